@@ -0,0 +1,207 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "Arena.h"
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+typedef unsigned char byte_t;
+
+typedef struct arenablock_s
+{
+   struct arenablock_s * next;
+   size_t size;
+   size_t used;
+   size_t last;
+} ArenaBlock_T;
+
+struct arena_s
+{
+   ArenaBlock_T * head;
+   size_t blockSize;
+   size_t used;
+};
+
+static ArenaBlock_T * Arena_NewBlock(Arena_T arena, size_t size);
+static byte_t * Arena_BlockData(ArenaBlock_T * block);
+static void * Arena_Alloc(void * context, size_t size, size_t alignment);
+static void * Arena_Realloc(void * context, void * ptr, size_t oldSize, size_t newSize, 
+                            size_t alignment);
+static void Arena_Free(void * context, void * ptr, size_t size, size_t alignment);
+
+
+Arena_T Arena_Create(size_t blockSize)
+{
+   Arena_T arena = malloc(sizeof(struct arena_s));
+   arena->head      = NULL;
+   arena->blockSize = blockSize;
+   arena->used      = 0;
+   (void)Arena_NewBlock(arena, blockSize);
+   return arena;
+}
+
+void Arena_GetAllocator(Arena_T arena, CompSystem_Allocator_T * allocator)
+{
+   allocator->allocFunc   = Arena_Alloc;
+   allocator->reallocFunc = Arena_Realloc;
+   allocator->freeFunc    = Arena_Free;
+   allocator->context     = arena;
+}
+
+void Arena_GetUsage(const Arena_T arena, size_t * used, size_t * reserved)
+{
+   ArenaBlock_T * block;
+   
+   (*used) = arena->used;
+   (*reserved) = 0;
+   for(block = arena->head; block != NULL; block = block->next)
+   {
+      (*reserved) += block->size;
+   }
+}
+
+void Arena_Reset(Arena_T arena)
+{
+   ArenaBlock_T * block, * next;
+   size_t total;
+   
+   if(arena->head->next == NULL)
+   {
+      arena->head->used = 0;
+      arena->head->last = 0;
+   }
+   else
+   {
+      // Replace the chain with one block big enough for all of it
+      total = 0;
+      for(block = arena->head; block != NULL; block = next)
+      {
+         next = block->next;
+         total += block->size;
+         free(block);
+      }
+      arena->head = NULL;
+      (void)Arena_NewBlock(arena, total);
+   }
+   arena->used = 0;
+}
+
+void Arena_Destroy(Arena_T arena)
+{
+   ArenaBlock_T * block, * next;
+   
+   for(block = arena->head; block != NULL; block = next)
+   {
+      next = block->next;
+      free(block);
+   }
+   free(arena);
+}
+
+
+static ArenaBlock_T * Arena_NewBlock(Arena_T arena, size_t size)
+{
+   ArenaBlock_T * block;
+   
+   block = malloc(sizeof(ArenaBlock_T) + size);
+   block->next = arena->head;
+   block->size = size;
+   block->used = 0;
+   block->last = 0;
+   arena->head = block;
+   return block;
+}
+
+static byte_t * Arena_BlockData(ArenaBlock_T * block)
+{
+   return (byte_t *)(block + 1);
+}
+
+static void * Arena_Alloc(void * context, size_t size, size_t alignment)
+{
+   Arena_T arena;
+   ArenaBlock_T * block;
+   size_t offset;
+   
+   arena = context;
+   block = arena->head;
+   offset = (((size_t)Arena_BlockData(block) + block->used + alignment - 1) & ~(alignment - 1)) - 
+            (size_t)Arena_BlockData(block);
+   if(offset + size > block->size)
+   {
+      block = Arena_NewBlock(arena, MAX(arena->blockSize, size + alignment));
+      offset = (((size_t)Arena_BlockData(block) + alignment - 1) & ~(alignment - 1)) - 
+               (size_t)Arena_BlockData(block);
+   }
+   
+   arena->used += offset + size - block->used;
+   block->last = offset;
+   block->used = offset + size;
+   return Arena_BlockData(block) + offset;
+}
+
+static void * Arena_Realloc(void * context, void * ptr, size_t oldSize, size_t newSize, 
+                            size_t alignment)
+{
+   Arena_T arena;
+   ArenaBlock_T * block;
+   void * temp;
+   
+   // The latest allocation can grow or shrink where it is
+   arena = context;
+   block = arena->head;
+   if((byte_t *)ptr == Arena_BlockData(block) + block->last &&
+      block->last + newSize <= block->size)
+   {
+      arena->used = arena->used - block->used + block->last + newSize;
+      block->used = block->last + newSize;
+      return ptr;
+   }
+   
+   temp = Arena_Alloc(context, newSize, alignment);
+   memcpy(temp, ptr, MIN(oldSize, newSize));
+   return temp;
+}
+
+static void Arena_Free(void * context, void * ptr, size_t size, size_t alignment)
+{
+   Arena_T arena;
+   ArenaBlock_T * block;
+   (void)size;
+   (void)alignment;
+   
+   // Only the latest allocation can be handed back before a reset
+   arena = context;
+   block = arena->head;
+   if((byte_t *)ptr == Arena_BlockData(block) + block->last && block->used > 0)
+   {
+      arena->used -= block->used - block->last;
+      block->used = block->last;
+   }
+}
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "CompSystem.h"
+
+typedef struct arena_s * Arena_T;
+
+// Bump allocator for CompSystem_CreateWithAllocator. Memory comes from
+// blocks of at least blockSize bytes, only the latest allocation can grow in
+// place or be given back, everything else is reclaimed by Arena_Reset. The
+// reset folds all blocks into one, so a world that is rebuilt every frame
+// settles into a single block. Resetting without CompSystem_Destroy skips
+// the destroy functions and leaks the thread pool, if one was started.
+Arena_T Arena_Create(size_t blockSize);
+void Arena_GetAllocator(Arena_T arena, CompSystem_Allocator_T * allocator);
+void Arena_GetUsage(const Arena_T arena, size_t * used, size_t * reserved);
+void Arena_Reset(Arena_T arena);
+void Arena_Destroy(Arena_T arena);
+
+#endif // __ARENA_H__
+
@@ -24,12 +24,76 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
+// clock_gettime for the stats build is hidden by -std=c99 without this
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "CompSystem.h"
+#include "ThreadPool.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMPSYSTEM_SSE2
+#include <emmintrin.h>
+#endif
+
+#define MIN_ARRAY_SIZE 16
+#define DEFAULT_ALIGNMENT 16
+#define FIELD_ALIGNMENT 64
+
+// Tracked types keep the newest change tick of every run of CHANGE_CHUNK
+// components, so iterators skip unchanged runs without reading them
+#define CHANGE_CHUNK 64
+#define CHUNK_COUNT(size) (((size) + CHANGE_CHUNK - 1) / CHANGE_CHUNK)
+#define VERSION_BYTES (2 * sizeof(comptick_t))
+
+// Spatial indexes start with this many buckets and double them whenever
+// they hold more actors than buckets
+#define SPATIAL_MIN_BUCKETS 64
+#define SPATIAL_MAX_CELL    1.0e9f
+
+// Key index tables start with this many entries and double before they
+// are half used, counting deleted entries
+#define KEY_MIN_ENTRIES 64
+
+#define PAGE_SIZE(compTypePtr) (1 << (compTypePtr)->pageShift)
+#define POOL_EXISTS(compTypePtr) ((compTypePtr)->compArray != NULL || (compTypePtr)->pageArray != NULL)
 
-#define GROW_BY 16
+// Counters and trace hooks cost nothing unless built with COMPSYSTEM_STATS
+#ifdef COMPSYSTEM_STATS
+#define STATS_ADD(sys, counter, amount) ((sys)->stats.counter += (amount))
+#define TRACE_CLOCK() CompSystem_TraceClock()
+#define TRACE_EVENT(sys, event, start) CompSystem_TraceEvent((sys), (event), (start))
+#else
+#define STATS_ADD(sys, counter, amount) ((void)0)
+#define TRACE_CLOCK() 0
+#define TRACE_EVENT(sys, event, start) ((void)(start))
+#endif
+
+#define SNAPSHOT_MAGIC     0x50414E53u
+#define SNAPSHOT_VERSION   1
+#define SNAPSHOT_ALIGNMENT 64
+#define SNAPSHOT_TEMP_SUFFIX ".tmp"
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// Component index of an actor in a type's pool, kept in one type-major
+// table with a row per type and a column per actor slot
+#define INDEX_ENTRY(sys, type, actor) \
+   ((sys)->indexTable[(size_t)(type) * (sys)->slotInfo.arySize + COMPSYSTEM_ACTOR_INDEX(actor)])
 
 
 
@@ -44,69 +108,589 @@ typedef struct arrayinfo_s
 typedef struct actor_s
 {
    actorid_t id;
-   int * compIndexArray;
+   int archetype;
+   CompSystem_TypeMask_T signature;
 } Actor_T;
 
+typedef struct actorslot_s
+{
+   int actorIndex;
+   int nextFree;
+   actorid_t generation;
+} ActorSlot_T;
+
+// In archetype storage every pool is split into one segment per archetype
+// that holds the type, ordered by archetype index. start[] is where the
+// segment of each type begins; it ends where the next segment begins.
+typedef struct archetype_s
+{
+   CompSystem_TypeMask_T mask;
+   int count;
+   int aligned;
+   int start[COMPSYSTEM_MASK_TYPES];
+   int addEdge[COMPSYSTEM_MASK_TYPES];
+   int removeEdge[COMPSYSTEM_MASK_TYPES];
+} Archetype_T;
+
+// Types set up with fields keep one column per field inside compArray.
+// Column f begins at compInfo.arySize * start and holds size bytes per element.
+typedef struct field_s
+{
+   int size;
+   int start;
+} Field_T;
+
+// A spatial index hashes the actors of a type by the grid cell of their
+// position. Entries are kept per actor slot and chained per bucket, so pool
+// moves never touch them. Each entry holds the position it was indexed at.
+typedef struct spatialentry_s
+{
+   actorid_t actor;
+   int bucket;
+   int next;
+   int prev;
+   int cell[3];
+   float pos[3];
+} SpatialEntry_T;
+
+typedef struct spatial_s
+{
+   int offset;
+   int dimensions;
+   float invCellSize;
+   int * bucketArray;
+   int bucketCount;
+   SpatialEntry_T * entryArray;
+   int entrySize;
+   int entryCount;
+   comptick_t tick;
+   int rebuild;
+} Spatial_T;
+
+// Paged types keep their components in pages of 1 << pageShift elements
+// instead of compArray, so growing never moves a component. Tags have no
+// pool at all, an actor has one when its signature bit is set. layout
+// changes whenever components of the pool move in bulk.
 typedef struct comptype_s
 {
    byte_t * compArray;
-   Actor_T ** actorPtrArray;
+   byte_t ** pageArray;
+   ArrayInfo_T pageInfo;
+   int pageShift;
+   actorid_t * actorIdArray;
    ArrayInfo_T compInfo;
    int elementSize;
+   int stride;
+   int alignment;
+   Field_T * fieldArray;
+   int fieldCount;
+   int tracked;
+   comptick_t * addedArray;
+   comptick_t * changedArray;
+   comptick_t * chunkArray;
+   int group;
+   unsigned long long growCount;
    CompSystem_DestroyFunc_T destroyFunc;
+   CompSystem_DestroyRangeFunc_T destroyRangeFunc;
+   int trivial;
+   int tag;
+   unsigned int layout;
+   Spatial_T * spatial;
    
 } CompType_T;
 
+// A cached query holds its members with includeCount indices each in
+// tupleArray. positionArray maps an actor slot to its member position plus
+// one, so zeroed entries are not members. layout[k] is the layout of
+// include[k] the indices were read at.
+typedef struct cachedquery_s
+{
+   CompSystem_Query_T filter;
+   actorid_t * memberArray;
+   int * tupleArray;
+   ArrayInfo_T memberInfo;
+   int * positionArray;
+   int positionSize;
+   unsigned int layout[COMPSYSTEM_QUERY_MAX_TYPES];
+   int dirty;
+} CachedQuery_T;
+
+// A key index hashes the components of one type by the keySize bytes at
+// keyOffset, with open addressing and linear probing. Entries only hold the
+// actor and hash, keys are compared in the pool. slotArray keeps, per actor
+// slot, the entry plus one and whether the key still has to be hashed, since
+// SetComponent hands out the component before its key is written.
+enum
+{
+   eKey_Empty,
+   eKey_Live,
+   eKey_Deleted
+};
+
+typedef struct keyentry_s
+{
+   actorid_t actor;
+   unsigned int hash;
+   int state;
+} KeyEntry_T;
+
+typedef struct keyslot_s
+{
+   int entry;
+   int pending;
+} KeySlot_T;
+
+typedef struct keyindex_s
+{
+   comptypeid_t type;
+   int keyOffset;
+   int keySize;
+   KeyEntry_T * entryArray;
+   int entrySize;
+   int liveCount;
+   int usedCount;
+   KeySlot_T * slotArray;
+   int slotSize;
+   actorid_t * pendingArray;
+   ArrayInfo_T pendingInfo;
+   int rebuild;
+} KeyIndex_T;
+
+typedef struct system_s
+{
+   CompSystem_SystemFunc_T func;
+   void * userData;
+   CompSystem_TypeMask_T reads;
+   CompSystem_TypeMask_T writes;
+   int exclusive;
+   int wave;
+} System_T;
+
+// A group owns its types: the size actors owning all of them sit at the front
+// of each of those pools, in the same order
+typedef struct group_s
+{
+   comptypeid_t * typeList;
+   int typeCount;
+   int size;
+} Group_T;
+
+// A captured frame holds the counts the system had when it began and an undo
+// journal of every table entry and component overwritten since. Each record
+// is the old bytes followed by their header, so the journal replays backwards.
+// Entries at or past the limits, the highest counts of this frame and the
+// ones before it, are never read back and are not journaled.
+typedef struct frame_s
+{
+   byte_t * journal;
+   ArrayInfo_T journalInfo;
+   int * countArray;
+   int * limitArray;
+   ArrayInfo_T countInfo;
+   int actorCount;
+   int actorLimit;
+   int slotCount;
+   int freeSlot;
+} Frame_T;
+
+enum
+{
+   eJournal_Component,
+   eJournal_ActorId,
+   eJournal_IndexEntry,
+   eJournal_Actor,
+   eJournal_Slot,
+   eJournal_GroupSize
+};
+
+typedef struct journalentry_s
+{
+   int kind;
+   int type;
+   int index;
+   int size;
+} JournalEntry_T;
+
 struct compsystem_s
 {
+   CompSystem_Allocator_T allocator;
    CompType_T  * typeArray;
    Actor_T     * actorArray;
+   ActorSlot_T * slotArray;
+   int         * indexTable;
    ArrayInfo_T   typeInfo;
    ArrayInfo_T   actorInfo;
-   actorid_t     nextActorID;
+   ArrayInfo_T   slotInfo;
+   int           freeSlot;
+   
+   CompSystem_Storage_T storage;
+   Archetype_T * archArray;
+   ArrayInfo_T   archInfo;
+   byte_t      * scratch;
+   int           scratchSize;
+   comptick_t    tick;
+   
+   ThreadPool_T         threadPool;
+   int                  threadCount;
+   int                  parallel;
+   CompSystem_Query_T * threadQueries;
+   CompSystem_CommandBuffer_T * bufferArray;
+   
+   System_T    * systemArray;
+   ArrayInfo_T   systemInfo;
+   int         * scheduleArray;
+   int           scheduleDirty;
+   
+   byte_t      * mapBase;
+   size_t        mapSize;
+   
+   Group_T     * groupArray;
+   ArrayInfo_T   groupInfo;
+   
+   CachedQuery_T * cachedArray;
+   ArrayInfo_T     cachedInfo;
+   int             spatialCount;
+   
+   KeyIndex_T    * keyIndexArray;
+   ArrayInfo_T     keyIndexInfo;
+   
+   Frame_T     * frameArray;
+   int           frameHead;
+   int           frameCount;
+   
+   CompSystem_Stats_T      stats;
+   CompSystem_TraceFunc_T  traceFunc;
+   void                  * traceData;
+};
+
+// Snapshot files start with this header and one entry per type, followed by
+// the tables and pools at the offsets given, each on a 64 byte boundary so a
+// mapped file can be used in place. layout[] holds the sizes of the raw
+// structures, files from a build where they differ are refused.
+typedef struct snapshotheader_s
+{
+   unsigned int magic;
+   unsigned int version;
+   unsigned int layout[6];
+   int storage;
+   int typeCount;
+   int typeRows;
+   int actorCount;
+   int slotCount;
+   int freeSlot;
+   int archCount;
+   int reserved;
+   long long actorOffset;
+   long long slotOffset;
+   long long indexOffset;
+   long long archOffset;
+} SnapshotHeader_T;
+
+typedef struct snapshottype_s
+{
+   int elementSize;
+   int fieldCount;
+   int count;
+   int capacity;
+   int reserved;
+   long long compOffset;
+   long long actorIdOffset;
+} SnapshotType_T;
+
+enum
+{
+   eCommand_NewActor,
+   eCommand_SetComponent,
+   eCommand_RemoveActor
+};
+
+// Recorded commands are a header followed by the component bytes, if any,
+// padded so the next header stays aligned
+typedef struct command_s
+{
+   int op;
+   actorid_t actor;
+   comptypeid_t type;
+   int size;
+} Command_T;
+
+#define COMMAND_ALIGN(size) (((size) + 7) & ~7)
+
+struct compsystem_commandbuffer_s
+{
+   CompSystem_T sys;
+   byte_t    * data;
+   ArrayInfo_T dataInfo;
+   actorid_t * resolvedArray;
+   ArrayInfo_T resolvedInfo;
+   int         flushed;
 };
 
-static int CompSystem_SetArraySize(void ** array, int elementSize, int size, int newSize);
-static int CompSystem_GrowArraySize(void ** array, int elementSize, int size, int delta);
+typedef struct paralleljob_s
+{
+   CompSystem_T sys;
+   CompType_T * compTypePtr;
+   const CompSystem_Query_T * query;
+   CompSystem_KernelFunc_T kernel;
+   CompSystem_QueryKernelFunc_T queryKernel;
+   void * userData;
+   const int * systems;
+   int grainSize;
+   int count;
+} ParallelJob_T;
+
+static void * CompSystem_DefaultAlloc(void * context, size_t size, size_t alignment);
+static void * CompSystem_DefaultRealloc(void * context, void * ptr, size_t oldSize, 
+                                        size_t newSize, size_t alignment);
+static void CompSystem_DefaultFree(void * context, void * ptr, size_t size, size_t alignment);
+static void * CompSystem_Alloc(CompSystem_T sys, size_t size);
+static void CompSystem_Free(CompSystem_T sys, void * ptr, size_t size);
+static void CompSystem_FreeAligned(CompSystem_T sys, void * ptr, size_t size, size_t alignment);
+static int CompSystem_IsMapped(CompSystem_T sys, const void * ptr);
+static void CompSystem_ReleaseMapping(CompSystem_T sys);
+static void CompSystem_SnapshotLayout(unsigned int * layout);
+static void CompSystem_SnapshotWrite(FILE * file, long long * offset, const void * data, 
+                                     size_t size);
+static void CompSystem_SnapshotPad(FILE * file, long long * offset, size_t alignment);
+static int CompSystem_SnapshotCheck(CompSystem_T sys, const byte_t * base, size_t size);
+static void CompSystem_MapFile(CompSystem_T sys, const char * filename, byte_t ** base, 
+                               size_t * size);
+static void CompSystem_UnmapFile(CompSystem_T sys, byte_t * base, size_t size);
+static void CompSystem_ClearPool(CompSystem_T sys, comptypeid_t type);
+static int CompSystem_SetArraySize(CompSystem_T sys, void ** array, int elementSize, int alignment,
+                                   int size, int newSize);
+static int CompSystem_GrowArraySize(CompSystem_T sys, void ** array, int elementSize, 
+                                    int size, int minSize);
 static int CompSystem_FindActorFromID(CompSystem_T sys, actorid_t actor);
-static void CompSystem_UpdateAllActorPointers(CompSystem_T sys);
-static void CompSystem_UpdateActorPointers(CompSystem_T sys, Actor_T * actorPtr);
-static void CompSystem_MoveMemory(void * dest, void * src, int elementSize);
-static void CompSystem_DestroyComponent(CompSystem_T sys, comptypeid_t type, 
-                                        actorid_t actor, 
-                                        CompSystem_DestroyFunc_T destroyFunc, 
-                                        void * comp);
+static Actor_T * CompSystem_GetActorPtr(CompSystem_T sys, actorid_t actor);
+static actorid_t CompSystem_AcquireSlot(CompSystem_T sys, int actorIndex);
+static void CompSystem_ReleaseSlot(CompSystem_T sys, actorid_t actor);
+static void CompSystem_GrowComponentArrays(CompSystem_T sys, CompType_T * compTypePtr, int minSize);
+static void CompSystem_FreeComponentArrays(CompSystem_T sys, CompType_T * compTypePtr);
+static void CompSystem_ResizeVersions(CompSystem_T sys, CompType_T * compTypePtr, int oldSize);
+static void CompSystem_StampElements(CompType_T * compTypePtr, int first, int count, 
+                                     comptick_t tick, int added);
+static void CompSystem_NextChangedRun(const CompType_T * compTypePtr, const comptick_t * versions,
+                                      comptick_t tick, int * position, int * first, int * count);
+static void CompSystem_GrowSlots(CompSystem_T sys, int minSize);
+static void CompSystem_SetTypeLayout(CompSystem_T sys, comptypeid_t type, int elementSize, 
+                                     int alignment, const CompSystem_Field_T * fields, 
+                                     int fieldCount, CompSystem_DestroyFunc_T destroyFunc);
+static byte_t * CompSystem_ElementPtr(const CompType_T * compTypePtr, int index);
+static int CompSystem_PageRun(const CompType_T * compTypePtr, int index, int count);
+static void CompSystem_GrowPages(CompSystem_T sys, CompType_T * compTypePtr);
+static void CompSystem_AdoptPages(CompSystem_T sys, CompType_T * compTypePtr);
+static void CompSystem_CopyElements(CompType_T * compTypePtr, int to, int from, int count);
+static void CompSystem_ReadElement(const CompType_T * compTypePtr, int index, byte_t * out);
+static void CompSystem_WriteElement(CompType_T * compTypePtr, int index, const byte_t * in);
+static void CompSystem_ReadVersions(const CompType_T * compTypePtr, int index, byte_t * out);
+static void CompSystem_Journal(CompSystem_T sys, int kind, comptypeid_t type, int index);
+static void CompSystem_JournalRange(CompSystem_T sys, int kind, comptypeid_t type, 
+                                   int first, int count);
+static void CompSystem_JournalEntry(CompSystem_T sys, int kind, comptypeid_t type, int index);
+static void CompSystem_OpenFrame(CompSystem_T sys, Frame_T * framePtr);
+static void CompSystem_UndoFrame(CompSystem_T sys, Frame_T * framePtr);
+static void CompSystem_WriteVersions(CompType_T * compTypePtr, int index, const byte_t * in);
+static void CompSystem_DestroyComponents(CompSystem_T sys, comptypeid_t type, 
+                                         int first, int count);
+static actorid_t CompSystem_QueryOwner(const CompSystem_Query_T * query, int position);
+static int CompSystem_QueryMatchActor(const CompSystem_Query_T * query, actorid_t actor,
+                                      int * indices, int stride);
+static int CompSystem_MaskMatches(const CompSystem_TypeMask_T * signature,
+                                  const CompSystem_TypeMask_T * include,
+                                  const CompSystem_TypeMask_T * exclude);
+static void CompSystem_UpdateQueries(CompSystem_T sys, actorid_t actor, comptypeid_t type);
+static void CompSystem_LeaveQueries(CompSystem_T sys, actorid_t actor);
+static void CompSystem_QueryMoved(CompSystem_T sys, actorid_t actor);
+static void CompSystem_QueryJoin(CompSystem_T sys, CachedQuery_T * cachedPtr, 
+                                 actorid_t actor, const int * indices);
+static void CompSystem_QueryDrop(CachedQuery_T * cachedPtr, int position);
+static void CompSystem_RebuildQuery(CompSystem_T sys, CachedQuery_T * cachedPtr);
+static void CompSystem_DirtyQueries(CompSystem_T sys);
+static int CompSystem_SpatialCell(float value, float invCellSize);
+static int CompSystem_SpatialBucket(const Spatial_T * spatial, const int * cell);
+static void CompSystem_SpatialInsert(CompSystem_T sys, Spatial_T * spatial, actorid_t actor, 
+                                     const byte_t * comp);
+static void CompSystem_SpatialUnlink(Spatial_T * spatial, int slot);
+static void CompSystem_SpatialGrowBuckets(CompSystem_T sys, Spatial_T * spatial);
+static int CompSystem_SpatialSearch(const Spatial_T * spatial, const float * lower, 
+                                    const float * upper, const float * center, float radius,
+                                    actorid_t * outIds, int maxCount);
+static void CompSystem_LeaveSpatial(CompSystem_T sys, actorid_t actor);
+static void CompSystem_ResetSpatial(CompSystem_T sys);
+static unsigned int CompSystem_KeyHash(const byte_t * key, int size);
+static KeySlot_T * CompSystem_KeySlot(CompSystem_T sys, KeyIndex_T * keyIndexPtr, actorid_t actor);
+static void CompSystem_KeyIndexMark(CompSystem_T sys, comptypeid_t type, actorid_t actor);
+static void CompSystem_KeyIndexRemove(CompSystem_T sys, comptypeid_t type, actorid_t actor);
+static void CompSystem_KeyIndexUnlink(KeyIndex_T * keyIndexPtr, KeySlot_T * slotPtr);
+static void CompSystem_KeyIndexInsert(CompSystem_T sys, KeyIndex_T * keyIndexPtr, actorid_t actor);
+static void CompSystem_KeyIndexResize(CompSystem_T sys, KeyIndex_T * keyIndexPtr, int newSize);
+static void CompSystem_KeyIndexRefresh(CompSystem_T sys, KeyIndex_T * keyIndexPtr);
+static void CompSystem_ResetKeyIndexes(CompSystem_T sys);
+static void CompSystem_MovePoolElements(CompSystem_T sys, comptypeid_t type, 
+                                        int from, int to, int count);
+static void CompSystem_SwapPoolElements(CompSystem_T sys, comptypeid_t type, int a, int b);
+static int CompSystem_FindArchetype(CompSystem_T sys, const CompSystem_TypeMask_T * mask);
+static int CompSystem_NextArchetypeWithType(CompSystem_T sys, comptypeid_t type, int after);
+static int CompSystem_SegmentEnd(CompSystem_T sys, comptypeid_t type, int arch);
+static int CompSystem_OpenSegmentGap(CompSystem_T sys, comptypeid_t type, int arch, int count);
+static void CompSystem_CloseSegmentGap(CompSystem_T sys, comptypeid_t type, int arch, int count);
+static void CompSystem_ArchetypeAddComponent(CompSystem_T sys, Actor_T * actorPtr, comptypeid_t type);
+static void CompSystem_ArchetypeRemoveComponent(CompSystem_T sys, Actor_T * actorPtr, comptypeid_t type);
+static void CompSystem_ArchetypeRemoveComponents(CompSystem_T sys, Actor_T * actorPtr);
+static void CompSystem_AlignArchetype(CompSystem_T sys, int arch);
+static void CompSystem_AlignSegments(CompSystem_T sys, int arch, comptypeid_t lead);
+static void CompSystem_SortRange(CompSystem_T sys, comptypeid_t type, int first, int count,
+                                 CompSystem_CompareFunc_T compareFunc, void * userData);
+static int CompSystem_GroupHas(const CompSystem_T sys, int group, actorid_t actor);
+static void CompSystem_GroupEnter(CompSystem_T sys, int group, actorid_t actor);
+static void CompSystem_GroupLeave(CompSystem_T sys, int group, actorid_t actor);
+static void CompSystem_GroupAlign(CompSystem_T sys, int group, comptypeid_t lead);
+static void CompSystem_BuildGroup(CompSystem_T sys, int group);
+static size_t CompSystem_PoolBytes(const CompType_T * compTypePtr, int count);
+#ifdef COMPSYSTEM_STATS
+static unsigned long long CompSystem_TraceClock(void);
+static void CompSystem_TraceEvent(CompSystem_T sys, const char * event, unsigned long long start);
+#endif
+static ThreadPool_T CompSystem_GetThreadPool(CompSystem_T sys);
+static void CompSystem_RunParallel(CompSystem_T sys, ThreadPool_TaskFunc_T func, 
+                                   void * userData, int taskCount);
+static void CompSystem_StopThreads(CompSystem_T sys);
+static void CompSystem_RecordCommand(CompSystem_CommandBuffer_T buffer, int op, actorid_t actor,
+                                     comptypeid_t type, const void * comp, int size);
+static actorid_t CompSystem_ResolvePending(CompSystem_CommandBuffer_T buffer, actorid_t actor);
+static void CompSystem_ParallelForTask(void * userData, int taskIndex, int threadIndex);
+static void CompSystem_ParallelQueryTask(void * userData, int taskIndex, int threadIndex);
+static int CompSystem_SystemsConflict(const System_T * a, const System_T * b);
+static void CompSystem_BuildSchedule(CompSystem_T sys);
+static void CompSystem_SystemTask(void * userData, int taskIndex, int threadIndex);
 
 
 CompSystem_T CompSystem_Create(void)
 {
-   CompSystem_T sys = malloc(sizeof(struct compsystem_s));
+   return CompSystem_CreateWithStorage(eCompSystem_Storage_Packed);
+}
+
+CompSystem_T CompSystem_CreateWithStorage(CompSystem_Storage_T storage)
+{
+   CompSystem_Allocator_T allocator;
+   
+   allocator.allocFunc   = CompSystem_DefaultAlloc;
+   allocator.reallocFunc = CompSystem_DefaultRealloc;
+   allocator.freeFunc    = CompSystem_DefaultFree;
+   allocator.context     = NULL;
+   return CompSystem_CreateWithAllocator(&allocator, storage);
+}
+
+CompSystem_T CompSystem_CreateWithAllocator(const CompSystem_Allocator_T * allocator, 
+                                            CompSystem_Storage_T storage)
+{
+   CompSystem_TypeMask_T emptyMask;
+   CompSystem_T sys = allocator->allocFunc(allocator->context, sizeof(struct compsystem_s), 
+                                           DEFAULT_ALIGNMENT);
+   sys->allocator = (*allocator);
+   
    // Create Empty Type Array
-   sys->typeArray = calloc(GROW_BY, sizeof(CompType_T));
-   sys->typeInfo.arySize = GROW_BY;
+   sys->typeArray = NULL;
+   sys->typeInfo.arySize = CompSystem_SetArraySize(sys, (void**)&sys->typeArray, 
+                                                   sizeof(CompType_T), DEFAULT_ALIGNMENT,
+                                                   0, MIN_ARRAY_SIZE);
    sys->typeInfo.eleCount = 0;
    
    // Create Empty Actor Array
-   sys->actorArray = calloc(GROW_BY, sizeof(Actor_T));
-   sys->actorInfo.arySize = GROW_BY;
+   sys->actorArray = NULL;
+   sys->actorInfo.arySize = CompSystem_SetArraySize(sys, (void**)&sys->actorArray, 
+                                                    sizeof(Actor_T), DEFAULT_ALIGNMENT,
+                                                    0, MIN_ARRAY_SIZE);
    sys->actorInfo.eleCount = 0;
 
-   sys->nextActorID = 0;
+   // Create Empty Actor Lookup Table
+   sys->slotArray = NULL;
+   sys->slotInfo.arySize = CompSystem_SetArraySize(sys, (void**)&sys->slotArray, 
+                                                   sizeof(ActorSlot_T), DEFAULT_ALIGNMENT,
+                                                   0, MIN_ARRAY_SIZE);
+   sys->slotInfo.eleCount = 0;
+   sys->freeSlot = COMPSYSTEM_INVALID_INDEX;
+   
+   // Create Empty Index Table, one row per type
+   sys->indexTable = CompSystem_Alloc(sys, sizeof(int) * sys->typeInfo.arySize * 
+                                           sys->slotInfo.arySize);
+   
+   // Archetype Storage starts with the empty archetype every new actor joins
+   sys->storage          = storage;
+   sys->archArray        = NULL;
+   sys->archInfo.arySize  = 0;
+   sys->archInfo.eleCount = 0;
+   sys->scratch          = NULL;
+   sys->scratchSize      = 0;
+   sys->tick             = 1;
+   
+   // The thread pool is started by the first parallel call
+   sys->threadPool       = NULL;
+   sys->threadCount      = 0;
+   sys->parallel         = 0;
+   sys->threadQueries    = NULL;
+   sys->bufferArray      = NULL;
+   
+   sys->systemArray       = NULL;
+   sys->systemInfo.arySize  = 0;
+   sys->systemInfo.eleCount = 0;
+   sys->scheduleArray     = NULL;
+   sys->scheduleDirty     = 0;
+   
+   sys->mapBase = NULL;
+   sys->mapSize = 0;
+   
+   sys->groupArray = NULL;
+   sys->groupInfo.arySize  = 0;
+   sys->groupInfo.eleCount = 0;
+   
+   sys->cachedArray = NULL;
+   sys->cachedInfo.arySize  = 0;
+   sys->cachedInfo.eleCount = 0;
+   sys->spatialCount = 0;
+   
+   sys->keyIndexArray = NULL;
+   sys->keyIndexInfo.arySize  = 0;
+   sys->keyIndexInfo.eleCount = 0;
+   
+   sys->frameArray = NULL;
+   sys->frameHead  = 0;
+   sys->frameCount = 0;
+   
+   memset(&sys->stats, 0, sizeof(CompSystem_Stats_T));
+   sys->traceFunc = NULL;
+   sys->traceData = NULL;
+   if(storage == eCompSystem_Storage_Archetype)
+   {
+      CompSystem_ClearMask(&emptyMask);
+      (void)CompSystem_FindArchetype(sys, &emptyMask);
+   }
    return sys;
 }
 
+void CompSystem_ClearMask(CompSystem_TypeMask_T * mask)
+{
+   memset(mask, 0, sizeof(CompSystem_TypeMask_T));
+}
+
 void CompSystem_NewType(CompSystem_T sys, comptypeid_t * type)
 {   
    CompType_T * compTypePtr;
-   Actor_T * actorPtr;
    int i, oldSize;
    
    if(sys->typeInfo.eleCount >= sys->typeInfo.arySize)
    {
-      sys->typeInfo.arySize = CompSystem_GrowArraySize((void **)&sys->typeArray, 
+      oldSize = sys->typeInfo.arySize;
+      sys->typeInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->typeArray, 
                                                        sizeof(CompType_T),
-                                                       sys->typeInfo.arySize,
-                                                       GROW_BY);
+                                                       oldSize,
+                                                       sys->typeInfo.eleCount + 1);
+      
+      // Rows are type-major, so new rows just extend the table
+      (void)CompSystem_SetArraySize(sys, (void**)&sys->indexTable, 
+                                    sizeof(int) * sys->slotInfo.arySize, DEFAULT_ALIGNMENT,
+                                    oldSize, sys->typeInfo.arySize);
    }
    oldSize = sys->typeInfo.eleCount;
    (*type) = oldSize;
@@ -115,117 +699,223 @@ void CompSystem_NewType(CompSystem_T sys, comptypeid_t * type)
    // Set Default Values
    compTypePtr = &sys->typeArray[(*type)];
    compTypePtr->compArray         = NULL;
-   compTypePtr->actorPtrArray     = NULL;
+   compTypePtr->pageArray         = NULL;
+   compTypePtr->pageInfo.arySize  = 0;
+   compTypePtr->pageInfo.eleCount = 0;
+   compTypePtr->pageShift         = 0;
+   compTypePtr->actorIdArray      = NULL;
    compTypePtr->compInfo.arySize  = 0;
    compTypePtr->compInfo.eleCount = 0;
    compTypePtr->elementSize       = 0;
+   compTypePtr->stride            = 0;
+   compTypePtr->alignment         = DEFAULT_ALIGNMENT;
+   compTypePtr->fieldArray        = NULL;
+   compTypePtr->fieldCount        = 0;
+   compTypePtr->tracked           = 0;
+   compTypePtr->addedArray        = NULL;
+   compTypePtr->changedArray      = NULL;
+   compTypePtr->chunkArray        = NULL;
+   compTypePtr->group             = COMPSYSTEM_INVALID_INDEX;
+   compTypePtr->growCount         = 0;
+   compTypePtr->destroyFunc       = NULL;
+   compTypePtr->destroyRangeFunc  = NULL;
+   compTypePtr->trivial           = 1;
+   compTypePtr->tag               = 0;
+   compTypePtr->layout            = 0;
+   compTypePtr->spatial           = NULL;
    
-   
-   // If there are any actors, expand their type pointers
-   for(i = 0; i < sys->actorInfo.eleCount; i++)
+   // No actor owns the new type yet
+   for(i = 0; i < sys->slotInfo.eleCount; i++)
    {
-      actorPtr = &sys->actorArray[i];
-      CompSystem_SetArraySize((void**)actorPtr->compIndexArray, 
-                              sizeof(byte_t *), 
-                              oldSize,
-                              sys->typeInfo.eleCount);
-      // Clear New Value
-      actorPtr->compIndexArray[(*type)] = COMPSYSTEM_INVALID_INDEX;
-      
+      sys->indexTable[(size_t)oldSize * sys->slotInfo.arySize + i] = COMPSYSTEM_INVALID_INDEX;
    }
 }
 
 void CompSystem_SetType(CompSystem_T sys, comptypeid_t type, int elementSize, CompSystem_DestroyFunc_T destroyFunc)
+{
+   CompSystem_SetTypeAligned(sys, type, elementSize, DEFAULT_ALIGNMENT, destroyFunc);
+}
+
+void CompSystem_SetTypeAligned(CompSystem_T sys, comptypeid_t type, int elementSize, 
+                               int alignment, CompSystem_DestroyFunc_T destroyFunc)
+{
+   CompSystem_SetTypeLayout(sys, type, elementSize, alignment, NULL, 0, destroyFunc);
+}
+
+void CompSystem_SetTypeFields(CompSystem_T sys, comptypeid_t type, 
+                              const CompSystem_Field_T * fields, int fieldCount)
+{
+   int elementSize, i;
+   
+   elementSize = 0;
+   for(i = 0; i < fieldCount; i++)
+   {
+      elementSize += fields[i].size;
+   }
+   
+   // Columns start at arySize multiples, so cache line aligned pools keep
+   // every column of 4 byte multiples on a cache line too
+   CompSystem_SetTypeLayout(sys, type, elementSize, FIELD_ALIGNMENT, fields, fieldCount, NULL);
+}
+
+void CompSystem_SetTypeDestroyRange(CompSystem_T sys, comptypeid_t type, 
+                                    CompSystem_DestroyRangeFunc_T destroyRangeFunc)
+{
+   CompType_T * compTypePtr;
+   compTypePtr = &sys->typeArray[type];
+   
+   compTypePtr->destroyFunc      = NULL;
+   compTypePtr->destroyRangeFunc = destroyRangeFunc;
+   compTypePtr->trivial          = (destroyRangeFunc == NULL);
+}
+
+void CompSystem_SetTypePaged(CompSystem_T sys, comptypeid_t type)
 {
    CompType_T * compTypePtr;
+   byte_t * compArray;
+   int pageSize, i;
    compTypePtr = &sys->typeArray[type];
    
-   // Remove old data if present
-   if(compTypePtr->compArray != NULL)
+   if(sys->storage == eCompSystem_Storage_Archetype || compTypePtr->fieldCount > 0 ||
+      compTypePtr->pageShift > 0 || !POOL_EXISTS(compTypePtr))
    {
-      free(compTypePtr->compArray);
-      free(compTypePtr->actorPtrArray);
+      return;
    }
    
-   // Create new buffers
-   compTypePtr->elementSize       = elementSize;
-   compTypePtr->destroyFunc       = destroyFunc;
-   compTypePtr->compInfo.arySize  = GROW_BY;
-   compTypePtr->compInfo.eleCount = 0;
-   compTypePtr->compArray         = calloc(GROW_BY, elementSize);
-   compTypePtr->actorPtrArray     = calloc(GROW_BY, sizeof(Actor_T*));
+   // The largest power of two of components that fits in COMPSYSTEM_PAGE_BYTES,
+   // but no less than MIN_ARRAY_SIZE
+   compTypePtr->pageShift = 4;
+   while(compTypePtr->pageShift < 20 && 
+         ((size_t)2 << compTypePtr->pageShift) * compTypePtr->elementSize <= COMPSYSTEM_PAGE_BYTES)
+   {
+      compTypePtr->pageShift ++;
+   }
+   
+   // Move the existing components over a page at a time
+   compArray = compTypePtr->compArray;
+   compTypePtr->compArray = NULL;
+   CompSystem_GrowPages(sys, compTypePtr);
+   pageSize = PAGE_SIZE(compTypePtr);
+   for(i = 0; i < compTypePtr->compInfo.eleCount; i += pageSize)
+   {
+      memcpy(compTypePtr->pageArray[i >> compTypePtr->pageShift], 
+             &compArray[(size_t)i * compTypePtr->elementSize],
+             (size_t)MIN(pageSize, compTypePtr->compInfo.eleCount - i) * compTypePtr->elementSize);
+   }
+   CompSystem_FreeAligned(sys, compArray, 
+                          (size_t)compTypePtr->compInfo.arySize * compTypePtr->elementSize,
+                          compTypePtr->alignment);
 }
 
-
 void CompSystem_NewActor(CompSystem_T sys, actorid_t * actor)
 {
    Actor_T * actorPtr;
+   actorid_t id;
+   unsigned long long traceStart;
    int actorIndex, i;
+   
+   traceStart = TRACE_CLOCK();
+   actorIndex = sys->actorInfo.eleCount;
+   id = CompSystem_AcquireSlot(sys, actorIndex);
+   if(id == COMPSYSTEM_INVALID_ACTOR)
+   {
+      (*actor) = COMPSYSTEM_INVALID_ACTOR;
+      return;
+   }
+   
    if(sys->actorInfo.eleCount >= sys->actorInfo.arySize)
    {
-      sys->actorInfo.arySize = CompSystem_GrowArraySize((void**)&sys->actorArray,
+      sys->actorInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->actorArray,
                                                          sizeof(Actor_T),
                                                          sys->actorInfo.arySize,
-                                                         GROW_BY);
-                                                         
-      CompSystem_UpdateAllActorPointers(sys);
+                                                         sys->actorInfo.eleCount + 1);
    }
-   actorIndex = sys->actorInfo.eleCount;
    sys->actorInfo.eleCount ++;
    
    // Init Actor
+   CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
    actorPtr = &sys->actorArray[actorIndex];
-   actorPtr->id = sys->nextActorID;
-   sys->nextActorID ++;
-   actorPtr->compIndexArray = calloc(sys->typeInfo.eleCount, sizeof(int));
+   actorPtr->id = id;
+   actorPtr->archetype = 0;
+   CompSystem_ClearMask(&actorPtr->signature);
+   if(sys->storage == eCompSystem_Storage_Archetype)
+   {
+      sys->archArray[0].count ++;
+   }
    for(i = 0; i < sys->typeInfo.eleCount; i ++)
    {
-      actorPtr->compIndexArray[i] = COMPSYSTEM_INVALID_INDEX;
+      CompSystem_Journal(sys, eJournal_IndexEntry, i, COMPSYSTEM_ACTOR_INDEX(id));
+      INDEX_ENTRY(sys, i, id) = COMPSYSTEM_INVALID_INDEX;
    }
    (*actor) = actorPtr->id;
+   STATS_ADD(sys, newActorCount, 1);
+   TRACE_EVENT(sys, "NewActor", traceStart);
 }
 
 void CompSystem_RemoveActor(CompSystem_T sys, actorid_t actor)
 {
-   int actorIndex, compType, compIndex, compIndexLast, actorIndexLast;
-   int compByteIndex, compByteIndexLast;
+   int actorIndex, compType, compIndex, compIndexLast, actorIndexLast, group;
    Actor_T * actorPtr, * actorPtrLast;
+   actorid_t actorLast;
    CompType_T * compTypePtr;
+   unsigned long long traceStart;
    
+   traceStart = TRACE_CLOCK();
    actorIndex = CompSystem_FindActorFromID(sys, actor);
    if(actorIndex != COMPSYSTEM_INVALID_INDEX)
    {
       actorPtr = &sys->actorArray[actorIndex];
-      // Overwrite each component and re-attach back to orignal Actor
-      for(compType = 0; compType < sys->typeInfo.eleCount; compType++)
-      {         
-         compIndex = actorPtr->compIndexArray[compType];
-         if(compIndex != COMPSYSTEM_INVALID_INDEX)
-         {
-            compTypePtr = &sys->typeArray[compType];
-            compIndexLast = compTypePtr->compInfo.eleCount - 1;
-            actorPtrLast = compTypePtr->actorPtrArray[compIndexLast];         
-            compByteIndex =     compIndex     * compTypePtr->elementSize;
-            compByteIndexLast = compIndexLast * compTypePtr->elementSize;
+      CompSystem_LeaveQueries(sys, actor);
+      CompSystem_LeaveSpatial(sys, actor);
+      CompSystem_KeyIndexRemove(sys, COMPSYSTEM_INVALID_INDEX, actor);
+      if(sys->storage == eCompSystem_Storage_Archetype)
+      {
+         CompSystem_ArchetypeRemoveComponents(sys, actorPtr);
+      }
+      else
+      {
+         for(group = 0; group < sys->groupInfo.eleCount; group++)
+         {
+            CompSystem_GroupLeave(sys, group, actor);
+         }
+         
+         // Overwrite each component and re-attach back to orignal Actor
+         for(compType = 0; compType < sys->typeInfo.eleCount; compType++)
+         {         
+            compIndex = INDEX_ENTRY(sys, compType, actorPtr->id);
+            if(compIndex != COMPSYSTEM_INVALID_INDEX)
+            {
+               compTypePtr = &sys->typeArray[compType];
+               compIndexLast = compTypePtr->compInfo.eleCount - 1;
+               actorLast = compTypePtr->actorIdArray[compIndexLast];
+               
+               CompSystem_Journal(sys, eJournal_Component, compType, compIndex);
+               CompSystem_Journal(sys, eJournal_ActorId, compType, compIndex);
+               CompSystem_Journal(sys, eJournal_IndexEntry, compType, 
+                                  COMPSYSTEM_ACTOR_INDEX(actorLast));
 
             
-            CompSystem_DestroyComponent(sys, compType, actor,
-                                        compTypePtr->destroyFunc,
-                                        &compTypePtr->compArray[compByteIndex]);
+               CompSystem_DestroyComponents(sys, compType, compIndex, 1);
                                         
             
-            // Move Last Element into this one
-            CompSystem_MoveMemory(&compTypePtr->compArray[compByteIndex], 
-                                  &compTypePtr->compArray[compByteIndexLast],
-                                  compTypePtr->elementSize);
+               // Move Last Element into this one
+               if(compIndex != compIndexLast)
+               {
+                  CompSystem_CopyElements(compTypePtr, compIndex, compIndexLast, 1);
+               }
                                   
-            // Re-attach Actor to component
+               // Re-attach Actor to component
             
-            compTypePtr->actorPtrArray[compIndex] = actorPtrLast;
-            actorPtrLast->compIndexArray[compType] = compIndex;
+               compTypePtr->actorIdArray[compIndex] = actorLast;
+               INDEX_ENTRY(sys, compType, actorLast) = compIndex;
+               if(actorLast != actor)
+               {
+                  CompSystem_QueryMoved(sys, actorLast);
+               }
             
-            // Decrement Size
-            compTypePtr->compInfo.eleCount --;
+               // Decrement Size
+               compTypePtr->compInfo.eleCount --;
+            }
          }
       }
       
@@ -233,311 +923,4790 @@ void CompSystem_RemoveActor(CompSystem_T sys, actorid_t actor)
       actorIndexLast = sys->actorInfo.eleCount - 1;
       actorPtrLast = &sys->actorArray[actorIndexLast];
       
-      free(actorPtr->compIndexArray);
       if(actorPtr != actorPtrLast)
       {
-         actorPtr->id = actorPtrLast->id;
-         actorPtr->compIndexArray = actorPtrLast->compIndexArray;
-         
-         CompSystem_UpdateActorPointers(sys, actorPtr);
+         CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
+         CompSystem_Journal(sys, eJournal_Slot, 0, COMPSYSTEM_ACTOR_INDEX(actorPtrLast->id));
+         (*actorPtr) = (*actorPtrLast);
+         sys->slotArray[COMPSYSTEM_ACTOR_INDEX(actorPtr->id)].actorIndex = actorIndex;
       }
-      actorPtrLast->compIndexArray = NULL;
+      CompSystem_ReleaseSlot(sys, actor);
       
       // Decrement Size
       sys->actorInfo.eleCount --;
-      
+      STATS_ADD(sys, removeActorCount, 1);
+      TRACE_EVENT(sys, "RemoveActor", traceStart);
       
    }
 }
 
-void CompSystem_SetComponent(CompSystem_T sys, actorid_t actor, comptypeid_t type, void ** compOut)
+void CompSystem_NewActors(CompSystem_T sys, int count, 
+                          const CompSystem_TypeMask_T * typeMask, 
+                          actorid_t * outIds)
 {
-   Actor_T * actorPtr;
    CompType_T * compTypePtr;
-   byte_t * dest;
-   int destOffset;
-   int destIndex;
-   int actorIndex;
+   Actor_T * actorPtr;
+   CompSystem_TypeMask_T mask, tags;
+   int i, type, created, firstIndex, arch, group;
    
-   compTypePtr = &sys->typeArray[type];
-   actorIndex = CompSystem_FindActorFromID(sys, actor);
-   if(actorIndex != COMPSYSTEM_INVALID_INDEX && compTypePtr != NULL)
+   CompSystem_ReserveActors(sys, sys->actorInfo.eleCount + count);
+   created = 0;
+   for(i = 0; i < count; i++)
    {
-      actorPtr = &sys->actorArray[actorIndex];
-      if(actorPtr->compIndexArray[type] == COMPSYSTEM_INVALID_INDEX)
-      {
-         // Grow if necessary
-         if(compTypePtr->compInfo.eleCount >= compTypePtr->compInfo.arySize)
-         {
-            
-
-            (void)CompSystem_GrowArraySize((void**)&compTypePtr->compArray, 
-                                           compTypePtr->elementSize,
-                                           compTypePtr->compInfo.arySize,
-                                           GROW_BY);
-            compTypePtr->compInfo.arySize = CompSystem_GrowArraySize((void**)&compTypePtr->actorPtrArray, 
-                                                                     sizeof(Actor_T*),
-                                                                     compTypePtr->compInfo.arySize,
-                                                                     GROW_BY);
-            
-
-
-         }
-         // Get offsets
-         destIndex  = compTypePtr->compInfo.eleCount;
-
-         // Set up references 
-         compTypePtr->actorPtrArray[destIndex] = actorPtr;
-         actorPtr->compIndexArray[type] = destIndex;
-         
-         // Inc count
-         compTypePtr->compInfo.eleCount ++;
-      }
-      else
+      CompSystem_NewActor(sys, &outIds[i]);
+      if(outIds[i] != COMPSYSTEM_INVALID_ACTOR)
       {
-         destIndex = actorPtr->compIndexArray[type];
+         created ++;
       }
-      
-      // do the copy
-      
-      destOffset = destIndex * compTypePtr->elementSize;
-      dest = &compTypePtr->compArray[destOffset];
    }
-   else
+   
+   if(typeMask == NULL)
    {
-      dest = NULL;
+      return;
    }
    
-   (*compOut) = dest;
-   
-   
-}
-
-void CompSystem_GetComponent(const CompSystem_T sys, actorid_t actor, comptypeid_t type, int * outIndex, void ** outPointer)
-{
-   Actor_T * actorPtr;
-   CompType_T * compTypePtr;
-   byte_t * outPtr;
-   int outInd, offset, actorIndex;   
-   
+   // Only types with a pool take part, tags just go into the signature
+   CompSystem_ClearMask(&mask);
+   CompSystem_ClearMask(&tags);
+   for(type = 0; type < sys->typeInfo.eleCount && type < COMPSYSTEM_MASK_TYPES; type++)
+   {
+      if(COMPSYSTEM_MASK_HAS(*typeMask, type) && POOL_EXISTS(&sys->typeArray[type]))
+      {
+         COMPSYSTEM_MASK_SET(mask, type);
+      }
+      else if(COMPSYSTEM_MASK_HAS(*typeMask, type) && sys->typeArray[type].tag)
+      {
+         COMPSYSTEM_MASK_SET(tags, type);
+      }
+   }
    
-   compTypePtr = &sys->typeArray[type];
-   actorIndex = CompSystem_FindActorFromID(sys, actor);
-   if(actorIndex != COMPSYSTEM_INVALID_INDEX)
+   arch = COMPSYSTEM_INVALID_INDEX;
+   if(sys->storage == eCompSystem_Storage_Archetype)
    {
-      actorPtr = &sys->actorArray[actorIndex];
-      outInd = actorPtr->compIndexArray[type];
-      offset = outInd * compTypePtr->elementSize;
-      outPtr = &compTypePtr->compArray[offset];
+      arch = CompSystem_FindArchetype(sys, &mask);
+      sys->archArray[0].count    -= created;
+      sys->archArray[arch].count += created;
    }
-   else
+   for(i = 0; i < created; i++)
    {
-      outPtr = NULL;
-      outInd = COMPSYSTEM_INVALID_INDEX;
+      actorPtr = CompSystem_GetActorPtr(sys, outIds[i]);
+      actorPtr->signature = mask;
+      for(type = 0; type < COMPSYSTEM_MASK_WORDS; type++)
+      {
+         actorPtr->signature.bits[type] |= tags.bits[type];
+      }
+      if(arch != COMPSYSTEM_INVALID_INDEX)
+      {
+         actorPtr->archetype = arch;
+      }
    }
    
-   if(outPointer != NULL)
+   // Append one contiguous range per type, in the same order as outIds
+   for(type = 0; type < sys->typeInfo.eleCount && type < COMPSYSTEM_MASK_TYPES; type++)
    {
-      (*outPointer) = outPtr;
+      compTypePtr = &sys->typeArray[type];
+      if(!COMPSYSTEM_MASK_HAS(mask, type))
+      {
+         continue;
+      }
+      
+      if(arch != COMPSYSTEM_INVALID_INDEX)
+      {
+         firstIndex = CompSystem_OpenSegmentGap(sys, type, arch, created);
+      }
+      else
+      {
+         firstIndex = compTypePtr->compInfo.eleCount;
+         CompSystem_GrowComponentArrays(sys, compTypePtr, firstIndex + created);
+         compTypePtr->compInfo.eleCount += created;
+      }
+      for(i = 0; i < created; i++)
+      {
+         CompSystem_Journal(sys, eJournal_Component, type, firstIndex + i);
+         CompSystem_Journal(sys, eJournal_ActorId, type, firstIndex + i);
+         compTypePtr->actorIdArray[firstIndex + i] = outIds[i];
+         INDEX_ENTRY(sys, type, outIds[i]) = firstIndex + i;
+      }
+      CompSystem_StampElements(compTypePtr, firstIndex, created, sys->tick, 1);
    }
    
-   if(outIndex != NULL)
+   for(group = 0; group < sys->groupInfo.eleCount; group++)
    {
-      (*outIndex) = outInd;
+      for(i = 0; i < created; i++)
+      {
+         CompSystem_GroupEnter(sys, group, outIds[i]);
+      }
+   }
+   for(i = 0; i < created && sys->cachedInfo.eleCount > 0; i++)
+   {
+      CompSystem_UpdateQueries(sys, outIds[i], COMPSYSTEM_INVALID_INDEX);
+   }
+   for(i = 0; i < created && sys->keyIndexInfo.eleCount > 0; i++)
+   {
+      CompSystem_KeyIndexMark(sys, COMPSYSTEM_INVALID_INDEX, outIds[i]);
    }
-
 }
 
-void CompSystem_GetComponentActor(const CompSystem_T sys, comptypeid_t type, int index, actorid_t * actor)
+void CompSystem_RemoveActors(CompSystem_T sys, const actorid_t * ids, int count)
 {
    CompType_T * compTypePtr;
-   
-   compTypePtr = &sys->typeArray[type];
-      
-   (*actor) = compTypePtr->actorPtrArray[index]->id;
-}
-
-void CompSystem_GetComponentFromComponent(const CompSystem_T sys, 
-                                          comptypeid_t sourceType, 
-                                          int sourceIndex, 
-                                          comptypeid_t destType, 
-                                          int * destIndex, 
-                                          void ** destPointer)
-{
-   CompType_T * sourceCompTypePtr;
-   CompType_T * destCompTypePtr;
    Actor_T * actorPtr;
-   int destInd, destOffset;
+   int * firstRemoved;
+   int i, type, actorIndex, compIndex, readIndex, writeIndex, firstActor, arch, group;
+   int deadStart;
+   actorid_t owner;
+   unsigned long long traceStart;
    
-   sourceCompTypePtr = &sys->typeArray[sourceType];
-   
-   actorPtr = sourceCompTypePtr->actorPtrArray[sourceIndex];
-   destInd = actorPtr->compIndexArray[destType];
-   
-   if(destIndex != NULL)
+   traceStart = TRACE_CLOCK();
+   firstRemoved = CompSystem_Alloc(sys, sizeof(int) * (sys->typeInfo.eleCount + 1));
+   for(type = 0; type < sys->typeInfo.eleCount; type++)
    {
-      (*destIndex) = destInd;
+      firstRemoved[type] = sys->typeArray[type].compInfo.eleCount;
    }
    
-   if(destPointer != NULL)
+   // Release every slot first so the dead show up as stale IDs below, and
+   // remember the lowest index each pool has to be compacted from
+   firstActor = sys->actorInfo.eleCount;
+   for(i = 0; i < count; i++)
    {
-      destCompTypePtr = &sys->typeArray[destType];
-      destOffset      = destInd * destCompTypePtr->elementSize;
-      (*destPointer)  = &destCompTypePtr->compArray[destOffset];
-   }
-}
-
-void CompSystem_ComponentFor(const CompSystem_T sys, comptypeid_t type, void ** array, int * size)
-{
+      actorIndex = CompSystem_FindActorFromID(sys, ids[i]);
+      if(actorIndex == COMPSYSTEM_INVALID_INDEX)
+      {
+         continue;
+      }
+      
+      // Leaving the groups first keeps their fronts out of the compaction
+      for(group = 0; group < sys->groupInfo.eleCount; group++)
+      {
+         CompSystem_GroupLeave(sys, group, ids[i]);
+      }
+      CompSystem_LeaveQueries(sys, ids[i]);
+      CompSystem_LeaveSpatial(sys, ids[i]);
+      CompSystem_KeyIndexRemove(sys, COMPSYSTEM_INVALID_INDEX, ids[i]);
+      
+      actorPtr = &sys->actorArray[actorIndex];
+      for(type = 0; type < sys->typeInfo.eleCount; type++)
+      {
+         compIndex = INDEX_ENTRY(sys, type, actorPtr->id);
+         if(compIndex != COMPSYSTEM_INVALID_INDEX && compIndex < firstRemoved[type])
+         {
+            firstRemoved[type] = compIndex;
+         }
+      }
+      if(actorIndex < firstActor)
+      {
+         firstActor = actorIndex;
+      }
+      if(sys->storage == eCompSystem_Storage_Archetype)
+      {
+         sys->archArray[actorPtr->archetype].count --;
+      }
+      CompSystem_ReleaseSlot(sys, ids[i]);
+      STATS_ADD(sys, removeActorCount, 1);
+   }
+   
+   // Compact each pool in one pass, keeping the order of the survivors
+   for(type = 0; type < sys->typeInfo.eleCount; type++)
+   {
+      compTypePtr = &sys->typeArray[type];
+      writeIndex = firstRemoved[type];
+      
+      // Archetype segments starting in the compacted part move down with it
+      arch = COMPSYSTEM_INVALID_INDEX;
+      if(sys->storage == eCompSystem_Storage_Archetype)
+      {
+         arch = CompSystem_NextArchetypeWithType(sys, type, COMPSYSTEM_INVALID_INDEX);
+         while(arch != COMPSYSTEM_INVALID_INDEX && sys->archArray[arch].start[type] < writeIndex)
+         {
+            arch = CompSystem_NextArchetypeWithType(sys, type, arch);
+         }
+      }
+      
+      deadStart = writeIndex;
+      for(readIndex = writeIndex; readIndex < compTypePtr->compInfo.eleCount; readIndex++)
+      {
+         while(arch != COMPSYSTEM_INVALID_INDEX && sys->archArray[arch].start[type] == readIndex)
+         {
+            sys->archArray[arch].start[type] = writeIndex;
+            arch = CompSystem_NextArchetypeWithType(sys, type, arch);
+         }
+         
+         owner = compTypePtr->actorIdArray[readIndex];
+         if(CompSystem_FindActorFromID(sys, owner) == COMPSYSTEM_INVALID_INDEX)
+         {
+            CompSystem_Journal(sys, eJournal_Component, type, readIndex);
+         }
+         else
+         {
+            // Each run of dead components is destroyed in one call, before
+            // the survivors are moved over it
+            CompSystem_DestroyComponents(sys, type, deadStart, readIndex - deadStart);
+            deadStart = readIndex + 1;
+            if(writeIndex != readIndex)
+            {
+               CompSystem_Journal(sys, eJournal_Component, type, writeIndex);
+               CompSystem_Journal(sys, eJournal_ActorId, type, writeIndex);
+               CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(owner));
+               CompSystem_CopyElements(compTypePtr, writeIndex, readIndex, 1);
+               compTypePtr->layout ++;
+            }
+            compTypePtr->actorIdArray[writeIndex] = owner;
+            INDEX_ENTRY(sys, type, owner) = writeIndex;
+            writeIndex ++;
+         }
+      }
+      CompSystem_DestroyComponents(sys, type, deadStart, readIndex - deadStart);
+      while(arch != COMPSYSTEM_INVALID_INDEX)
+      {
+         sys->archArray[arch].start[type] = writeIndex;
+         arch = CompSystem_NextArchetypeWithType(sys, type, arch);
+      }
+      compTypePtr->compInfo.eleCount = writeIndex;
+   }
+   
+   // Compact the actor array the same way
+   writeIndex = firstActor;
+   for(readIndex = firstActor; readIndex < sys->actorInfo.eleCount; readIndex++)
+   {
+      actorPtr = &sys->actorArray[readIndex];
+      if(CompSystem_FindActorFromID(sys, actorPtr->id) != COMPSYSTEM_INVALID_INDEX)
+      {
+         if(writeIndex != readIndex)
+         {
+            CompSystem_Journal(sys, eJournal_Actor, 0, writeIndex);
+            CompSystem_Journal(sys, eJournal_Slot, 0, COMPSYSTEM_ACTOR_INDEX(actorPtr->id));
+         }
+         sys->actorArray[writeIndex] = (*actorPtr);
+         sys->slotArray[COMPSYSTEM_ACTOR_INDEX(actorPtr->id)].actorIndex = writeIndex;
+         writeIndex ++;
+      }
+   }
+   sys->actorInfo.eleCount = writeIndex;
+   
+   CompSystem_Free(sys, firstRemoved, sizeof(int) * (sys->typeInfo.eleCount + 1));
+   TRACE_EVENT(sys, "RemoveActors", traceStart);
+}
+
+void CompSystem_IsActorAlive(const CompSystem_T sys, actorid_t actor, int * alive)
+{
+   (*alive) = CompSystem_FindActorFromID(sys, actor) != COMPSYSTEM_INVALID_INDEX;
+}
+
+void CompSystem_ReserveActors(CompSystem_T sys, int count)
+{
+   sys->actorInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->actorArray,
+                                                      sizeof(Actor_T),
+                                                      sys->actorInfo.arySize,
+                                                      count);
+   CompSystem_GrowSlots(sys, count);
+}
+
+void CompSystem_ReserveComponents(CompSystem_T sys, comptypeid_t type, int count)
+{
+   CompType_T * compTypePtr;
+   compTypePtr = &sys->typeArray[type];
+   
+   // Pools are created by CompSystem_SetType
+   if(POOL_EXISTS(compTypePtr))
+   {
+      CompSystem_GrowComponentArrays(sys, compTypePtr, count);
+   }
+}
+
+void CompSystem_SetComponent(CompSystem_T sys, actorid_t actor, comptypeid_t type, void ** compOut)
+{
+   Actor_T * actorPtr;
+   CompType_T * compTypePtr;
+   byte_t * dest;
+   int destIndex;
+   int actorIndex;
+   int added;
+   unsigned long long traceStart;
+   
+   traceStart = TRACE_CLOCK();
+   compTypePtr = &sys->typeArray[type];
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   
+   // Archetypes can only describe types that fit in a type mask
+   if(sys->storage == eCompSystem_Storage_Archetype && type >= COMPSYSTEM_MASK_TYPES)
+   {
+      actorIndex = COMPSYSTEM_INVALID_INDEX;
+   }
+   
+   // Tags only set the signature bit, there is nothing to point at
+   if(compTypePtr->tag)
+   {
+      if(actorIndex != COMPSYSTEM_INVALID_INDEX)
+      {
+         actorPtr = &sys->actorArray[actorIndex];
+         CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
+         COMPSYSTEM_MASK_SET(actorPtr->signature, type);
+         CompSystem_UpdateQueries(sys, actor, type);
+         STATS_ADD(sys, setComponentCount, 1);
+         TRACE_EVENT(sys, "SetComponent", traceStart);
+      }
+      (*compOut) = NULL;
+      return;
+   }
+   
+   if(actorIndex != COMPSYSTEM_INVALID_INDEX && compTypePtr != NULL)
+   {
+      actorPtr = &sys->actorArray[actorIndex];
+      added = (INDEX_ENTRY(sys, type, actorPtr->id) == COMPSYSTEM_INVALID_INDEX);
+      
+      // Rewinding needs whatever this call is about to overwrite
+      if(added)
+      {
+         CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(actorPtr->id));
+         CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
+      }
+      else
+      {
+         CompSystem_Journal(sys, eJournal_Component, type, INDEX_ENTRY(sys, type, actorPtr->id));
+      }
+      if(INDEX_ENTRY(sys, type, actorPtr->id) == COMPSYSTEM_INVALID_INDEX &&
+         sys->storage == eCompSystem_Storage_Archetype)
+      {
+         CompSystem_ArchetypeAddComponent(sys, actorPtr, type);
+         destIndex = INDEX_ENTRY(sys, type, actorPtr->id);
+      }
+      else if(INDEX_ENTRY(sys, type, actorPtr->id) == COMPSYSTEM_INVALID_INDEX)
+      {
+         // Grow if necessary
+         if(compTypePtr->compInfo.eleCount >= compTypePtr->compInfo.arySize)
+         {
+            CompSystem_GrowComponentArrays(sys, compTypePtr, compTypePtr->compInfo.eleCount + 1);
+         }
+         // Get offsets
+         destIndex  = compTypePtr->compInfo.eleCount;
+         CompSystem_Journal(sys, eJournal_Component, type, destIndex);
+         CompSystem_Journal(sys, eJournal_ActorId, type, destIndex);
+
+         // Set up references 
+         compTypePtr->actorIdArray[destIndex] = actor;
+         INDEX_ENTRY(sys, type, actorPtr->id) = destIndex;
+         
+         // Inc count
+         compTypePtr->compInfo.eleCount ++;
+         
+         // Completing a group's set of types moves the actor into it
+         if(compTypePtr->group != COMPSYSTEM_INVALID_INDEX)
+         {
+            CompSystem_GroupEnter(sys, compTypePtr->group, actor);
+            destIndex = INDEX_ENTRY(sys, type, actorPtr->id);
+         }
+      }
+      else
+      {
+         destIndex = INDEX_ENTRY(sys, type, actorPtr->id);
+      }
+      
+      if(type < COMPSYSTEM_MASK_TYPES)
+      {
+         COMPSYSTEM_MASK_SET(actorPtr->signature, type);
+      }
+      if(added)
+      {
+         CompSystem_UpdateQueries(sys, actor, type);
+      }
+      CompSystem_KeyIndexMark(sys, type, actor);
+      
+      // The caller writes through the pointer, so count it as a change
+      CompSystem_StampElements(compTypePtr, destIndex, 1, sys->tick, added);
+      
+      // do the copy
+      
+      dest = CompSystem_ElementPtr(compTypePtr, destIndex);
+      STATS_ADD(sys, setComponentCount, 1);
+      TRACE_EVENT(sys, "SetComponent", traceStart);
+   }
+   else
+   {
+      dest = NULL;
+   }
+   
+   (*compOut) = dest;
+   
+   
+}
+
+void CompSystem_RemoveComponent(CompSystem_T sys, actorid_t actor, comptypeid_t type)
+{
+   Actor_T * actorPtr;
+   CompType_T * compTypePtr;
+   actorid_t actorLast;
+   int actorIndex, compIndex, compIndexLast;
+   
+   compTypePtr = &sys->typeArray[type];
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   if(actorIndex == COMPSYSTEM_INVALID_INDEX)
+   {
+      return;
+   }
+   
+   actorPtr = &sys->actorArray[actorIndex];
+   if(compTypePtr->tag)
+   {
+      CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
+      COMPSYSTEM_MASK_CLEAR(actorPtr->signature, type);
+      CompSystem_UpdateQueries(sys, actor, type);
+      return;
+   }
+   if(INDEX_ENTRY(sys, type, actor) == COMPSYSTEM_INVALID_INDEX)
+   {
+      return;
+   }
+   if(compTypePtr->spatial != NULL && 
+      (int)COMPSYSTEM_ACTOR_INDEX(actor) < compTypePtr->spatial->entrySize &&
+      compTypePtr->spatial->entryArray[COMPSYSTEM_ACTOR_INDEX(actor)].bucket != COMPSYSTEM_INVALID_INDEX)
+   {
+      CompSystem_SpatialUnlink(compTypePtr->spatial, (int)COMPSYSTEM_ACTOR_INDEX(actor));
+   }
+   CompSystem_KeyIndexRemove(sys, type, actor);
+   
+   if(sys->storage == eCompSystem_Storage_Archetype)
+   {
+      CompSystem_ArchetypeRemoveComponent(sys, actorPtr, type);
+   }
+   else
+   {
+      if(compTypePtr->group != COMPSYSTEM_INVALID_INDEX)
+      {
+         CompSystem_GroupLeave(sys, compTypePtr->group, actor);
+      }
+      
+      // Same swap with the last component as RemoveActor
+      compIndex = INDEX_ENTRY(sys, type, actor);
+      compIndexLast = compTypePtr->compInfo.eleCount - 1;
+      actorLast = compTypePtr->actorIdArray[compIndexLast];
+      CompSystem_Journal(sys, eJournal_Component, type, compIndex);
+      CompSystem_Journal(sys, eJournal_ActorId, type, compIndex);
+      CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(actorLast));
+      CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(actor));
+      CompSystem_DestroyComponents(sys, type, compIndex, 1);
+      if(compIndex != compIndexLast)
+      {
+         CompSystem_CopyElements(compTypePtr, compIndex, compIndexLast, 1);
+      }
+      compTypePtr->actorIdArray[compIndex] = actorLast;
+      INDEX_ENTRY(sys, type, actorLast) = compIndex;
+      INDEX_ENTRY(sys, type, actor) = COMPSYSTEM_INVALID_INDEX;
+      compTypePtr->compInfo.eleCount --;
+      if(actorLast != actor)
+      {
+         CompSystem_QueryMoved(sys, actorLast);
+      }
+   }
+   
+   if(type < COMPSYSTEM_MASK_TYPES)
+   {
+      CompSystem_Journal(sys, eJournal_Actor, 0, actorIndex);
+      COMPSYSTEM_MASK_CLEAR(actorPtr->signature, type);
+   }
+   CompSystem_UpdateQueries(sys, actor, type);
+}
+
+void CompSystem_HasComponent(const CompSystem_T sys, actorid_t actor, comptypeid_t type, int * has)
+{
+   int actorIndex;
+   
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   if(actorIndex == COMPSYSTEM_INVALID_INDEX)
+   {
+      (*has) = 0;
+   }
+   else if(sys->typeArray[type].tag)
+   {
+      (*has) = COMPSYSTEM_MASK_HAS(sys->actorArray[actorIndex].signature, type);
+   }
+   else
+   {
+      (*has) = INDEX_ENTRY(sys, type, actor) != COMPSYSTEM_INVALID_INDEX;
+   }
+}
+
+void CompSystem_GetComponent(const CompSystem_T sys, actorid_t actor, comptypeid_t type, int * outIndex, void ** outPointer)
+{
+   Actor_T * actorPtr;
+   CompType_T * compTypePtr;
+   byte_t * outPtr;
+   int outInd, actorIndex;   
+   
+   
+   compTypePtr = &sys->typeArray[type];
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   if(actorIndex != COMPSYSTEM_INVALID_INDEX)
+   {
+      actorPtr = &sys->actorArray[actorIndex];
+      outInd = INDEX_ENTRY(sys, type, actorPtr->id);
+      outPtr = outInd != COMPSYSTEM_INVALID_INDEX ? CompSystem_ElementPtr(compTypePtr, outInd) : NULL;
+   }
+   else
+   {
+      outPtr = NULL;
+      outInd = COMPSYSTEM_INVALID_INDEX;
+   }
+   
+   if(outPointer != NULL)
+   {
+      (*outPointer) = outPtr;
+   }
+   
+   if(outIndex != NULL)
+   {
+      (*outIndex) = outInd;
+   }
+
+}
+
+void CompSystem_GetComponentActor(const CompSystem_T sys, comptypeid_t type, int index, actorid_t * actor)
+{
+   CompType_T * compTypePtr;
+   
+   compTypePtr = &sys->typeArray[type];
+      
+   (*actor) = compTypePtr->actorIdArray[index];
+}
+
+void CompSystem_GetComponentFromComponent(const CompSystem_T sys, 
+                                          comptypeid_t sourceType, 
+                                          int sourceIndex, 
+                                          comptypeid_t destType, 
+                                          int * destIndex, 
+                                          void ** destPointer)
+{
+   CompType_T * sourceCompTypePtr;
+   CompType_T * destCompTypePtr;
+   int destInd;
+   
+   sourceCompTypePtr = &sys->typeArray[sourceType];
+   destInd = INDEX_ENTRY(sys, destType, sourceCompTypePtr->actorIdArray[sourceIndex]);
+   
+   if(destIndex != NULL)
+   {
+      (*destIndex) = destInd;
+   }
+   
+   if(destPointer != NULL)
+   {
+      destCompTypePtr = &sys->typeArray[destType];
+      (*destPointer)  = destInd != COMPSYSTEM_INVALID_INDEX ? 
+                        CompSystem_ElementPtr(destCompTypePtr, destInd) : NULL;
+   }
+}
+
+void CompSystem_ComponentFor(const CompSystem_T sys, comptypeid_t type, void ** array, int * size)
+{
+   CompSystem_ComponentForPage(sys, type, 0, array, size);
+}
+
+void CompSystem_ComponentForPage(const CompSystem_T sys, comptypeid_t type, int page, 
+                                 void ** array, int * size)
+{
+   CompType_T * compTypePtr;
+   int first, count;
+   compTypePtr = &sys->typeArray[type];
+   
+   // Contiguous pools are a single page
+   first = compTypePtr->pageShift > 0 ? page << compTypePtr->pageShift : 
+           (page > 0 ? compTypePtr->compInfo.eleCount : 0);
+   count = compTypePtr->compInfo.eleCount - first;
+   count = count > 0 ? CompSystem_PageRun(compTypePtr, first, count) : 0;
+   if(array != NULL)
+   {
+      (*array) = count > 0 ? CompSystem_ElementPtr(compTypePtr, first) : compTypePtr->compArray;
+   }
+   
+   if(size != NULL)
+   {
+      (*size) = count;
+   }
+}
+
+void CompSystem_ColumnsFor(const CompSystem_T sys, comptypeid_t type, void ** columns, int * size)
+{
+   CompType_T * compTypePtr;
+   int i;
+   
+   compTypePtr = &sys->typeArray[type];
+   if(compTypePtr->pageShift > 0)
+   {
+      CompSystem_ComponentForPage(sys, type, 0, &columns[0], size);
+      return;
+   }
+   columns[0] = compTypePtr->compArray;
+   for(i = 1; i < compTypePtr->fieldCount; i++)
+   {
+      columns[i] = &compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * 
+                                           compTypePtr->fieldArray[i].start];
+   }
+   (*size) = compTypePtr->compInfo.eleCount;
+}
+
+void CompSystem_SortType(CompSystem_T sys, comptypeid_t type, 
+                         CompSystem_CompareFunc_T compareFunc, void * userData)
+{
+   CompType_T * compTypePtr;
+   Group_T * groupPtr;
+   int arch;
+   
+   compTypePtr = &sys->typeArray[type];
+   if(sys->storage == eCompSystem_Storage_Archetype)
+   {
+      // Each segment is sorted on its own and the archetype follows it
+      for(arch = CompSystem_NextArchetypeWithType(sys, type, COMPSYSTEM_INVALID_INDEX);
+          arch != COMPSYSTEM_INVALID_INDEX;
+          arch = CompSystem_NextArchetypeWithType(sys, type, arch))
+      {
+         CompSystem_SortRange(sys, type, sys->archArray[arch].start[type], 
+                              sys->archArray[arch].count, compareFunc, userData);
+         CompSystem_AlignSegments(sys, arch, type);
+      }
+   }
+   else if(compTypePtr->group != COMPSYSTEM_INVALID_INDEX)
+   {
+      // The group front and the rest are sorted apart, the other types follow
+      groupPtr = &sys->groupArray[compTypePtr->group];
+      CompSystem_SortRange(sys, type, 0, groupPtr->size, compareFunc, userData);
+      CompSystem_SortRange(sys, type, groupPtr->size, 
+                           compTypePtr->compInfo.eleCount - groupPtr->size, 
+                           compareFunc, userData);
+      CompSystem_GroupAlign(sys, compTypePtr->group, type);
+   }
+   else
+   {
+      CompSystem_SortRange(sys, type, 0, compTypePtr->compInfo.eleCount, compareFunc, userData);
+   }
+}
+
+void CompSystem_GroupTypes(CompSystem_T sys, const comptypeid_t * types, int count, 
+                           int * groupIndex)
+{
+   Group_T * groupPtr;
+   int i, group;
+   
+   // Archetype chunks are already aligned, and a type joins one group at most.
+   // Tags have no pool to order.
+   group = COMPSYSTEM_INVALID_INDEX;
+   if(sys->storage == eCompSystem_Storage_Packed && count > 0)
+   {
+      group = sys->groupInfo.eleCount;
+      for(i = 0; i < count; i++)
+      {
+         if(sys->typeArray[types[i]].group != COMPSYSTEM_INVALID_INDEX ||
+            sys->typeArray[types[i]].tag)
+         {
+            group = COMPSYSTEM_INVALID_INDEX;
+         }
+      }
+   }
+   
+   if(group != COMPSYSTEM_INVALID_INDEX)
+   {
+      if(sys->groupInfo.eleCount >= sys->groupInfo.arySize)
+      {
+         sys->groupInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->groupArray,
+                                                           sizeof(Group_T),
+                                                           sys->groupInfo.arySize,
+                                                           sys->groupInfo.eleCount + 1);
+      }
+      sys->groupInfo.eleCount ++;
+      
+      groupPtr = &sys->groupArray[group];
+      groupPtr->typeList  = CompSystem_Alloc(sys, sizeof(comptypeid_t) * count);
+      groupPtr->typeCount = count;
+      groupPtr->size      = 0;
+      for(i = 0; i < count; i++)
+      {
+         groupPtr->typeList[i] = types[i];
+         sys->typeArray[types[i]].group = group;
+      }
+      CompSystem_BuildGroup(sys, group);
+   }
+   
+   if(groupIndex != NULL)
+   {
+      (*groupIndex) = group;
+   }
+}
+
+void CompSystem_GetGroupSize(const CompSystem_T sys, int groupIndex, int * size)
+{
+   (*size) = sys->groupArray[groupIndex].size;
+}
+
+void CompSystem_QueryBegin(const CompSystem_T sys, CompSystem_Query_T * query,
+                           const comptypeid_t * include, int includeCount,
+                           const comptypeid_t * exclude, int excludeCount)
+{
+   CompType_T * compTypePtr;
+   int i, smallest;
+   
+   query->sys          = sys;
+   query->count        = 0;
+   query->chunkActor   = NULL;
+   query->position     = 0;
+   query->limit        = 0;
+   query->driver       = 0;
+   query->includeCount = includeCount < COMPSYSTEM_QUERY_MAX_TYPES ? includeCount : COMPSYSTEM_QUERY_MAX_TYPES;
+   query->excludeCount = excludeCount < COMPSYSTEM_QUERY_MAX_TYPES ? excludeCount : COMPSYSTEM_QUERY_MAX_TYPES;
+   query->tagged       = 0;
+   CompSystem_ClearMask(&query->tagInclude);
+   CompSystem_ClearMask(&query->tagExclude);
+   
+   // Drive the join from the smallest required pool, or every actor when
+   // only tags are required
+   smallest = sys->actorInfo.eleCount;
+   query->driver = COMPSYSTEM_INVALID_INDEX;
+   for(i = 0; i < query->includeCount; i++)
+   {
+      compTypePtr = &sys->typeArray[include[i]];
+      query->include[i] = include[i];
+      query->base[i]    = compTypePtr->compArray;
+      if(compTypePtr->tag)
+      {
+         COMPSYSTEM_MASK_SET(query->tagInclude, include[i]);
+         query->tagged = 1;
+      }
+      else if(query->driver == COMPSYSTEM_INVALID_INDEX || compTypePtr->compInfo.eleCount < smallest)
+      {
+         smallest      = compTypePtr->compInfo.eleCount;
+         query->driver = i;
+      }
+   }
+   query->limit = smallest;
+   
+   for(i = 0; i < query->excludeCount; i++)
+   {
+      query->exclude[i] = exclude[i];
+      if(sys->typeArray[exclude[i]].tag)
+      {
+         COMPSYSTEM_MASK_SET(query->tagExclude, exclude[i]);
+         query->tagged = 1;
+      }
+   }
+}
+
+void CompSystem_QueryNext(CompSystem_Query_T * query, int * count)
+{
+   actorid_t owner;
+   int outCount;
+   
+   outCount = 0;
+   if(query->includeCount > 0)
+   {
+      while(query->position < query->limit && 
+            outCount < COMPSYSTEM_QUERY_BATCH)
+      {
+         owner = CompSystem_QueryOwner(query, query->position);
+         query->position ++;
+         
+         // Indices are written speculatively and only kept if every type matched
+         if(CompSystem_QueryMatchActor(query, owner, &query->index[0][outCount], 
+                                       COMPSYSTEM_QUERY_BATCH))
+         {
+            query->actor[outCount] = owner;
+            outCount ++;
+         }
+      }
+   }
+   
+   query->count = outCount;
+   if(count != NULL)
+   {
+      (*count) = outCount;
+   }
+}
+
+void CompSystem_QueryNextChunk(CompSystem_Query_T * query, int * count)
+{
+   CompSystem_T sys;
+   CompType_T * compTypePtr;
+   Archetype_T * archPtr;
+   int indices[COMPSYSTEM_QUERY_MAX_TYPES], next[COMPSYSTEM_QUERY_MAX_TYPES];
+   int outCount, i, arch, match;
+   
+   sys = query->sys;
+   outCount = 0;
+   if(query->includeCount > 0 && sys->storage == eCompSystem_Storage_Archetype && !query->tagged)
+   {
+      // Walk the matching archetypes, each one is a column aligned run
+      for(arch = query->position; arch < sys->archInfo.eleCount && outCount == 0; arch++)
+      {
+         archPtr = &sys->archArray[arch];
+         match = archPtr->count > 0;
+         for(i = 0; i < query->includeCount && match; i++)
+         {
+            match = query->include[i] < COMPSYSTEM_MASK_TYPES &&
+                    COMPSYSTEM_MASK_HAS(archPtr->mask, query->include[i]);
+         }
+         for(i = 0; i < query->excludeCount && match; i++)
+         {
+            match = query->exclude[i] >= COMPSYSTEM_MASK_TYPES ||
+                    !COMPSYSTEM_MASK_HAS(archPtr->mask, query->exclude[i]);
+         }
+         
+         if(match)
+         {
+            if(!archPtr->aligned)
+            {
+               CompSystem_AlignArchetype(sys, arch);
+            }
+            for(i = 0; i < query->includeCount; i++)
+            {
+               indices[i] = archPtr->start[query->include[i]];
+            }
+            outCount = archPtr->count;
+         }
+      }
+      query->position = arch;
+   }
+   else if(query->includeCount > 0)
+   {
+      // Find the next match, then extend it while every index stays consecutive
+      while(query->position < query->limit && outCount == 0)
+      {
+         if(CompSystem_QueryMatchActor(query, CompSystem_QueryOwner(query, query->position), 
+                                       indices, 1))
+         {
+            outCount = 1;
+         }
+         query->position ++;
+      }
+      
+      // Tag only queries have no pool to run along
+      while(outCount > 0 && query->position < query->limit && 
+            query->driver != COMPSYSTEM_INVALID_INDEX)
+      {
+         match = CompSystem_QueryMatchActor(query, CompSystem_QueryOwner(query, query->position), 
+                                            next, 1);
+         // Runs of paged types end with their page, tags have no index
+         for(i = 0; i < query->includeCount && match; i++)
+         {
+            compTypePtr = &sys->typeArray[query->include[i]];
+            match = compTypePtr->tag ||
+                    (next[i] == indices[i] + outCount &&
+                     CompSystem_PageRun(compTypePtr, indices[i], outCount + 1) > outCount);
+         }
+         if(!match)
+         {
+            break;
+         }
+         outCount ++;
+         query->position ++;
+      }
+   }
+   
+   if(outCount > 0)
+   {
+      for(i = 0; i < query->includeCount; i++)
+      {
+         compTypePtr = &sys->typeArray[query->include[i]];
+         query->base[i] = compTypePtr->tag ? NULL : CompSystem_ElementPtr(compTypePtr, indices[i]);
+      }
+      if(query->driver == COMPSYSTEM_INVALID_INDEX)
+      {
+         query->chunkActor = &sys->actorArray[query->position - 1].id;
+      }
+      else
+      {
+         i = query->driver;
+         query->chunkActor = &sys->typeArray[query->include[i]].actorIdArray[indices[i]];
+      }
+   }
+   
+   query->count = outCount;
+   if(count != NULL)
+   {
+      (*count) = outCount;
+   }
+}
+
+void CompSystem_CreateQuery(CompSystem_T sys,
+                            const comptypeid_t * include, int includeCount,
+                            const comptypeid_t * exclude, int excludeCount,
+                            int * queryIndex)
+{
+   CachedQuery_T * cachedPtr;
+   int query;
+   
+   if(sys->cachedInfo.eleCount >= sys->cachedInfo.arySize)
+   {
+      sys->cachedInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->cachedArray,
+                                                         sizeof(CachedQuery_T),
+                                                         sys->cachedInfo.arySize,
+                                                         sys->cachedInfo.eleCount + 1);
+   }
+   query = sys->cachedInfo.eleCount;
+   sys->cachedInfo.eleCount ++;
+   
+   // The filter is a query iterator that is never run, only matched against
+   cachedPtr = &sys->cachedArray[query];
+   CompSystem_QueryBegin(sys, &cachedPtr->filter, include, includeCount, exclude, excludeCount);
+   cachedPtr->memberArray = NULL;
+   cachedPtr->tupleArray  = NULL;
+   cachedPtr->memberInfo.arySize  = 0;
+   cachedPtr->memberInfo.eleCount = 0;
+   cachedPtr->positionArray = NULL;
+   cachedPtr->positionSize  = 0;
+   CompSystem_RebuildQuery(sys, cachedPtr);
+   
+   if(queryIndex != NULL)
+   {
+      (*queryIndex) = query;
+   }
+}
+
+void CompSystem_QueryMatches(CompSystem_T sys, int queryIndex, const actorid_t ** actors,
+                             const int ** indices, int * count)
+{
+   CachedQuery_T * cachedPtr;
+   CompType_T * compTypePtr;
+   int i, k, stride;
+   
+   cachedPtr = &sys->cachedArray[queryIndex];
+   if(cachedPtr->dirty)
+   {
+      CompSystem_RebuildQuery(sys, cachedPtr);
+   }
+   
+   // Only the columns of pools that moved in bulk are read again
+   stride = cachedPtr->filter.includeCount;
+   for(k = 0; k < stride; k++)
+   {
+      compTypePtr = &sys->typeArray[cachedPtr->filter.include[k]];
+      if(cachedPtr->layout[k] != compTypePtr->layout)
+      {
+         for(i = 0; i < cachedPtr->memberInfo.eleCount; i++)
+         {
+            cachedPtr->tupleArray[i * stride + k] = 
+               INDEX_ENTRY(sys, cachedPtr->filter.include[k], cachedPtr->memberArray[i]);
+         }
+         cachedPtr->layout[k] = compTypePtr->layout;
+      }
+   }
+   
+   (*actors)  = cachedPtr->memberArray;
+   (*indices) = cachedPtr->tupleArray;
+   (*count)   = cachedPtr->memberInfo.eleCount;
+}
+
+void CompSystem_SetTypeSpatial(CompSystem_T sys, comptypeid_t type, int offset, int dimensions,
+                               float cellSize)
+{
+   CompType_T * compTypePtr;
+   Spatial_T * spatial;
+   int i;
+   
+   // Positions are read from the element, columns would split them up
+   compTypePtr = &sys->typeArray[type];
+   if(compTypePtr->spatial != NULL || compTypePtr->tag || compTypePtr->fieldCount > 0 ||
+      (dimensions != 2 && dimensions != 3) || !(cellSize > 0.0f) || offset < 0 ||
+      offset + dimensions * (int)sizeof(float) > compTypePtr->elementSize)
+   {
+      return;
+   }
+   
+   spatial = CompSystem_Alloc(sys, sizeof(Spatial_T));
+   spatial->offset      = offset;
+   spatial->dimensions  = dimensions;
+   spatial->invCellSize = 1.0f / cellSize;
+   spatial->bucketCount = SPATIAL_MIN_BUCKETS;
+   spatial->bucketArray = CompSystem_Alloc(sys, sizeof(int) * SPATIAL_MIN_BUCKETS);
+   for(i = 0; i < SPATIAL_MIN_BUCKETS; i++)
+   {
+      spatial->bucketArray[i] = COMPSYSTEM_INVALID_INDEX;
+   }
+   spatial->entryArray = NULL;
+   spatial->entrySize  = 0;
+   spatial->entryCount = 0;
+   spatial->tick       = 0;
+   spatial->rebuild    = 1;
+   compTypePtr->spatial = spatial;
+   sys->spatialCount ++;
+}
+
+void CompSystem_UpdateSpatial(CompSystem_T sys, comptypeid_t type)
+{
+   CompType_T * compTypePtr;
+   Spatial_T * spatial;
+   int i, position, first, count;
+   
+   compTypePtr = &sys->typeArray[type];
+   spatial = compTypePtr->spatial;
+   if(spatial == NULL)
+   {
+      return;
+   }
+   
+   // Untracked types report their whole pool as changed
+   if(spatial->rebuild)
+   {
+      for(i = 0; i < compTypePtr->compInfo.eleCount; i++)
+      {
+         CompSystem_SpatialInsert(sys, spatial, compTypePtr->actorIdArray[i], 
+                                  CompSystem_ElementPtr(compTypePtr, i));
+      }
+      spatial->rebuild = 0;
+   }
+   else
+   {
+      position = 0;
+      CompSystem_ComponentForChangedSince(sys, type, spatial->tick, &position, &first, &count);
+      while(count > 0)
+      {
+         for(i = first; i < first + count; i++)
+         {
+            CompSystem_SpatialInsert(sys, spatial, compTypePtr->actorIdArray[i], 
+                                     CompSystem_ElementPtr(compTypePtr, i));
+         }
+         CompSystem_ComponentForChangedSince(sys, type, spatial->tick, &position, &first, &count);
+      }
+   }
+   
+   // Changes made later in this tick are stamped with it too
+   spatial->tick = sys->tick;
+}
+
+void CompSystem_QueryRadius(const CompSystem_T sys, comptypeid_t type, const float * center, 
+                            float radius, actorid_t * outIds, int maxCount, int * outCount)
+{
+   const Spatial_T * spatial;
+   float lower[3], upper[3];
+   int d;
+   
+   spatial = sys->typeArray[type].spatial;
+   (*outCount) = 0;
+   if(spatial != NULL)
+   {
+      for(d = 0; d < spatial->dimensions; d++)
+      {
+         lower[d] = center[d] - radius;
+         upper[d] = center[d] + radius;
+      }
+      (*outCount) = CompSystem_SpatialSearch(spatial, lower, upper, center, radius, 
+                                             outIds, maxCount);
+   }
+}
+
+void CompSystem_QueryAABB(const CompSystem_T sys, comptypeid_t type, const float * lower, 
+                          const float * upper, actorid_t * outIds, int maxCount, int * outCount)
+{
+   const Spatial_T * spatial;
+   
+   spatial = sys->typeArray[type].spatial;
+   (*outCount) = 0;
+   if(spatial != NULL)
+   {
+      (*outCount) = CompSystem_SpatialSearch(spatial, lower, upper, NULL, 0.0f, 
+                                             outIds, maxCount);
+   }
+}
+
+void CompSystem_CreateIndex(CompSystem_T sys, comptypeid_t type, int keyOffset, int keySize,
+                            int * keyIndex)
+{
+   CompType_T * compTypePtr;
+   KeyIndex_T * keyIndexPtr;
+   int index;
+   
+   // Keys are read from the element, columns would split them up
+   compTypePtr = &sys->typeArray[type];
+   index = COMPSYSTEM_INVALID_INDEX;
+   if(!compTypePtr->tag && compTypePtr->fieldCount == 0 && keySize > 0 && keyOffset >= 0 &&
+      keyOffset + keySize <= compTypePtr->elementSize)
+   {
+      if(sys->keyIndexInfo.eleCount >= sys->keyIndexInfo.arySize)
+      {
+         sys->keyIndexInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->keyIndexArray,
+                                                              sizeof(KeyIndex_T),
+                                                              sys->keyIndexInfo.arySize,
+                                                              sys->keyIndexInfo.eleCount + 1);
+      }
+      index = sys->keyIndexInfo.eleCount;
+      sys->keyIndexInfo.eleCount ++;
+      
+      keyIndexPtr = &sys->keyIndexArray[index];
+      keyIndexPtr->type       = type;
+      keyIndexPtr->keyOffset  = keyOffset;
+      keyIndexPtr->keySize    = keySize;
+      keyIndexPtr->entryArray = NULL;
+      keyIndexPtr->entrySize  = 0;
+      keyIndexPtr->liveCount  = 0;
+      keyIndexPtr->usedCount  = 0;
+      keyIndexPtr->slotArray  = NULL;
+      keyIndexPtr->slotSize   = 0;
+      keyIndexPtr->pendingArray = NULL;
+      keyIndexPtr->pendingInfo.arySize  = 0;
+      keyIndexPtr->pendingInfo.eleCount = 0;
+      keyIndexPtr->rebuild    = 1;
+      CompSystem_KeyIndexResize(sys, keyIndexPtr, KEY_MIN_ENTRIES);
+   }
+   
+   if(keyIndex != NULL)
+   {
+      (*keyIndex) = index;
+   }
+}
+
+void CompSystem_IndexLookup(CompSystem_T sys, int keyIndex, const void * key, 
+                            actorid_t * actor, void ** comp)
+{
+   KeyIndex_T * keyIndexPtr;
+   CompType_T * compTypePtr;
+   KeyEntry_T * entryPtr;
+   byte_t * found;
+   unsigned int hash, mask, position;
+   
+   keyIndexPtr = &sys->keyIndexArray[keyIndex];
+   compTypePtr = &sys->typeArray[keyIndexPtr->type];
+   CompSystem_KeyIndexRefresh(sys, keyIndexPtr);
+   
+   // Probe until an empty entry, deleted ones keep the chains intact
+   found = NULL;
+   hash = CompSystem_KeyHash(key, keyIndexPtr->keySize);
+   mask = (unsigned int)keyIndexPtr->entrySize - 1;
+   for(position = hash & mask; found == NULL; position = (position + 1) & mask)
+   {
+      entryPtr = &keyIndexPtr->entryArray[position];
+      if(entryPtr->state == eKey_Empty)
+      {
+         break;
+      }
+      if(entryPtr->state == eKey_Live && entryPtr->hash == hash)
+      {
+         found = CompSystem_ElementPtr(compTypePtr, INDEX_ENTRY(sys, keyIndexPtr->type, 
+                                                                entryPtr->actor));
+         if(memcmp(&found[keyIndexPtr->keyOffset], key, keyIndexPtr->keySize) != 0)
+         {
+            found = NULL;
+         }
+         else if(actor != NULL)
+         {
+            (*actor) = entryPtr->actor;
+         }
+      }
+   }
+   
+   if(found == NULL && actor != NULL)
+   {
+      (*actor) = COMPSYSTEM_INVALID_ACTOR;
+   }
+   if(comp != NULL)
+   {
+      (*comp) = found;
+   }
+}
+
+void CompSystem_IndexRekey(CompSystem_T sys, int keyIndex, actorid_t actor)
+{
+   KeyIndex_T * keyIndexPtr;
+   KeySlot_T * slotPtr;
+   
+   keyIndexPtr = &sys->keyIndexArray[keyIndex];
+   if(keyIndexPtr->rebuild || CompSystem_FindActorFromID(sys, actor) == COMPSYSTEM_INVALID_INDEX ||
+      INDEX_ENTRY(sys, keyIndexPtr->type, actor) == COMPSYSTEM_INVALID_INDEX)
+   {
+      return;
+   }
+   
+   slotPtr = CompSystem_KeySlot(sys, keyIndexPtr, actor);
+   CompSystem_KeyIndexUnlink(keyIndexPtr, slotPtr);
+   slotPtr->pending = 0;
+   CompSystem_KeyIndexInsert(sys, keyIndexPtr, actor);
+}
+
+void CompSystem_GetActorSignature(const CompSystem_T sys, actorid_t actor, 
+                                  CompSystem_TypeMask_T * signature)
+{
+   int actorIndex;
+   
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   if(actorIndex != COMPSYSTEM_INVALID_INDEX)
+   {
+      (*signature) = sys->actorArray[actorIndex].signature;
+   }
+   else
+   {
+      CompSystem_ClearMask(signature);
+   }
+}
+
+void CompSystem_ActorHasAll(const CompSystem_T sys, actorid_t actor, 
+                            const CompSystem_TypeMask_T * mask, int * hasAll)
+{
+   int actorIndex;
+   
+   actorIndex = CompSystem_FindActorFromID(sys, actor);
+   (*hasAll) = actorIndex != COMPSYSTEM_INVALID_INDEX &&
+               CompSystem_MaskMatches(&sys->actorArray[actorIndex].signature, mask, NULL);
+}
+
+void CompSystem_FilterActors(const CompSystem_T sys, 
+                             const CompSystem_TypeMask_T * include,
+                             const CompSystem_TypeMask_T * exclude,
+                             actorid_t * outIds, int maxCount, int * outCount)
+{
+   Actor_T * actorPtr;
+   int i, count;
+   
+   count = 0;
+   actorPtr = sys->actorArray;
+   for(i = 0; i < sys->actorInfo.eleCount && count < maxCount; i++)
+   {
+      if(CompSystem_MaskMatches(&actorPtr[i].signature, include, exclude))
+      {
+         outIds[count] = actorPtr[i].id;
+         count ++;
+      }
+   }
+   (*outCount) = count;
+}
+
+void CompSystem_GetActorCount(const CompSystem_T sys, int * actorCount)
+{
+   (*actorCount) = sys->actorInfo.eleCount;
+}
+
+void CompSystem_GetActor(const CompSystem_T sys, int index, actorid_t * actor)
+{
+   (*actor) = sys->actorArray[index].id;
+}
+
+
+void CompSystem_SetThreadCount(CompSystem_T sys, int threadCount)
+{
+   // Commands still waiting in the per-thread buffers are applied first
+   CompSystem_Flush(sys);
+   CompSystem_StopThreads(sys);
+   sys->threadCount = threadCount;
+}
+
+void CompSystem_ParallelFor(CompSystem_T sys, comptypeid_t type, 
+                            CompSystem_KernelFunc_T kernel, void * userData, 
+                            int grainSize)
+{
+   ParallelJob_T job;
+   
+   job.sys         = sys;
+   job.compTypePtr = &sys->typeArray[type];
+   job.kernel      = kernel;
+   job.userData    = userData;
+   job.grainSize   = grainSize > 0 ? grainSize : 1;
+   job.count       = job.compTypePtr->compInfo.eleCount;
+   
+   // Power of two grains no larger than a page never straddle two pages
+   if(job.compTypePtr->pageShift > 0)
+   {
+      job.grainSize = MIN(job.grainSize, PAGE_SIZE(job.compTypePtr));
+      while(job.grainSize & (job.grainSize - 1))
+      {
+         job.grainSize &= job.grainSize - 1;
+      }
+   }
+   CompSystem_RunParallel(sys, CompSystem_ParallelForTask, &job, 
+                          (job.count + job.grainSize - 1) / job.grainSize);
+}
+
+void CompSystem_ParallelQuery(CompSystem_T sys, 
+                              const comptypeid_t * include, int includeCount,
+                              const comptypeid_t * exclude, int excludeCount,
+                              CompSystem_QueryKernelFunc_T kernel, void * userData, 
+                              int grainSize)
+{
+   ParallelJob_T job;
+   ThreadPool_T pool;
+   int threadIndex;
+   
+   // Every worker runs its own copy of this query over a slice of the driver
+   // pool. Nested in a running wave, the caller's copy is the template.
+   pool = CompSystem_GetThreadPool(sys);
+   threadIndex = 0;
+   if(sys->parallel)
+   {
+      ThreadPool_GetWorkerIndex(pool, &threadIndex);
+   }
+   CompSystem_QueryBegin(sys, &sys->threadQueries[threadIndex], include, includeCount, 
+                         exclude, excludeCount);
+   job.sys         = sys;
+   job.query       = &sys->threadQueries[threadIndex];
+   job.queryKernel = kernel;
+   job.userData    = userData;
+   job.grainSize   = grainSize > 0 ? grainSize : 1;
+   job.count       = sys->threadQueries[threadIndex].limit;
+   CompSystem_RunParallel(sys, CompSystem_ParallelQueryTask, &job, 
+                          (job.count + job.grainSize - 1) / job.grainSize);
+}
+
+void CompSystem_GetCommandBuffer(CompSystem_T sys, int threadIndex, 
+                                 CompSystem_CommandBuffer_T * buffer)
+{
+   (void)CompSystem_GetThreadPool(sys);
+   (*buffer) = sys->bufferArray[threadIndex];
+}
+
+void CompSystem_DeferNewActor(CompSystem_CommandBuffer_T buffer, actorid_t * pendingActor)
+{
+   int pending;
+   
+   CompSystem_RecordCommand(buffer, eCommand_NewActor, COMPSYSTEM_INVALID_ACTOR, 0, NULL, 0);
+   
+   // Pending handles live in the reserved generation and count up per buffer
+   pending = buffer->resolvedInfo.eleCount;
+   if(pending >= buffer->resolvedInfo.arySize)
+   {
+      buffer->resolvedInfo.arySize = CompSystem_GrowArraySize(buffer->sys, 
+                                                              (void**)&buffer->resolvedArray,
+                                                              sizeof(actorid_t),
+                                                              buffer->resolvedInfo.arySize,
+                                                              pending + 1);
+   }
+   buffer->resolvedArray[pending] = COMPSYSTEM_INVALID_ACTOR;
+   buffer->resolvedInfo.eleCount ++;
+   (*pendingActor) = (COMPSYSTEM_ACTOR_GENERATION_MASK << COMPSYSTEM_ACTOR_INDEX_BITS) | 
+                     (actorid_t)pending;
+}
+
+void CompSystem_DeferSetComponent(CompSystem_CommandBuffer_T buffer, actorid_t actor, 
+                                  comptypeid_t type, const void * comp)
+{
+   CompSystem_RecordCommand(buffer, eCommand_SetComponent, actor, type, comp,
+                            comp != NULL ? buffer->sys->typeArray[type].elementSize : 0);
+}
+
+void CompSystem_DeferRemoveActor(CompSystem_CommandBuffer_T buffer, actorid_t actor)
+{
+   CompSystem_RecordCommand(buffer, eCommand_RemoveActor, actor, 0, NULL, 0);
+}
+
+void CompSystem_ResolveActor(const CompSystem_CommandBuffer_T buffer, actorid_t pendingActor, 
+                             actorid_t * actor)
+{
+   (*actor) = CompSystem_ResolvePending(buffer, pendingActor);
+}
+
+void CompSystem_Flush(CompSystem_T sys)
+{
+   CompSystem_CommandBuffer_T buffer;
+   Command_T command;
+   actorid_t actor;
+   void * comp;
+   int i, offset, pending, threadCount;
+   
+   if(sys->bufferArray == NULL)
+   {
+      return;
+   }
+   
+   // Apply buffers in thread order and each one in recording order
+   ThreadPool_GetThreadCount(sys->threadPool, &threadCount);
+   for(i = 0; i < threadCount; i++)
+   {
+      buffer = sys->bufferArray[i];
+      pending = 0;
+      offset = 0;
+      while(offset < buffer->dataInfo.eleCount)
+      {
+         memcpy(&command, &buffer->data[offset], sizeof(Command_T));
+         offset += COMMAND_ALIGN(sizeof(Command_T));
+         
+         switch(command.op)
+         {
+         case eCommand_NewActor:
+            CompSystem_NewActor(sys, &buffer->resolvedArray[pending]);
+            pending ++;
+            break;
+         case eCommand_SetComponent:
+            actor = CompSystem_ResolvePending(buffer, command.actor);
+            CompSystem_SetComponent(sys, actor, command.type, &comp);
+            if(comp != NULL && command.size > 0)
+            {
+               CompSystem_WriteElement(&sys->typeArray[command.type], 
+                                       INDEX_ENTRY(sys, command.type, actor),
+                                       &buffer->data[offset]);
+            }
+            break;
+         case eCommand_RemoveActor:
+            CompSystem_RemoveActor(sys, CompSystem_ResolvePending(buffer, command.actor));
+            break;
+         }
+         offset += COMMAND_ALIGN(command.size);
+      }
+      
+      // Resolved handles stay readable until the buffer records again
+      buffer->dataInfo.eleCount = 0;
+      buffer->flushed = 1;
+   }
+}
+
+void CompSystem_AddSystem(CompSystem_T sys, CompSystem_SystemFunc_T func, void * userData,
+                          const comptypeid_t * reads, int readCount,
+                          const comptypeid_t * writes, int writeCount,
+                          int * systemIndex)
+{
+   System_T * systemPtr;
+   int i, oldSize;
+   
+   if(sys->systemInfo.eleCount >= sys->systemInfo.arySize)
+   {
+      oldSize = sys->systemInfo.arySize;
+      sys->systemInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->systemArray, 
+                                                         sizeof(System_T),
+                                                         oldSize,
+                                                         sys->systemInfo.eleCount + 1);
+      (void)CompSystem_SetArraySize(sys, (void**)&sys->scheduleArray, sizeof(int), 
+                                    DEFAULT_ALIGNMENT, oldSize, sys->systemInfo.arySize);
+   }
+   if(systemIndex != NULL)
+   {
+      (*systemIndex) = sys->systemInfo.eleCount;
+   }
+   systemPtr = &sys->systemArray[sys->systemInfo.eleCount];
+   sys->systemInfo.eleCount ++;
+   
+   systemPtr->func      = func;
+   systemPtr->userData  = userData;
+   systemPtr->exclusive = 0;
+   CompSystem_ClearMask(&systemPtr->reads);
+   CompSystem_ClearMask(&systemPtr->writes);
+   
+   // Types past the mask can not be tracked, so their systems run alone
+   for(i = 0; i < readCount; i++)
+   {
+      if(reads[i] < COMPSYSTEM_MASK_TYPES)
+      {
+         COMPSYSTEM_MASK_SET(systemPtr->reads, reads[i]);
+      }
+      else
+      {
+         systemPtr->exclusive = 1;
+      }
+   }
+   for(i = 0; i < writeCount; i++)
+   {
+      if(writes[i] < COMPSYSTEM_MASK_TYPES)
+      {
+         COMPSYSTEM_MASK_SET(systemPtr->writes, writes[i]);
+      }
+      else
+      {
+         systemPtr->exclusive = 1;
+      }
+   }
+   sys->scheduleDirty = 1;
+}
+
+void CompSystem_RunSystems(CompSystem_T sys)
+{
+   ParallelJob_T job;
+   int i, begin, end;
+   
+   if(sys->scheduleDirty)
+   {
+      CompSystem_BuildSchedule(sys);
+   }
+   
+   job.sys = sys;
+   begin = 0;
+   while(begin < sys->systemInfo.eleCount)
+   {
+      end = begin + 1;
+      while(end < sys->systemInfo.eleCount &&
+            sys->systemArray[sys->scheduleArray[end]].wave == 
+            sys->systemArray[sys->scheduleArray[begin]].wave)
+      {
+         end ++;
+      }
+      
+      if(end - begin == 1)
+      {
+         // A lone system runs on the caller and may use the thread pool itself
+         job.systems = &sys->scheduleArray[begin];
+         CompSystem_SystemTask(&job, 0, 0);
+      }
+      else
+      {
+         // Align every archetype first so concurrent chunk queries stay read only
+         for(i = 0; i < sys->archInfo.eleCount; i++)
+         {
+            if(!sys->archArray[i].aligned)
+            {
+               CompSystem_AlignArchetype(sys, i);
+            }
+         }
+         job.systems = &sys->scheduleArray[begin];
+         CompSystem_RunParallel(sys, CompSystem_SystemTask, &job, end - begin);
+      }
+      begin = end;
+   }
+   
+   CompSystem_Flush(sys);
+}
+
+void CompSystem_TrackChanges(CompSystem_T sys, comptypeid_t type)
+{
+   CompType_T * compTypePtr;
+   
+   compTypePtr = &sys->typeArray[type];
+   if(compTypePtr->tracked)
+   {
+      return;
+   }
+   
+   // Components that already exist count as added now
+   compTypePtr->tracked = 1;
+   if(POOL_EXISTS(compTypePtr))
+   {
+      CompSystem_ResizeVersions(sys, compTypePtr, 0);
+      CompSystem_StampElements(compTypePtr, 0, compTypePtr->compInfo.eleCount, sys->tick, 1);
+   }
+}
+
+void CompSystem_AdvanceTick(CompSystem_T sys, comptick_t * tick)
+{
+   sys->tick ++;
+   if(tick != NULL)
+   {
+      (*tick) = sys->tick;
+   }
+}
+
+void CompSystem_GetTick(const CompSystem_T sys, comptick_t * tick)
+{
+   (*tick) = sys->tick;
+}
+
+void CompSystem_MarkChanged(CompSystem_T sys, actorid_t actor, comptypeid_t type)
+{
+   int index;
+   
+   if(CompSystem_FindActorFromID(sys, actor) == COMPSYSTEM_INVALID_INDEX)
+   {
+      return;
+   }
+   index = INDEX_ENTRY(sys, type, actor);
+   if(index != COMPSYSTEM_INVALID_INDEX)
+   {
+      CompSystem_Journal(sys, eJournal_Component, type, index);
+      CompSystem_StampElements(&sys->typeArray[type], index, 1, sys->tick, 0);
+   }
+}
+
+void CompSystem_MarkChangedRange(CompSystem_T sys, comptypeid_t type, int first, int count)
+{
+   CompSystem_JournalRange(sys, eJournal_Component, type, first, count);
+   CompSystem_StampElements(&sys->typeArray[type], first, count, sys->tick, 0);
+}
+
+void CompSystem_GetComponentVersion(const CompSystem_T sys, actorid_t actor, comptypeid_t type,
+                                    comptick_t * added, comptick_t * changed)
+{
+   CompType_T * compTypePtr;
+   comptick_t addedTick, changedTick;
+   int index;
+   
+   compTypePtr = &sys->typeArray[type];
+   addedTick   = 0;
+   changedTick = 0;
+   if(compTypePtr->tracked && 
+      CompSystem_FindActorFromID(sys, actor) != COMPSYSTEM_INVALID_INDEX)
+   {
+      index = INDEX_ENTRY(sys, type, actor);
+      if(index != COMPSYSTEM_INVALID_INDEX)
+      {
+         addedTick   = compTypePtr->addedArray[index];
+         changedTick = compTypePtr->changedArray[index];
+      }
+   }
+   
+   if(added != NULL)
+   {
+      (*added) = addedTick;
+   }
+   if(changed != NULL)
+   {
+      (*changed) = changedTick;
+   }
+}
+
+void CompSystem_ComponentForChangedSince(const CompSystem_T sys, comptypeid_t type, comptick_t tick,
+                                         int * position, int * first, int * count)
+{
+   CompType_T * compTypePtr;
+   
+   compTypePtr = &sys->typeArray[type];
+   CompSystem_NextChangedRun(compTypePtr, compTypePtr->changedArray, tick, position, first, count);
+}
+
+void CompSystem_ComponentForAddedSince(const CompSystem_T sys, comptypeid_t type, comptick_t tick,
+                                       int * position, int * first, int * count)
+{
+   CompType_T * compTypePtr;
+   
+   // Additions also stamp the change chunks, so the same skip applies
+   compTypePtr = &sys->typeArray[type];
+   CompSystem_NextChangedRun(compTypePtr, compTypePtr->addedArray, tick, position, first, count);
+}
+
+void CompSystem_BeginFrameCapture(CompSystem_T sys)
+{
+   // Only packed pools are journaled
+   if(sys->storage != eCompSystem_Storage_Packed)
+   {
+      return;
+   }
+   
+   if(sys->frameArray == NULL)
+   {
+      sys->frameArray = CompSystem_Alloc(sys, sizeof(Frame_T) * COMPSYSTEM_ROLLBACK_FRAMES);
+      memset(sys->frameArray, 0, sizeof(Frame_T) * COMPSYSTEM_ROLLBACK_FRAMES);
+      sys->frameHead = COMPSYSTEM_ROLLBACK_FRAMES - 1;
+   }
+   
+   // The oldest frame is dropped once the ring is full
+   sys->frameHead  = (sys->frameHead + 1) % COMPSYSTEM_ROLLBACK_FRAMES;
+   sys->frameCount = MIN(sys->frameCount + 1, COMPSYSTEM_ROLLBACK_FRAMES);
+   CompSystem_OpenFrame(sys, &sys->frameArray[sys->frameHead]);
+}
+
+void CompSystem_Rewind(CompSystem_T sys, int frames, int * rewound)
+{
+   int i;
+   
+   frames = MAX(MIN(frames, sys->frameCount), 0);
+   for(i = 0; i < frames; i++)
+   {
+      CompSystem_UndoFrame(sys, &sys->frameArray[sys->frameHead]);
+      
+      // The last frame undone stays open for the resimulated tick
+      if(i < frames - 1)
+      {
+         sys->frameHead = (sys->frameHead + COMPSYSTEM_ROLLBACK_FRAMES - 1) % 
+                          COMPSYSTEM_ROLLBACK_FRAMES;
+         sys->frameCount --;
+      }
+   }
+   
+   if(frames > 0)
+   {
+      CompSystem_DirtyQueries(sys);
+      CompSystem_ResetSpatial(sys);
+      CompSystem_ResetKeyIndexes(sys);
+   }
+   if(rewound != NULL)
+   {
+      (*rewound) = frames;
+   }
+}
+
+void CompSystem_ClearFrameCaptures(CompSystem_T sys)
+{
+   Frame_T * framePtr;
+   int i;
+   
+   if(sys->frameArray == NULL)
+   {
+      return;
+   }
+   
+   for(i = 0; i < COMPSYSTEM_ROLLBACK_FRAMES; i++)
+   {
+      framePtr = &sys->frameArray[i];
+      CompSystem_Free(sys, framePtr->journal, framePtr->journalInfo.arySize);
+      CompSystem_Free(sys, framePtr->countArray, sizeof(int) * framePtr->countInfo.arySize);
+      CompSystem_Free(sys, framePtr->limitArray, sizeof(int) * framePtr->countInfo.arySize);
+   }
+   CompSystem_Free(sys, sys->frameArray, sizeof(Frame_T) * COMPSYSTEM_ROLLBACK_FRAMES);
+   sys->frameArray = NULL;
+   sys->frameHead  = 0;
+   sys->frameCount = 0;
+}
+
+void CompSystem_GetStats(const CompSystem_T sys, CompSystem_Stats_T * stats)
+{
+   const CompType_T * compTypePtr;
+   int i;
+   
+   (*stats) = sys->stats;
+   stats->actorCount     = sys->actorInfo.eleCount;
+   stats->slotCount      = sys->slotInfo.eleCount;
+   stats->typeCount      = sys->typeInfo.eleCount;
+   stats->archetypeCount = sys->archInfo.eleCount;
+   
+   stats->bytesReserved = sizeof(Actor_T) * sys->actorInfo.arySize +
+                          sizeof(ActorSlot_T) * sys->slotInfo.arySize +
+                          sizeof(int) * sys->typeInfo.arySize * sys->slotInfo.arySize +
+                          sizeof(CompType_T) * sys->typeInfo.arySize +
+                          sizeof(Archetype_T) * sys->archInfo.arySize;
+   stats->bytesUsed     = sizeof(Actor_T) * sys->actorInfo.eleCount +
+                          sizeof(ActorSlot_T) * sys->slotInfo.eleCount +
+                          sizeof(int) * sys->typeInfo.eleCount * sys->slotInfo.eleCount +
+                          sizeof(CompType_T) * sys->typeInfo.eleCount +
+                          sizeof(Archetype_T) * sys->archInfo.eleCount;
+   for(i = 0; i < sys->typeInfo.eleCount; i++)
+   {
+      compTypePtr = &sys->typeArray[i];
+      stats->bytesReserved += CompSystem_PoolBytes(compTypePtr, compTypePtr->compInfo.arySize);
+      stats->bytesUsed     += CompSystem_PoolBytes(compTypePtr, compTypePtr->compInfo.eleCount);
+   }
+}
+
+void CompSystem_GetTypeStats(const CompSystem_T sys, comptypeid_t type, 
+                             CompSystem_TypeStats_T * stats)
+{
+   const CompType_T * compTypePtr;
+   int i;
+   compTypePtr = &sys->typeArray[type];
+   
+   stats->count         = compTypePtr->compInfo.eleCount;
+   stats->capacity      = compTypePtr->compInfo.arySize;
+   stats->elementSize   = compTypePtr->elementSize;
+   stats->bytesReserved = CompSystem_PoolBytes(compTypePtr, compTypePtr->compInfo.arySize);
+   stats->bytesUsed     = CompSystem_PoolBytes(compTypePtr, compTypePtr->compInfo.eleCount);
+   stats->growCount     = compTypePtr->growCount;
+   
+   // Tags are only counted in the signatures
+   for(i = 0; compTypePtr->tag && i < sys->actorInfo.eleCount; i++)
+   {
+      stats->count += COMPSYSTEM_MASK_HAS(sys->actorArray[i].signature, type);
+   }
+}
+
+void CompSystem_ResetStats(CompSystem_T sys)
+{
+   int i;
+   
+   memset(&sys->stats, 0, sizeof(CompSystem_Stats_T));
+   for(i = 0; i < sys->typeInfo.eleCount; i++)
+   {
+      sys->typeArray[i].growCount = 0;
+   }
+}
+
+void CompSystem_SetTraceHook(CompSystem_T sys, CompSystem_TraceFunc_T traceFunc, void * userData)
+{
+   sys->traceFunc = traceFunc;
+   sys->traceData = userData;
+}
+
+void CompSystem_SaveSnapshot(const CompSystem_T sys, const char * filename, int * saved)
+{
+   SnapshotHeader_T header;
+   SnapshotType_T * typeTable;
+   SnapshotType_T * entryPtr;
+   CompType_T * compTypePtr;
+   FILE * file;
+   char * tempName;
+   long long offset;
+   size_t tableSize, nameSize;
+   int type, i;
+   
+   // Written next to the target and renamed over it, so a system that loaded
+   // the target keeps its mapping of the old file
+   nameSize = strlen(filename) + sizeof(SNAPSHOT_TEMP_SUFFIX);
+   tempName = CompSystem_Alloc(sys, nameSize);
+   memcpy(tempName, filename, nameSize - sizeof(SNAPSHOT_TEMP_SUFFIX));
+   memcpy(&tempName[nameSize - sizeof(SNAPSHOT_TEMP_SUFFIX)], SNAPSHOT_TEMP_SUFFIX, 
+          sizeof(SNAPSHOT_TEMP_SUFFIX));
+   file = fopen(tempName, "wb");
+   if(file == NULL)
+   {
+      CompSystem_Free(sys, tempName, nameSize);
+      (*saved) = 0;
+      return;
+   }
+   
+   memset(&header, 0, sizeof(SnapshotHeader_T));
+   header.magic      = SNAPSHOT_MAGIC;
+   header.version    = SNAPSHOT_VERSION;
+   CompSystem_SnapshotLayout(header.layout);
+   header.storage    = sys->storage;
+   header.typeCount  = sys->typeInfo.eleCount;
+   header.typeRows   = sys->typeInfo.arySize;
+   header.actorCount = sys->actorInfo.eleCount;
+   header.slotCount  = sys->slotInfo.eleCount;
+   header.freeSlot   = sys->freeSlot;
+   header.archCount  = sys->archInfo.eleCount;
+   tableSize = sizeof(SnapshotType_T) * header.typeCount;
+   typeTable = CompSystem_Alloc(sys, MAX(tableSize, 1));
+   memset(typeTable, 0, tableSize);
+   
+   // Write placeholders first and come back once the offsets are known
+   offset = 0;
+   CompSystem_SnapshotWrite(file, &offset, &header, sizeof(SnapshotHeader_T));
+   CompSystem_SnapshotWrite(file, &offset, typeTable, tableSize);
+   
+   CompSystem_SnapshotPad(file, &offset, SNAPSHOT_ALIGNMENT);
+   header.actorOffset = offset;
+   CompSystem_SnapshotWrite(file, &offset, sys->actorArray, sizeof(Actor_T) * header.actorCount);
+   
+   CompSystem_SnapshotPad(file, &offset, SNAPSHOT_ALIGNMENT);
+   header.slotOffset = offset;
+   CompSystem_SnapshotWrite(file, &offset, sys->slotArray, sizeof(ActorSlot_T) * header.slotCount);
+   
+   // Rows are cut down to the slots in use, unused rows are left zero
+   CompSystem_SnapshotPad(file, &offset, SNAPSHOT_ALIGNMENT);
+   header.indexOffset = offset;
+   for(type = 0; type < header.typeRows; type++)
+   {
+      CompSystem_SnapshotWrite(file, &offset, 
+                               type < header.typeCount ? 
+                               &sys->indexTable[(size_t)type * sys->slotInfo.arySize] : NULL,
+                               sizeof(int) * header.slotCount);
+   }
+   
+   CompSystem_SnapshotPad(file, &offset, SNAPSHOT_ALIGNMENT);
+   header.archOffset = offset;
+   CompSystem_SnapshotWrite(file, &offset, sys->archArray, sizeof(Archetype_T) * header.archCount);
+   
+   for(type = 0; type < header.typeCount; type++)
+   {
+      compTypePtr = &sys->typeArray[type];
+      entryPtr = &typeTable[type];
+      entryPtr->elementSize = compTypePtr->elementSize;
+      entryPtr->fieldCount  = compTypePtr->fieldCount;
+      entryPtr->count       = compTypePtr->compInfo.eleCount;
+      entryPtr->capacity    = entryPtr->count;
+      
+      CompSystem_SnapshotPad(file, &offset, MAX(SNAPSHOT_ALIGNMENT, compTypePtr->alignment));
+      entryPtr->compOffset = offset;
+      if(compTypePtr->pageShift > 0)
+      {
+         // Whole pages are saved so loading can adopt them one by one
+         entryPtr->capacity = (entryPtr->count + PAGE_SIZE(compTypePtr) - 1) & 
+                              ~(PAGE_SIZE(compTypePtr) - 1);
+         for(i = 0; i < entryPtr->count; i += PAGE_SIZE(compTypePtr))
+         {
+            CompSystem_SnapshotWrite(file, &offset, CompSystem_ElementPtr(compTypePtr, i),
+                                     (size_t)CompSystem_PageRun(compTypePtr, i, entryPtr->count - i) *
+                                     compTypePtr->elementSize);
+         }
+         CompSystem_SnapshotWrite(file, &offset, NULL, 
+                                  (size_t)(entryPtr->capacity - entryPtr->count) * 
+                                  compTypePtr->elementSize);
+      }
+      else if(compTypePtr->fieldCount == 0)
+      {
+         CompSystem_SnapshotWrite(file, &offset, compTypePtr->compArray, 
+                                  (size_t)entryPtr->count * compTypePtr->elementSize);
+      }
+      else
+      {
+         // Columns are padded to a multiple of MIN_ARRAY_SIZE elements so
+         // they stay on the same boundaries they have in memory
+         entryPtr->capacity = (entryPtr->count + MIN_ARRAY_SIZE - 1) & ~(MIN_ARRAY_SIZE - 1);
+         for(i = 0; i < compTypePtr->fieldCount; i++)
+         {
+            CompSystem_SnapshotWrite(file, &offset, 
+                                     &compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * 
+                                                             compTypePtr->fieldArray[i].start],
+                                     (size_t)entryPtr->count * compTypePtr->fieldArray[i].size);
+            CompSystem_SnapshotWrite(file, &offset, NULL, 
+                                     (size_t)(entryPtr->capacity - entryPtr->count) * 
+                                     compTypePtr->fieldArray[i].size);
+         }
+      }
+      
+      CompSystem_SnapshotPad(file, &offset, SNAPSHOT_ALIGNMENT);
+      entryPtr->actorIdOffset = offset;
+      CompSystem_SnapshotWrite(file, &offset, compTypePtr->actorIdArray, 
+                               sizeof(actorid_t) * entryPtr->count);
+      
+      // Appends after loading write into the adopted padding
+      CompSystem_SnapshotWrite(file, &offset, NULL, 
+                               sizeof(actorid_t) * (entryPtr->capacity - entryPtr->count));
+   }
+   
+   fseek(file, 0, SEEK_SET);
+   offset = 0;
+   CompSystem_SnapshotWrite(file, &offset, &header, sizeof(SnapshotHeader_T));
+   CompSystem_SnapshotWrite(file, &offset, typeTable, tableSize);
+   CompSystem_Free(sys, typeTable, MAX(tableSize, 1));
+   
+   (*saved) = !ferror(file);
+   if(fclose(file) != 0)
+   {
+      (*saved) = 0;
+   }
+   
+#ifdef _WIN32
+   if((*saved) && !MoveFileExA(tempName, filename, MOVEFILE_REPLACE_EXISTING))
+#else
+   if((*saved) && rename(tempName, filename) != 0)
+#endif
+   {
+      (*saved) = 0;
+   }
+   if(!(*saved))
+   {
+      remove(tempName);
+   }
+   CompSystem_Free(sys, tempName, nameSize);
+}
+
+void CompSystem_LoadSnapshot(CompSystem_T sys, const char * filename, 
+                             CompSystem_FixupFunc_T fixupFunc, void * userData, int * loaded)
+{
+   SnapshotHeader_T header;
+   SnapshotType_T entry;
+   CompType_T * compTypePtr;
+   byte_t * base;
+   void * comps;
+   size_t size;
+   int type, i, count;
+   
+   (*loaded) = 0;
+   CompSystem_MapFile(sys, filename, &base, &size);
+   if(base == NULL)
+   {
+      return;
+   }
+   if(!CompSystem_SnapshotCheck(sys, base, size))
+   {
+      CompSystem_UnmapFile(sys, base, size);
+      return;
+   }
+   memcpy(&header, base, sizeof(SnapshotHeader_T));
+   
+   // Throw away the current world, including whatever a previous load mapped
+   CompSystem_Flush(sys);
+   CompSystem_ClearFrameCaptures(sys);
+   for(type = 0; type < sys->typeInfo.eleCount; type++)
+   {
+      CompSystem_ClearPool(sys, type);
+   }
+   CompSystem_Free(sys, sys->indexTable, sizeof(int) * sys->typeInfo.arySize * 
+                                         sys->slotInfo.arySize);
+   CompSystem_Free(sys, sys->actorArray, sizeof(Actor_T) * sys->actorInfo.arySize);
+   CompSystem_Free(sys, sys->slotArray, sizeof(ActorSlot_T) * sys->slotInfo.arySize);
+   CompSystem_Free(sys, sys->archArray, sizeof(Archetype_T) * sys->archInfo.arySize);
+   CompSystem_ReleaseMapping(sys);
+   sys->mapBase = base;
+   sys->mapSize = size;
+   
+   // Adopt the tables where they lie in the file, empty ones start over
+   sys->actorArray = NULL;
+   sys->actorInfo.arySize  = header.actorCount;
+   sys->actorInfo.eleCount = header.actorCount;
+   if(header.actorCount > 0)
+   {
+      sys->actorArray = (Actor_T *)&base[header.actorOffset];
+   }
+   
+   sys->freeSlot = header.freeSlot;
+   sys->slotInfo.eleCount = header.slotCount;
+   if(header.slotCount > 0)
+   {
+      sys->slotArray = (ActorSlot_T *)&base[header.slotOffset];
+      sys->slotInfo.arySize = header.slotCount;
+      if(header.typeRows == sys->typeInfo.arySize)
+      {
+         sys->indexTable = (int *)&base[header.indexOffset];
+      }
+      else
+      {
+         sys->indexTable = CompSystem_Alloc(sys, sizeof(int) * sys->typeInfo.arySize * 
+                                                 sys->slotInfo.arySize);
+         memcpy(sys->indexTable, &base[header.indexOffset], 
+                sizeof(int) * header.typeCount * sys->slotInfo.arySize);
+      }
+   }
+   else
+   {
+      sys->slotArray = NULL;
+      sys->slotInfo.arySize = CompSystem_SetArraySize(sys, (void**)&sys->slotArray, 
+                                                      sizeof(ActorSlot_T), DEFAULT_ALIGNMENT,
+                                                      0, MIN_ARRAY_SIZE);
+      sys->indexTable = CompSystem_Alloc(sys, sizeof(int) * sys->typeInfo.arySize * 
+                                              sys->slotInfo.arySize);
+   }
+   
+   sys->archArray = NULL;
+   sys->archInfo.arySize  = header.archCount;
+   sys->archInfo.eleCount = header.archCount;
+   if(header.archCount > 0)
+   {
+      sys->archArray = (Archetype_T *)&base[header.archOffset];
+   }
+   
+   for(type = 0; type < header.typeCount; type++)
+   {
+      memcpy(&entry, &base[sizeof(SnapshotHeader_T) + sizeof(SnapshotType_T) * type], 
+             sizeof(SnapshotType_T));
+      compTypePtr = &sys->typeArray[type];
+      if(entry.capacity > 0)
+      {
+         compTypePtr->compArray    = &base[entry.compOffset];
+         compTypePtr->actorIdArray = (actorid_t *)&base[entry.actorIdOffset];
+         compTypePtr->compInfo.arySize  = entry.capacity;
+         compTypePtr->compInfo.eleCount = entry.count;
+         if(compTypePtr->pageShift > 0)
+         {
+            CompSystem_AdoptPages(sys, compTypePtr);
+         }
+         
+         // Versions are not saved, loaded components count as added now
+         if(compTypePtr->tracked)
+         {
+            CompSystem_ResizeVersions(sys, compTypePtr, 0);
+            CompSystem_StampElements(compTypePtr, 0, entry.count, sys->tick, 1);
+         }
+      }
+      else if(!compTypePtr->tag)
+      {
+         CompSystem_GrowComponentArrays(sys, compTypePtr, MIN_ARRAY_SIZE);
+      }
+      
+      for(i = 0; fixupFunc != NULL && i < entry.count; i += count)
+      {
+         CompSystem_ComponentForPage(sys, type, i >> compTypePtr->pageShift, &comps, &count);
+         fixupFunc(sys, type, comps, count, userData);
+      }
+   }
+   
+   // Group sizes are not saved, find the members again
+   for(type = 0; type < sys->groupInfo.eleCount; type++)
+   {
+      CompSystem_BuildGroup(sys, type);
+   }
+   CompSystem_DirtyQueries(sys);
+   CompSystem_ResetSpatial(sys);
+   CompSystem_ResetKeyIndexes(sys);
+   (*loaded) = 1;
+}
+
+void CompSystem_Destroy(CompSystem_T sys)
+{
+   int i;
+   CompType_T * compTypePtr;
+   CachedQuery_T * cachedPtr;
+   KeyIndex_T * keyIndexPtr;
+   CompSystem_Allocator_T allocator;
+   unsigned long long traceStart;
+   
+   traceStart = TRACE_CLOCK();
+   CompSystem_ClearFrameCaptures(sys);
+   
+   // Clean Components
+   for(i = 0; i < sys->typeInfo.eleCount; i++)
+   {
+      compTypePtr = &sys->typeArray[i];
+      CompSystem_ClearPool(sys, i);
+      CompSystem_Free(sys, compTypePtr->fieldArray, sizeof(Field_T) * compTypePtr->fieldCount);
+      if(compTypePtr->spatial != NULL)
+      {
+         CompSystem_Free(sys, compTypePtr->spatial->bucketArray, 
+                         sizeof(int) * compTypePtr->spatial->bucketCount);
+         CompSystem_Free(sys, compTypePtr->spatial->entryArray, 
+                         sizeof(SpatialEntry_T) * compTypePtr->spatial->entrySize);
+         CompSystem_Free(sys, compTypePtr->spatial, sizeof(Spatial_T));
+      }
+   }
+   
+   CompSystem_StopThreads(sys);
+   CompSystem_Free(sys, sys->indexTable, sizeof(int) * sys->typeInfo.arySize * 
+                                         sys->slotInfo.arySize);
+   CompSystem_Free(sys, sys->typeArray, sizeof(CompType_T) * sys->typeInfo.arySize);
+   CompSystem_Free(sys, sys->actorArray, sizeof(Actor_T) * sys->actorInfo.arySize);
+   CompSystem_Free(sys, sys->slotArray, sizeof(ActorSlot_T) * sys->slotInfo.arySize);
+   CompSystem_Free(sys, sys->archArray, sizeof(Archetype_T) * sys->archInfo.arySize);
+   CompSystem_Free(sys, sys->scratch, sys->scratchSize);
+   CompSystem_Free(sys, sys->systemArray, sizeof(System_T) * sys->systemInfo.arySize);
+   CompSystem_Free(sys, sys->scheduleArray, sizeof(int) * sys->systemInfo.arySize);
+   for(i = 0; i < sys->groupInfo.eleCount; i++)
+   {
+      CompSystem_Free(sys, sys->groupArray[i].typeList, 
+                      sizeof(comptypeid_t) * sys->groupArray[i].typeCount);
+   }
+   CompSystem_Free(sys, sys->groupArray, sizeof(Group_T) * sys->groupInfo.arySize);
+   for(i = 0; i < sys->cachedInfo.eleCount; i++)
+   {
+      cachedPtr = &sys->cachedArray[i];
+      CompSystem_Free(sys, cachedPtr->memberArray, sizeof(actorid_t) * cachedPtr->memberInfo.arySize);
+      CompSystem_Free(sys, cachedPtr->tupleArray, sizeof(int) * cachedPtr->filter.includeCount * 
+                                                  cachedPtr->memberInfo.arySize);
+      CompSystem_Free(sys, cachedPtr->positionArray, sizeof(int) * cachedPtr->positionSize);
+   }
+   CompSystem_Free(sys, sys->cachedArray, sizeof(CachedQuery_T) * sys->cachedInfo.arySize);
+   for(i = 0; i < sys->keyIndexInfo.eleCount; i++)
+   {
+      keyIndexPtr = &sys->keyIndexArray[i];
+      CompSystem_Free(sys, keyIndexPtr->entryArray, sizeof(KeyEntry_T) * keyIndexPtr->entrySize);
+      CompSystem_Free(sys, keyIndexPtr->slotArray, sizeof(KeySlot_T) * keyIndexPtr->slotSize);
+      CompSystem_Free(sys, keyIndexPtr->pendingArray, 
+                      sizeof(actorid_t) * keyIndexPtr->pendingInfo.arySize);
+   }
+   CompSystem_Free(sys, sys->keyIndexArray, sizeof(KeyIndex_T) * sys->keyIndexInfo.arySize);
+   CompSystem_ReleaseMapping(sys);
+   TRACE_EVENT(sys, "Destroy", traceStart);
+   
+   // The system itself goes last, through a copy of its own allocator
+   allocator = sys->allocator;
+   allocator.freeFunc(allocator.context, sys, sizeof(struct compsystem_s), DEFAULT_ALIGNMENT);
+}
+
+
+static void * CompSystem_DefaultAlloc(void * context, size_t size, size_t alignment)
+{
+   byte_t * block, * aligned;
+   (void)context;
+   
+   if(alignment <= DEFAULT_ALIGNMENT)
+   {
+      return malloc(size);
+   }
+   
+   // Over-aligned blocks keep the pointer malloc returned just before them
+   block = malloc(size + alignment + sizeof(void *));
+   if(block == NULL)
+   {
+      return NULL;
+   }
+   aligned = (byte_t *)(((size_t)(block + sizeof(void *)) + alignment - 1) & ~(alignment - 1));
+   memcpy(aligned - sizeof(void *), &block, sizeof(void *));
+   return aligned;
+}
+
+static void * CompSystem_DefaultRealloc(void * context, void * ptr, size_t oldSize, 
+                                        size_t newSize, size_t alignment)
+{
+   void * temp;
+   
+   if(alignment <= DEFAULT_ALIGNMENT)
+   {
+      return realloc(ptr, newSize);
+   }
+   
+   temp = CompSystem_DefaultAlloc(context, newSize, alignment);
+   if(temp != NULL)
+   {
+      memcpy(temp, ptr, MIN(oldSize, newSize));
+      CompSystem_DefaultFree(context, ptr, oldSize, alignment);
+   }
+   return temp;
+}
+
+static void CompSystem_DefaultFree(void * context, void * ptr, size_t size, size_t alignment)
+{
+   void * block;
+   (void)context;
+   (void)size;
+   
+   if(alignment <= DEFAULT_ALIGNMENT || ptr == NULL)
+   {
+      free(ptr);
+      return;
+   }
+   memcpy(&block, (byte_t *)ptr - sizeof(void *), sizeof(void *));
+   free(block);
+}
+
+static void * CompSystem_Alloc(CompSystem_T sys, size_t size)
+{
+   return sys->allocator.allocFunc(sys->allocator.context, size, DEFAULT_ALIGNMENT);
+}
+
+static void CompSystem_Free(CompSystem_T sys, void * ptr, size_t size)
+{
+   CompSystem_FreeAligned(sys, ptr, size, DEFAULT_ALIGNMENT);
+}
+
+static void CompSystem_FreeAligned(CompSystem_T sys, void * ptr, size_t size, size_t alignment)
+{
+   // Tables adopted from a snapshot belong to the mapping
+   if(ptr != NULL && !CompSystem_IsMapped(sys, ptr))
+   {
+      sys->allocator.freeFunc(sys->allocator.context, ptr, size, alignment);
+   }
+}
+
+static int CompSystem_IsMapped(CompSystem_T sys, const void * ptr)
+{
+   return sys->mapBase != NULL && (const byte_t *)ptr >= sys->mapBase &&
+          (const byte_t *)ptr < sys->mapBase + sys->mapSize;
+}
+
+static int CompSystem_GrowArraySize(CompSystem_T sys, void ** array, int elementSize, 
+                                    int size, int minSize)
+{
+   int newSize;
+   
+   // Double the capacity so that N appends cost O(N) copies in total
+   newSize = size < MIN_ARRAY_SIZE ? MIN_ARRAY_SIZE : size;
+   while(newSize < minSize)
+   {
+      newSize *= 2;
+   }
+   
+   if(newSize == size)
+   {
+      return size;
+   }
+   return CompSystem_SetArraySize(sys, array, elementSize, DEFAULT_ALIGNMENT, size, newSize);
+}
+
+static int CompSystem_SetArraySize(CompSystem_T sys, void ** array, int elementSize, int alignment,
+                                   int size, int newSize)
+{
+   byte_t * temp;
+   if(CompSystem_IsMapped(sys, (*array)))
+   {
+      // Mapped tables can not be resized, so the first growth copies them out
+      temp = sys->allocator.allocFunc(sys->allocator.context, (size_t)newSize * elementSize, 
+                                      alignment);
+      memcpy(temp, (*array), (size_t)MIN(size, newSize) * elementSize);
+   }
+   else if((*array) == NULL)
+   {
+      temp = sys->allocator.allocFunc(sys->allocator.context, (size_t)newSize * elementSize, 
+                                      alignment);
+   }
+   else
+   {
+      temp = sys->allocator.reallocFunc(sys->allocator.context, (*array), 
+                                        (size_t)size * elementSize,
+                                        (size_t)newSize * elementSize, alignment);
+   }
+   
+   if(newSize != size)
+   {
+      STATS_ADD(sys, growCount, 1);
+   }
+   
+   // Keep the calloc behavior of zeroing new elements
+   if(newSize > size)
+   {
+      memset(&temp[(size_t)size * elementSize], 0, (size_t)(newSize - size) * elementSize);
+   }
+   (*array) = temp;
+   return newSize;
+}
+
+
+static int CompSystem_FindActorFromID(CompSystem_T sys, actorid_t actor)
+{   
+   ActorSlot_T * slotPtr;
+   actorid_t slot;
+   
+   STATS_ADD(sys, lookupCount, 1);
+   slot = COMPSYSTEM_ACTOR_INDEX(actor);
+   if(slot >= (actorid_t)sys->slotInfo.eleCount)
+   {
+      return COMPSYSTEM_INVALID_INDEX;
+   }
+   
+   // Free slots have no actor index, and a slot that was reused has moved
+   // on to a newer generation than the one baked into a stale ID
+   slotPtr = &sys->slotArray[slot];
+   if(slotPtr->generation != COMPSYSTEM_ACTOR_GENERATION(actor))
+   {
+      return COMPSYSTEM_INVALID_INDEX;
+   }
+   return slotPtr->actorIndex;
+}
+
+static actorid_t CompSystem_AcquireSlot(CompSystem_T sys, int actorIndex)
+{
+   ActorSlot_T * slotPtr;
+   int slot;
+   
+   if(sys->freeSlot != COMPSYSTEM_INVALID_INDEX)
+   {
+      // Recycle the most recently released slot
+      slot = sys->freeSlot;
+      sys->freeSlot = sys->slotArray[slot].nextFree;
+      CompSystem_Journal(sys, eJournal_Slot, 0, slot);
+   }
+   else
+   {
+      // Keep the top slot index unused so no ID can equal COMPSYSTEM_INVALID_ACTOR
+      if((actorid_t)sys->slotInfo.eleCount >= COMPSYSTEM_ACTOR_INDEX_MASK)
+      {
+         return COMPSYSTEM_INVALID_ACTOR;
+      }
+      
+      if(sys->slotInfo.eleCount >= sys->slotInfo.arySize)
+      {
+         CompSystem_GrowSlots(sys, sys->slotInfo.eleCount + 1);
+      }
+      slot = sys->slotInfo.eleCount;
+      sys->slotInfo.eleCount ++;
+      sys->slotArray[slot].generation = 0;
+   }
+   
+   slotPtr = &sys->slotArray[slot];
+   slotPtr->actorIndex = actorIndex;
+   slotPtr->nextFree   = COMPSYSTEM_INVALID_INDEX;
+   return (slotPtr->generation << COMPSYSTEM_ACTOR_INDEX_BITS) | (actorid_t)slot;
+}
+
+static void CompSystem_ReleaseSlot(CompSystem_T sys, actorid_t actor)
+{
+   ActorSlot_T * slotPtr;
+   int slot;
+   
+   slot = COMPSYSTEM_ACTOR_INDEX(actor);
+   slotPtr = &sys->slotArray[slot];
+   CompSystem_Journal(sys, eJournal_Slot, 0, slot);
+   
+   // Bump the generation so every outstanding copy of this ID goes stale
+   // The top generation is reserved for pending actors, so wrap before it
+   slotPtr->generation = (slotPtr->generation + 1) % COMPSYSTEM_ACTOR_GENERATION_MASK;
+   slotPtr->actorIndex = COMPSYSTEM_INVALID_INDEX;
+   slotPtr->nextFree   = sys->freeSlot;
+   sys->freeSlot       = slot;
+}
+
+static void CompSystem_GrowSlots(CompSystem_T sys, int minSize)
+{
+   unsigned long long traceStart;
+   int * newTable;
+   int oldStride, type;
+   
+   traceStart = TRACE_CLOCK();
+   oldStride = sys->slotInfo.arySize;
+   sys->slotInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->slotArray,
+                                                    sizeof(ActorSlot_T),
+                                                    sys->slotInfo.arySize,
+                                                    minSize);
+   if(sys->slotInfo.arySize == oldStride)
+   {
+      return;
+   }
+   
+   // Each row gets wider, so copy the rows into their new positions
+   newTable = CompSystem_Alloc(sys, sizeof(int) * sys->typeInfo.arySize * sys->slotInfo.arySize);
+   for(type = 0; type < sys->typeInfo.eleCount; type++)
+   {
+      memcpy(&newTable[(size_t)type * sys->slotInfo.arySize], 
+             &sys->indexTable[(size_t)type * oldStride],
+             sizeof(int) * sys->slotInfo.eleCount);
+   }
+   CompSystem_Free(sys, sys->indexTable, sizeof(int) * sys->typeInfo.arySize * oldStride);
+   sys->indexTable = newTable;
+   TRACE_EVENT(sys, "Grow", traceStart);
+}
+
+static Actor_T * CompSystem_GetActorPtr(CompSystem_T sys, actorid_t actor)
+{
+   return &sys->actorArray[sys->slotArray[COMPSYSTEM_ACTOR_INDEX(actor)].actorIndex];
+}
+
+static void CompSystem_GrowComponentArrays(CompSystem_T sys, CompType_T * compTypePtr, int minSize)
+{
+   const Field_T * fieldPtr;
+   unsigned long long traceStart;
+   int oldSize, count, i;
+   
+   traceStart = TRACE_CLOCK();
+   oldSize = compTypePtr->compInfo.arySize;
+   compTypePtr->compInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&compTypePtr->actorIdArray, 
+                                                            sizeof(actorid_t),
+                                                            oldSize,
+                                                            minSize);
+   if(compTypePtr->compInfo.arySize != oldSize && compTypePtr->tracked)
+   {
+      CompSystem_ResizeVersions(sys, compTypePtr, oldSize);
+   }
+   if(compTypePtr->compInfo.arySize != oldSize && compTypePtr->pageShift > 0)
+   {
+      // Paged pools only add pages, no component moves
+      CompSystem_GrowPages(sys, compTypePtr);
+#ifdef COMPSYSTEM_STATS
+      compTypePtr->growCount ++;
+#endif
+      TRACE_EVENT(sys, "Grow", traceStart);
+   }
+   else if(compTypePtr->compInfo.arySize != oldSize)
+   {
+      (void)CompSystem_SetArraySize(sys, (void**)&compTypePtr->compArray, 
+                                    compTypePtr->elementSize,
+                                    compTypePtr->alignment,
+                                    oldSize,
+                                    compTypePtr->compInfo.arySize);
+      
+      // Columns spread out to the new capacity, last first so none is overwritten.
+      // Open frames may still undo into the slots past eleCount, keep them all.
+      count = sys->frameCount > 0 ? oldSize : compTypePtr->compInfo.eleCount;
+      for(i = compTypePtr->fieldCount - 1; i > 0 && oldSize > 0; i--)
+      {
+         fieldPtr = &compTypePtr->fieldArray[i];
+         memmove(&compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * fieldPtr->start],
+                 &compTypePtr->compArray[(size_t)oldSize * fieldPtr->start],
+                 (size_t)count * fieldPtr->size);
+      }
+#ifdef COMPSYSTEM_STATS
+      compTypePtr->growCount ++;
+#endif
+      TRACE_EVENT(sys, "Grow", traceStart);
+   }
+}
+
+static void CompSystem_SetTypeLayout(CompSystem_T sys, comptypeid_t type, int elementSize, 
+                                     int alignment, const CompSystem_Field_T * fields, 
+                                     int fieldCount, CompSystem_DestroyFunc_T destroyFunc)
+{
+   CompType_T * compTypePtr;
+   int i, start;
+   compTypePtr = &sys->typeArray[type];
+   
+   // Remove old data if present, an empty pool leaves its group empty
+   if(POOL_EXISTS(compTypePtr))
+   {
+      CompSystem_FreeComponentArrays(sys, compTypePtr);
+   }
+   compTypePtr->pageShift = 0;
+   if(compTypePtr->group != COMPSYSTEM_INVALID_INDEX)
+   {
+      sys->groupArray[compTypePtr->group].size = 0;
+   }
+   CompSystem_Free(sys, compTypePtr->fieldArray, sizeof(Field_T) * compTypePtr->fieldCount);
+   compTypePtr->fieldArray = NULL;
+   compTypePtr->fieldCount = 0;
+   compTypePtr->stride     = elementSize;
+   
+   if(fieldCount > 0)
+   {
+      compTypePtr->fieldArray = CompSystem_Alloc(sys, sizeof(Field_T) * fieldCount);
+      compTypePtr->fieldCount = fieldCount;
+      compTypePtr->stride     = fields[0].size;
+      start = 0;
+      for(i = 0; i < fieldCount; i++)
+      {
+         compTypePtr->fieldArray[i].size  = fields[i].size;
+         compTypePtr->fieldArray[i].start = start;
+         start += fields[i].size;
+      }
+   }
+   
+   // Create new buffers
+   compTypePtr->elementSize       = elementSize;
+   compTypePtr->alignment         = MAX(alignment, DEFAULT_ALIGNMENT);
+   compTypePtr->destroyFunc       = destroyFunc;
+   compTypePtr->destroyRangeFunc  = NULL;
+   compTypePtr->trivial           = (destroyFunc == NULL);
+   compTypePtr->compInfo.arySize  = 0;
+   compTypePtr->compInfo.eleCount = 0;
+   
+   // Empty types that fit the signature are tags and never get a pool
+   compTypePtr->tag = (elementSize == 0 && type < COMPSYSTEM_MASK_TYPES);
+   if(compTypePtr->tag)
+   {
+      compTypePtr->trivial = 1;
+   }
+   else
+   {
+      CompSystem_GrowComponentArrays(sys, compTypePtr, MIN_ARRAY_SIZE);
+   }
+   
+   // Archetype moves stage one component, with its versions, at a time
+   if(elementSize + (int)VERSION_BYTES > sys->scratchSize)
+   {
+      sys->scratchSize = CompSystem_SetArraySize(sys, (void**)&sys->scratch, 1, 
+                                                 DEFAULT_ALIGNMENT, sys->scratchSize, 
+                                                 elementSize + (int)VERSION_BYTES);
+   }
+}
+
+static void CompSystem_GrowPages(CompSystem_T sys, CompType_T * compTypePtr)
+{
+   int pageCount;
+   
+   pageCount = (compTypePtr->compInfo.arySize + PAGE_SIZE(compTypePtr) - 1) >> 
+               compTypePtr->pageShift;
+   compTypePtr->pageInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&compTypePtr->pageArray,
+                                                            sizeof(byte_t *),
+                                                            compTypePtr->pageInfo.arySize,
+                                                            pageCount);
+   while(compTypePtr->pageInfo.eleCount < pageCount)
+   {
+      (void)CompSystem_SetArraySize(sys, 
+                                    (void**)&compTypePtr->pageArray[compTypePtr->pageInfo.eleCount],
+                                    compTypePtr->elementSize, compTypePtr->alignment, 
+                                    0, PAGE_SIZE(compTypePtr));
+      compTypePtr->pageInfo.eleCount ++;
+   }
+}
+
+static void CompSystem_AdoptPages(CompSystem_T sys, CompType_T * compTypePtr)
+{
+   byte_t * compArray;
+   int pageSize, i;
+   
+   // Whole pages of the mapping are used in place, a partial one is copied out
+   compArray = compTypePtr->compArray;
+   compTypePtr->compArray = NULL;
+   pageSize = PAGE_SIZE(compTypePtr);
+   compTypePtr->pageInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&compTypePtr->pageArray,
+                                                            sizeof(byte_t *), 0,
+                                                            compTypePtr->compInfo.arySize / pageSize);
+   for(i = 0; i + pageSize <= compTypePtr->compInfo.arySize; i += pageSize)
+   {
+      compTypePtr->pageArray[compTypePtr->pageInfo.eleCount] = 
+         &compArray[(size_t)i * compTypePtr->elementSize];
+      compTypePtr->pageInfo.eleCount ++;
+   }
+   CompSystem_GrowPages(sys, compTypePtr);
+   if(i < compTypePtr->compInfo.eleCount)
+   {
+      memcpy(compTypePtr->pageArray[i >> compTypePtr->pageShift], 
+             &compArray[(size_t)i * compTypePtr->elementSize],
+             (size_t)(compTypePtr->compInfo.eleCount - i) * compTypePtr->elementSize);
+   }
+}
+
+static void CompSystem_FreeComponentArrays(CompSystem_T sys, CompType_T * compTypePtr)
+{
+   int i;
+   
+   for(i = 0; i < compTypePtr->pageInfo.eleCount; i++)
+   {
+      CompSystem_FreeAligned(sys, compTypePtr->pageArray[i], 
+                             (size_t)PAGE_SIZE(compTypePtr) * compTypePtr->elementSize,
+                             compTypePtr->alignment);
+   }
+   CompSystem_Free(sys, compTypePtr->pageArray, sizeof(byte_t *) * compTypePtr->pageInfo.arySize);
+   compTypePtr->pageArray         = NULL;
+   compTypePtr->pageInfo.arySize  = 0;
+   compTypePtr->pageInfo.eleCount = 0;
+   CompSystem_FreeAligned(sys, compTypePtr->compArray, 
+                          (size_t)compTypePtr->compInfo.arySize * compTypePtr->elementSize,
+                          compTypePtr->alignment);
+   CompSystem_Free(sys, compTypePtr->actorIdArray, 
+                   sizeof(actorid_t) * compTypePtr->compInfo.arySize);
+   CompSystem_Free(sys, compTypePtr->addedArray, 
+                   sizeof(comptick_t) * compTypePtr->compInfo.arySize);
+   CompSystem_Free(sys, compTypePtr->changedArray, 
+                   sizeof(comptick_t) * compTypePtr->compInfo.arySize);
+   CompSystem_Free(sys, compTypePtr->chunkArray, 
+                   sizeof(comptick_t) * CHUNK_COUNT(compTypePtr->compInfo.arySize));
+   compTypePtr->compArray    = NULL;
+   compTypePtr->actorIdArray = NULL;
+   compTypePtr->addedArray   = NULL;
+   compTypePtr->changedArray = NULL;
+   compTypePtr->chunkArray   = NULL;
+}
+
+static void CompSystem_ResizeVersions(CompSystem_T sys, CompType_T * compTypePtr, int oldSize)
+{
+   int newSize;
+   
+   newSize = compTypePtr->compInfo.arySize;
+   (void)CompSystem_SetArraySize(sys, (void**)&compTypePtr->addedArray, sizeof(comptick_t),
+                                 DEFAULT_ALIGNMENT, oldSize, newSize);
+   (void)CompSystem_SetArraySize(sys, (void**)&compTypePtr->changedArray, sizeof(comptick_t),
+                                 DEFAULT_ALIGNMENT, oldSize, newSize);
+   (void)CompSystem_SetArraySize(sys, (void**)&compTypePtr->chunkArray, sizeof(comptick_t),
+                                 DEFAULT_ALIGNMENT, CHUNK_COUNT(oldSize), CHUNK_COUNT(newSize));
+   
+   // Fresh slots have never changed
+   if(newSize > oldSize)
+   {
+      memset(&compTypePtr->addedArray[oldSize], 0, sizeof(comptick_t) * (newSize - oldSize));
+      memset(&compTypePtr->changedArray[oldSize], 0, sizeof(comptick_t) * (newSize - oldSize));
+      memset(&compTypePtr->chunkArray[CHUNK_COUNT(oldSize)], 0, 
+             sizeof(comptick_t) * (CHUNK_COUNT(newSize) - CHUNK_COUNT(oldSize)));
+   }
+}
+
+static void CompSystem_StampElements(CompType_T * compTypePtr, int first, int count, 
+                                     comptick_t tick, int added)
+{
+   int i;
+   
+   if(!compTypePtr->tracked || count <= 0)
+   {
+      return;
+   }
+   for(i = first; i < first + count; i++)
+   {
+      compTypePtr->changedArray[i] = tick;
+      if(added)
+      {
+         compTypePtr->addedArray[i] = tick;
+      }
+   }
+   for(i = first / CHANGE_CHUNK; i <= (first + count - 1) / CHANGE_CHUNK; i++)
+   {
+      compTypePtr->chunkArray[i] = tick;
+   }
+}
+
+static void CompSystem_NextChangedRun(const CompType_T * compTypePtr, const comptick_t * versions,
+                                      comptick_t tick, int * position, int * first, int * count)
+{
+   int index, end;
+   
+   index = (*position);
+   end = compTypePtr->compInfo.eleCount;
+   (*first) = end;
+   (*count) = 0;
+   if(versions == NULL)
+   {
+      // Untracked pools report everything once
+      if(index < end)
+      {
+         (*first) = index;
+         (*count) = end - index;
+      }
+      (*position) = end;
+      return;
+   }
+   
+   while(index < end)
+   {
+      if(compTypePtr->chunkArray[index / CHANGE_CHUNK] < tick)
+      {
+         index = (index / CHANGE_CHUNK + 1) * CHANGE_CHUNK;
+      }
+      else if(versions[index] >= tick)
+      {
+         (*first) = index;
+         while(index < end && versions[index] >= tick)
+         {
+            index ++;
+         }
+         (*count) = index - (*first);
+         break;
+      }
+      else
+      {
+         index ++;
+      }
+   }
+   (*position) = MIN(index, end);
+}
+
+static byte_t * CompSystem_ElementPtr(const CompType_T * compTypePtr, int index)
+{
+   if(compTypePtr->pageShift > 0)
+   {
+      return &compTypePtr->pageArray[index >> compTypePtr->pageShift]
+                                    [(size_t)(index & (PAGE_SIZE(compTypePtr) - 1)) * 
+                                     compTypePtr->stride];
+   }
+   return &compTypePtr->compArray[(size_t)index * compTypePtr->stride];
+}
+
+static int CompSystem_PageRun(const CompType_T * compTypePtr, int index, int count)
+{
+   // Contiguous pools are one run, pages end at the next page boundary
+   if(compTypePtr->pageShift > 0)
+   {
+      return MIN(count, PAGE_SIZE(compTypePtr) - (index & (PAGE_SIZE(compTypePtr) - 1)));
+   }
+   return count;
+}
+
+static void CompSystem_CopyElements(CompType_T * compTypePtr, int to, int from, int count)
+{
+   byte_t * column;
+   int i, size;
+   
+   // Versions travel with their components, the chunks they land in only grow
+   if(compTypePtr->tracked)
+   {
+      memmove(&compTypePtr->addedArray[to], &compTypePtr->addedArray[from], 
+              sizeof(comptick_t) * count);
+      memmove(&compTypePtr->changedArray[to], &compTypePtr->changedArray[from], 
+              sizeof(comptick_t) * count);
+      for(i = to; i < to + count; i++)
+      {
+         compTypePtr->chunkArray[i / CHANGE_CHUNK] = MAX(compTypePtr->chunkArray[i / CHANGE_CHUNK],
+                                                         compTypePtr->changedArray[i]);
+      }
+   }
+   
+   // Runs are cut where either side crosses a page, walking back to front
+   // when the destination overlaps the end of the source
+   if(compTypePtr->fieldCount == 0 && to <= from)
+   {
+      for(i = 0; i < count; i += size)
+      {
+         size = CompSystem_PageRun(compTypePtr, from + i, 
+                                   CompSystem_PageRun(compTypePtr, to + i, count - i));
+         memmove(CompSystem_ElementPtr(compTypePtr, to + i), 
+                 CompSystem_ElementPtr(compTypePtr, from + i),
+                 (size_t)size * compTypePtr->elementSize);
+      }
+      return;
+   }
+   if(compTypePtr->fieldCount == 0)
+   {
+      for(i = count; i > 0; i -= size)
+      {
+         size = i;
+         if(compTypePtr->pageShift > 0)
+         {
+            size = MIN(size, MIN(((to + i - 1) & (PAGE_SIZE(compTypePtr) - 1)) + 1,
+                                 ((from + i - 1) & (PAGE_SIZE(compTypePtr) - 1)) + 1));
+         }
+         memmove(CompSystem_ElementPtr(compTypePtr, to + i - size), 
+                 CompSystem_ElementPtr(compTypePtr, from + i - size),
+                 (size_t)size * compTypePtr->elementSize);
+      }
+      return;
+   }
+   
+   for(i = 0; i < compTypePtr->fieldCount; i++)
+   {
+      size = compTypePtr->fieldArray[i].size;
+      column = &compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * 
+                                       compTypePtr->fieldArray[i].start];
+      memmove(&column[(size_t)to * size], &column[(size_t)from * size], (size_t)count * size);
+   }
+}
+
+static void CompSystem_ReadElement(const CompType_T * compTypePtr, int index, byte_t * out)
+{
+   const Field_T * fieldPtr;
+   int i;
+   
+   if(compTypePtr->fieldCount == 0)
+   {
+      memcpy(out, CompSystem_ElementPtr(compTypePtr, index), compTypePtr->elementSize);
+      return;
+   }
+   
+   // Gather the fields into one packed element
+   for(i = 0; i < compTypePtr->fieldCount; i++)
+   {
+      fieldPtr = &compTypePtr->fieldArray[i];
+      memcpy(&out[fieldPtr->start], 
+             &compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * fieldPtr->start + 
+                                     (size_t)index * fieldPtr->size],
+             fieldPtr->size);
+   }
+}
+
+static void CompSystem_WriteElement(CompType_T * compTypePtr, int index, const byte_t * in)
+{
+   const Field_T * fieldPtr;
+   int i;
+   
+   if(compTypePtr->fieldCount == 0)
+   {
+      memcpy(CompSystem_ElementPtr(compTypePtr, index), in, compTypePtr->elementSize);
+      return;
+   }
+   
+   for(i = 0; i < compTypePtr->fieldCount; i++)
+   {
+      fieldPtr = &compTypePtr->fieldArray[i];
+      memcpy(&compTypePtr->compArray[(size_t)compTypePtr->compInfo.arySize * fieldPtr->start + 
+                                     (size_t)index * fieldPtr->size],
+             &in[fieldPtr->start], fieldPtr->size);
+   }
+}
+
+static void CompSystem_ReadVersions(const CompType_T * compTypePtr, int index, byte_t * out)
+{
+   // Tracked versions are staged after the component bytes
+   if(compTypePtr->tracked)
+   {
+      memcpy(&out[compTypePtr->elementSize], &compTypePtr->addedArray[index], 
+             sizeof(comptick_t));
+      memcpy(&out[compTypePtr->elementSize + sizeof(comptick_t)], 
+             &compTypePtr->changedArray[index], sizeof(comptick_t));
+   }
+}
+
+static void CompSystem_WriteVersions(CompType_T * compTypePtr, int index, const byte_t * in)
+{
+   int chunk;
+   
+   if(compTypePtr->tracked)
+   {
+      memcpy(&compTypePtr->addedArray[index], &in[compTypePtr->elementSize], 
+             sizeof(comptick_t));
+      memcpy(&compTypePtr->changedArray[index], 
+             &in[compTypePtr->elementSize + sizeof(comptick_t)], sizeof(comptick_t));
+      chunk = index / CHANGE_CHUNK;
+      compTypePtr->chunkArray[chunk] = MAX(compTypePtr->chunkArray[chunk], 
+                                           compTypePtr->changedArray[index]);
+   }
+}
+
+static void CompSystem_Journal(CompSystem_T sys, int kind, comptypeid_t type, int index)
+{
+   CompSystem_JournalRange(sys, kind, type, index, 1);
+}
+
+static void CompSystem_JournalRange(CompSystem_T sys, int kind, comptypeid_t type, 
+                                   int first, int count)
+{
+   int i;
+   
+   if(sys->frameCount == 0)
+   {
+      return;
+   }
+   
+   // Kernels and systems running on the pool append to the same journal
+   if(sys->parallel)
+   {
+      ThreadPool_Lock(sys->threadPool);
+   }
+   for(i = first; i < first + count; i++)
+   {
+      CompSystem_JournalEntry(sys, kind, type, i);
+   }
+   if(sys->parallel)
+   {
+      ThreadPool_Unlock(sys->threadPool);
+   }
+}
+
+static void CompSystem_JournalEntry(CompSystem_T sys, int kind, comptypeid_t type, int index)
+{
+   Frame_T * framePtr;
+   CompType_T * compTypePtr;
+   JournalEntry_T entry;
+   byte_t * data;
+   int offset, size, limit;
+   
+   framePtr = &sys->frameArray[sys->frameHead];
+   compTypePtr = &sys->typeArray[type];
+   switch(kind)
+   {
+   case eJournal_Component:
+      size = compTypePtr->elementSize + (compTypePtr->tracked ? (int)VERSION_BYTES : 0);
+      limit = ((int)type < framePtr->countInfo.eleCount) ? framePtr->limitArray[type] : 0;
+      break;
+   case eJournal_ActorId:
+      size = sizeof(actorid_t);
+      limit = ((int)type < framePtr->countInfo.eleCount) ? framePtr->limitArray[type] : 0;
+      break;
+   case eJournal_IndexEntry:
+      size = sizeof(int);
+      limit = framePtr->slotCount;
+      break;
+   case eJournal_Actor:
+      size = sizeof(Actor_T);
+      limit = framePtr->actorLimit;
+      break;
+   case eJournal_GroupSize:
+      size = sizeof(int);
+      limit = sys->groupInfo.eleCount;
+      break;
+   default:
+      size = sizeof(ActorSlot_T);
+      limit = framePtr->slotCount;
+      break;
+   }
+   
+   if(index >= limit)
+   {
+      return;
+   }
+   
+   offset = framePtr->journalInfo.eleCount;
+   if(offset + COMMAND_ALIGN(size) + (int)sizeof(JournalEntry_T) > framePtr->journalInfo.arySize)
+   {
+      framePtr->journalInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&framePtr->journal, 1,
+                                                               framePtr->journalInfo.arySize,
+                                                               offset + COMMAND_ALIGN(size) + 
+                                                               (int)sizeof(JournalEntry_T));
+   }
+   
+   data = &framePtr->journal[offset];
+   switch(kind)
+   {
+   case eJournal_Component:
+      CompSystem_ReadElement(compTypePtr, index, data);
+      CompSystem_ReadVersions(compTypePtr, index, data);
+      break;
+   case eJournal_ActorId:
+      memcpy(data, &compTypePtr->actorIdArray[index], size);
+      break;
+   case eJournal_IndexEntry:
+      memcpy(data, &INDEX_ENTRY(sys, type, index), size);
+      break;
+   case eJournal_Actor:
+      memcpy(data, &sys->actorArray[index], size);
+      break;
+   case eJournal_GroupSize:
+      memcpy(data, &sys->groupArray[index].size, size);
+      break;
+   default:
+      memcpy(data, &sys->slotArray[index], size);
+      break;
+   }
+   
+   entry.kind  = kind;
+   entry.type  = type;
+   entry.index = index;
+   entry.size  = size;
+   memcpy(&data[COMMAND_ALIGN(size)], &entry, sizeof(JournalEntry_T));
+   framePtr->journalInfo.eleCount = offset + COMMAND_ALIGN(size) + sizeof(JournalEntry_T);
+}
+
+static void CompSystem_OpenFrame(CompSystem_T sys, Frame_T * framePtr)
+{
+   const Frame_T * prevPtr;
+   int type, size;
+   
+   if(framePtr->countInfo.arySize < sys->typeInfo.eleCount)
+   {
+      size = framePtr->countInfo.arySize;
+      (void)CompSystem_GrowArraySize(sys, (void**)&framePtr->limitArray, sizeof(int),
+                                     size, sys->typeInfo.eleCount);
+      framePtr->countInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&framePtr->countArray, 
+                                                             sizeof(int), size,
+                                                             sys->typeInfo.eleCount);
+   }
+   framePtr->countInfo.eleCount = sys->typeInfo.eleCount;
+   for(type = 0; type < sys->typeInfo.eleCount; type++)
+   {
+      framePtr->countArray[type] = sys->typeArray[type].compInfo.eleCount;
+      framePtr->limitArray[type] = sys->typeArray[type].compInfo.eleCount;
+   }
+   framePtr->actorCount = sys->actorInfo.eleCount;
+   framePtr->actorLimit = sys->actorInfo.eleCount;
+   
+   // An older frame still needs entries that lie past this frame's counts
+   if(sys->frameCount > 1)
+   {
+      prevPtr = &sys->frameArray[(sys->frameHead + COMPSYSTEM_ROLLBACK_FRAMES - 1) % 
+                                 COMPSYSTEM_ROLLBACK_FRAMES];
+      for(type = 0; type < prevPtr->countInfo.eleCount; type++)
+      {
+         framePtr->limitArray[type] = MAX(framePtr->limitArray[type], prevPtr->limitArray[type]);
+      }
+      framePtr->actorLimit = MAX(framePtr->actorLimit, prevPtr->actorLimit);
+   }
+   framePtr->slotCount  = sys->slotInfo.eleCount;
+   framePtr->freeSlot   = sys->freeSlot;
+   framePtr->journalInfo.eleCount = 0;
+}
+
+static void CompSystem_UndoFrame(CompSystem_T sys, Frame_T * framePtr)
+{
+   CompType_T * compTypePtr;
+   JournalEntry_T entry;
+   byte_t * data;
+   int offset, type;
+   
+   // Newest record first, so each entry ends up with its oldest bytes
+   offset = framePtr->journalInfo.eleCount;
+   while(offset > 0)
+   {
+      offset -= sizeof(JournalEntry_T);
+      memcpy(&entry, &framePtr->journal[offset], sizeof(JournalEntry_T));
+      offset -= COMMAND_ALIGN(entry.size);
+      data = &framePtr->journal[offset];
+      
+      compTypePtr = &sys->typeArray[entry.type];
+      switch(entry.kind)
+      {
+      case eJournal_Component:
+         // Restored components count as changed for incremental consumers
+         CompSystem_WriteElement(compTypePtr, entry.index, data);
+         CompSystem_WriteVersions(compTypePtr, entry.index, data);
+         CompSystem_StampElements(compTypePtr, entry.index, 1, sys->tick, 0);
+         break;
+      case eJournal_ActorId:
+         memcpy(&compTypePtr->actorIdArray[entry.index], data, entry.size);
+         break;
+      case eJournal_IndexEntry:
+         memcpy(&INDEX_ENTRY(sys, entry.type, entry.index), data, entry.size);
+         break;
+      case eJournal_Actor:
+         memcpy(&sys->actorArray[entry.index], data, entry.size);
+         break;
+      case eJournal_GroupSize:
+         memcpy(&sys->groupArray[entry.index].size, data, entry.size);
+         break;
+      default:
+         memcpy(&sys->slotArray[entry.index], data, entry.size);
+         break;
+      }
+   }
+   
+   // Whatever was appended since lies past the restored counts
+   for(type = 0; type < framePtr->countInfo.eleCount; type++)
+   {
+      sys->typeArray[type].compInfo.eleCount = framePtr->countArray[type];
+   }
+   sys->actorInfo.eleCount = framePtr->actorCount;
+   sys->slotInfo.eleCount  = framePtr->slotCount;
+   sys->freeSlot           = framePtr->freeSlot;
+   framePtr->journalInfo.eleCount = 0;
+}
+
+static void CompSystem_DestroyComponents(CompSystem_T sys, comptypeid_t type, 
+                                         int first, int count)
+{
+   CompType_T * compTypePtr;
+   int i, run;
+   
+   compTypePtr = &sys->typeArray[type];
+   if(compTypePtr->trivial || count <= 0)
+   {
+      return;
+   }
+   
+   if(compTypePtr->destroyRangeFunc != NULL)
+   {
+      for(i = first; i < first + count; i += run)
+      {
+         run = CompSystem_PageRun(compTypePtr, i, first + count - i);
+         compTypePtr->destroyRangeFunc(CompSystem_ElementPtr(compTypePtr, i), run, sys, type,
+                                       &compTypePtr->actorIdArray[i]);
+      }
+   }
+   else
+   {
+      for(i = first; i < first + count; i++)
+      {
+         compTypePtr->destroyFunc(CompSystem_ElementPtr(compTypePtr, i), sys, type,
+                                  compTypePtr->actorIdArray[i]);
+      }
+   }
+}
+
+
+static actorid_t CompSystem_QueryOwner(const CompSystem_Query_T * query, int position)
+{
+   if(query->driver == COMPSYSTEM_INVALID_INDEX)
+   {
+      return query->sys->actorArray[position].id;
+   }
+   return query->sys->typeArray[query->include[query->driver]].actorIdArray[position];
+}
+
+static int CompSystem_QueryMatchActor(const CompSystem_Query_T * query, actorid_t actor,
+                                      int * indices, int stride)
+{
+   CompSystem_T sys;
+   int i;
+   
+   // Tags are checked on the signature, their index stays invalid
+   sys = query->sys;
+   if(query->tagged && !CompSystem_MaskMatches(&CompSystem_GetActorPtr(sys, actor)->signature,
+                                               &query->tagInclude, &query->tagExclude))
+   {
+      return 0;
+   }
+   for(i = 0; i < query->excludeCount; i++)
+   {
+      if(INDEX_ENTRY(sys, query->exclude[i], actor) != COMPSYSTEM_INVALID_INDEX)
+      {
+         return 0;
+      }
+   }
+   
+   for(i = 0; i < query->includeCount; i++)
+   {
+      indices[i * stride] = INDEX_ENTRY(sys, query->include[i], actor);
+      if(indices[i * stride] == COMPSYSTEM_INVALID_INDEX && 
+         !(query->tagged && sys->typeArray[query->include[i]].tag))
+      {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+static void CompSystem_UpdateQueries(CompSystem_T sys, actorid_t actor, comptypeid_t type)
+{
+   CachedQuery_T * cachedPtr;
+   int indices[COMPSYSTEM_QUERY_MAX_TYPES];
+   int query, i, slot, position, mentioned, match;
+   
+   // Only queries naming type can change, an invalid type checks them all
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   for(query = 0; query < sys->cachedInfo.eleCount; query++)
+   {
+      cachedPtr = &sys->cachedArray[query];
+      mentioned = (int)type == COMPSYSTEM_INVALID_INDEX;
+      for(i = 0; i < cachedPtr->filter.includeCount && !mentioned; i++)
+      {
+         mentioned = cachedPtr->filter.include[i] == type;
+      }
+      for(i = 0; i < cachedPtr->filter.excludeCount && !mentioned; i++)
+      {
+         mentioned = cachedPtr->filter.exclude[i] == type;
+      }
+      if(!mentioned || cachedPtr->dirty)
+      {
+         continue;
+      }
+      
+      match = cachedPtr->filter.includeCount > 0 &&
+              CompSystem_QueryMatchActor(&cachedPtr->filter, actor, indices, 1);
+      position = slot < cachedPtr->positionSize ? cachedPtr->positionArray[slot] - 1 : -1;
+      if(match && position < 0)
+      {
+         CompSystem_QueryJoin(sys, cachedPtr, actor, indices);
+      }
+      else if(match)
+      {
+         memcpy(&cachedPtr->tupleArray[position * cachedPtr->filter.includeCount], indices,
+                sizeof(int) * cachedPtr->filter.includeCount);
+      }
+      else if(position >= 0)
+      {
+         CompSystem_QueryDrop(cachedPtr, position);
+      }
+   }
+}
+
+static void CompSystem_LeaveQueries(CompSystem_T sys, actorid_t actor)
+{
+   CachedQuery_T * cachedPtr;
+   int query, slot;
+   
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   for(query = 0; query < sys->cachedInfo.eleCount; query++)
+   {
+      cachedPtr = &sys->cachedArray[query];
+      if(slot < cachedPtr->positionSize && cachedPtr->positionArray[slot] > 0)
+      {
+         CompSystem_QueryDrop(cachedPtr, cachedPtr->positionArray[slot] - 1);
+      }
+   }
+}
+
+static void CompSystem_QueryMoved(CompSystem_T sys, actorid_t actor)
+{
+   CachedQuery_T * cachedPtr;
+   int query, k, slot, position;
+   
+   // One of the actor's components moved, its membership did not change
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   for(query = 0; query < sys->cachedInfo.eleCount; query++)
+   {
+      cachedPtr = &sys->cachedArray[query];
+      if(slot >= cachedPtr->positionSize || cachedPtr->positionArray[slot] == 0)
+      {
+         continue;
+      }
+      position = cachedPtr->positionArray[slot] - 1;
+      for(k = 0; k < cachedPtr->filter.includeCount; k++)
+      {
+         cachedPtr->tupleArray[position * cachedPtr->filter.includeCount + k] = 
+            INDEX_ENTRY(sys, cachedPtr->filter.include[k], actor);
+      }
+   }
+}
+
+static void CompSystem_QueryJoin(CompSystem_T sys, CachedQuery_T * cachedPtr, 
+                                 actorid_t actor, const int * indices)
+{
+   int stride, oldSize, slot;
+   
+   stride = cachedPtr->filter.includeCount;
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   if(cachedPtr->memberInfo.eleCount >= cachedPtr->memberInfo.arySize)
+   {
+      oldSize = cachedPtr->memberInfo.arySize;
+      cachedPtr->memberInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&cachedPtr->memberArray,
+                                                               sizeof(actorid_t), oldSize,
+                                                               cachedPtr->memberInfo.eleCount + 1);
+      (void)CompSystem_SetArraySize(sys, (void**)&cachedPtr->tupleArray, sizeof(int) * stride, 
+                                    DEFAULT_ALIGNMENT, oldSize, cachedPtr->memberInfo.arySize);
+   }
+   if(slot >= cachedPtr->positionSize)
+   {
+      cachedPtr->positionSize = CompSystem_SetArraySize(sys, (void**)&cachedPtr->positionArray,
+                                                        sizeof(int), DEFAULT_ALIGNMENT,
+                                                        cachedPtr->positionSize,
+                                                        sys->slotInfo.arySize);
+   }
+   
+   cachedPtr->memberArray[cachedPtr->memberInfo.eleCount] = actor;
+   memcpy(&cachedPtr->tupleArray[cachedPtr->memberInfo.eleCount * stride], indices, 
+          sizeof(int) * stride);
+   cachedPtr->memberInfo.eleCount ++;
+   cachedPtr->positionArray[slot] = cachedPtr->memberInfo.eleCount;
+}
+
+static void CompSystem_QueryDrop(CachedQuery_T * cachedPtr, int position)
+{
+   actorid_t actorLast;
+   int stride, last;
+   
+   // Swap with the last member, the order of the list does not matter
+   stride = cachedPtr->filter.includeCount;
+   last = cachedPtr->memberInfo.eleCount - 1;
+   actorLast = cachedPtr->memberArray[last];
+   cachedPtr->positionArray[COMPSYSTEM_ACTOR_INDEX(cachedPtr->memberArray[position])] = 0;
+   if(position != last)
+   {
+      cachedPtr->memberArray[position] = actorLast;
+      memcpy(&cachedPtr->tupleArray[position * stride], &cachedPtr->tupleArray[last * stride],
+             sizeof(int) * stride);
+      cachedPtr->positionArray[COMPSYSTEM_ACTOR_INDEX(actorLast)] = position + 1;
+   }
+   cachedPtr->memberInfo.eleCount --;
+}
+
+static void CompSystem_RebuildQuery(CompSystem_T sys, CachedQuery_T * cachedPtr)
+{
+   int indices[COMPSYSTEM_QUERY_MAX_TYPES];
+   int i;
+   
+   cachedPtr->memberInfo.eleCount = 0;
+   if(cachedPtr->positionArray != NULL)
+   {
+      memset(cachedPtr->positionArray, 0, sizeof(int) * cachedPtr->positionSize);
+   }
+   for(i = 0; i < cachedPtr->filter.includeCount; i++)
+   {
+      cachedPtr->layout[i] = sys->typeArray[cachedPtr->filter.include[i]].layout;
+   }
+   
+   for(i = 0; i < sys->actorInfo.eleCount && cachedPtr->filter.includeCount > 0; i++)
+   {
+      if(CompSystem_QueryMatchActor(&cachedPtr->filter, sys->actorArray[i].id, indices, 1))
+      {
+         CompSystem_QueryJoin(sys, cachedPtr, sys->actorArray[i].id, indices);
+      }
+   }
+   cachedPtr->dirty = 0;
+}
+
+static void CompSystem_DirtyQueries(CompSystem_T sys)
+{
+   int query;
+   
+   for(query = 0; query < sys->cachedInfo.eleCount; query++)
+   {
+      sys->cachedArray[query].dirty = 1;
+   }
+}
+
+static int CompSystem_SpatialCell(float value, float invCellSize)
+{
+   float scaled;
+   int cell;
+   
+   // Round toward negative infinity, far away positions share the edge cells
+   scaled = MAX(MIN(value * invCellSize, SPATIAL_MAX_CELL), -SPATIAL_MAX_CELL);
+   cell = (int)scaled;
+   if((float)cell > scaled)
+   {
+      cell --;
+   }
+   return cell;
+}
+
+static int CompSystem_SpatialBucket(const Spatial_T * spatial, const int * cell)
+{
+   unsigned int hash;
+   
+   hash = (unsigned int)cell[0] * 73856093u ^ 
+          (unsigned int)cell[1] * 19349663u ^ 
+          (unsigned int)cell[2] * 83492791u;
+   return (int)(hash & (unsigned int)(spatial->bucketCount - 1));
+}
+
+static void CompSystem_SpatialInsert(CompSystem_T sys, Spatial_T * spatial, actorid_t actor, 
+                                     const byte_t * comp)
+{
+   SpatialEntry_T * entryPtr;
+   float pos[3];
+   int cell[3];
+   int slot, oldSize, d, bucket;
+   
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   if(slot >= spatial->entrySize)
+   {
+      oldSize = spatial->entrySize;
+      spatial->entrySize = CompSystem_SetArraySize(sys, (void**)&spatial->entryArray, 
+                                                   sizeof(SpatialEntry_T), DEFAULT_ALIGNMENT,
+                                                   oldSize, sys->slotInfo.arySize);
+      for(d = oldSize; d < spatial->entrySize; d++)
+      {
+         spatial->entryArray[d].bucket = COMPSYSTEM_INVALID_INDEX;
+      }
+   }
+   
+   pos[2] = 0.0f;
+   cell[2] = 0;
+   memcpy(pos, &comp[spatial->offset], sizeof(float) * spatial->dimensions);
+   for(d = 0; d < spatial->dimensions; d++)
+   {
+      cell[d] = CompSystem_SpatialCell(pos[d], spatial->invCellSize);
+   }
+   
+   // Staying in the same cell only updates the position
+   entryPtr = &spatial->entryArray[slot];
+   if(entryPtr->bucket != COMPSYSTEM_INVALID_INDEX && 
+      memcmp(entryPtr->cell, cell, sizeof(cell)) == 0)
+   {
+      memcpy(entryPtr->pos, pos, sizeof(pos));
+      return;
+   }
+   if(entryPtr->bucket != COMPSYSTEM_INVALID_INDEX)
+   {
+      CompSystem_SpatialUnlink(spatial, slot);
+   }
+   
+   bucket = CompSystem_SpatialBucket(spatial, cell);
+   entryPtr->actor  = actor;
+   entryPtr->bucket = bucket;
+   entryPtr->prev   = COMPSYSTEM_INVALID_INDEX;
+   entryPtr->next   = spatial->bucketArray[bucket];
+   memcpy(entryPtr->cell, cell, sizeof(cell));
+   memcpy(entryPtr->pos, pos, sizeof(pos));
+   if(entryPtr->next != COMPSYSTEM_INVALID_INDEX)
+   {
+      spatial->entryArray[entryPtr->next].prev = slot;
+   }
+   spatial->bucketArray[bucket] = slot;
+   spatial->entryCount ++;
+   
+   if(spatial->entryCount > spatial->bucketCount)
+   {
+      CompSystem_SpatialGrowBuckets(sys, spatial);
+   }
+}
+
+static void CompSystem_SpatialUnlink(Spatial_T * spatial, int slot)
+{
+   SpatialEntry_T * entryPtr;
+   
+   entryPtr = &spatial->entryArray[slot];
+   if(entryPtr->prev != COMPSYSTEM_INVALID_INDEX)
+   {
+      spatial->entryArray[entryPtr->prev].next = entryPtr->next;
+   }
+   else
+   {
+      spatial->bucketArray[entryPtr->bucket] = entryPtr->next;
+   }
+   if(entryPtr->next != COMPSYSTEM_INVALID_INDEX)
+   {
+      spatial->entryArray[entryPtr->next].prev = entryPtr->prev;
+   }
+   entryPtr->bucket = COMPSYSTEM_INVALID_INDEX;
+   spatial->entryCount --;
+}
+
+static void CompSystem_SpatialGrowBuckets(CompSystem_T sys, Spatial_T * spatial)
+{
+   SpatialEntry_T * entryPtr;
+   int i, bucket;
+   
+   CompSystem_Free(sys, spatial->bucketArray, sizeof(int) * spatial->bucketCount);
+   spatial->bucketCount *= 2;
+   spatial->bucketArray = CompSystem_Alloc(sys, sizeof(int) * spatial->bucketCount);
+   for(i = 0; i < spatial->bucketCount; i++)
+   {
+      spatial->bucketArray[i] = COMPSYSTEM_INVALID_INDEX;
+   }
+   
+   // Relink every entry into its bucket of the larger table
+   for(i = 0; i < spatial->entrySize; i++)
+   {
+      entryPtr = &spatial->entryArray[i];
+      if(entryPtr->bucket == COMPSYSTEM_INVALID_INDEX)
+      {
+         continue;
+      }
+      bucket = CompSystem_SpatialBucket(spatial, entryPtr->cell);
+      entryPtr->bucket = bucket;
+      entryPtr->prev   = COMPSYSTEM_INVALID_INDEX;
+      entryPtr->next   = spatial->bucketArray[bucket];
+      if(entryPtr->next != COMPSYSTEM_INVALID_INDEX)
+      {
+         spatial->entryArray[entryPtr->next].prev = i;
+      }
+      spatial->bucketArray[bucket] = i;
+   }
+}
+
+static int CompSystem_SpatialSearch(const Spatial_T * spatial, const float * lower, 
+                                    const float * upper, const float * center, float radius,
+                                    actorid_t * outIds, int maxCount)
+{
+   const SpatialEntry_T * entryPtr;
+   int low[3], high[3], cell[3];
+   double cells;
+   float dist, delta;
+   int d, slot, inside, count, scan;
+   
+   low[2] = high[2] = 0;
+   cells = 1.0;
+   for(d = 0; d < spatial->dimensions; d++)
+   {
+      low[d]  = CompSystem_SpatialCell(lower[d], spatial->invCellSize);
+      high[d] = CompSystem_SpatialCell(upper[d], spatial->invCellSize);
+      cells *= (double)high[d] - low[d] + 1.0;
+   }
+   if(cells <= 0.0)
+   {
+      return 0;
+   }
+   
+   // A box covering more cells than there are actors is cheaper to answer
+   // with one pass over the entries
+   count = 0;
+   scan = cells > (double)spatial->entryCount;
+   cell[0] = low[0];
+   cell[1] = low[1];
+   cell[2] = low[2];
+   slot = scan ? 0 : spatial->bucketArray[CompSystem_SpatialBucket(spatial, cell)];
+   while(count < maxCount)
+   {
+      if(scan && slot >= spatial->entrySize)
+      {
+         break;
+      }
+      if(!scan && slot == COMPSYSTEM_INVALID_INDEX)
+      {
+         // Move on to the next cell of the box
+         for(d = 0; d < 3 && cell[d] == high[d]; d++)
+         {
+            cell[d] = low[d];
+         }
+         if(d == 3)
+         {
+            break;
+         }
+         cell[d] ++;
+         slot = spatial->bucketArray[CompSystem_SpatialBucket(spatial, cell)];
+         continue;
+      }
+      
+      entryPtr = &spatial->entryArray[slot];
+      slot = scan ? slot + 1 : entryPtr->next;
+      
+      // Buckets are shared by every cell that hashes to them
+      inside = scan ? entryPtr->bucket != COMPSYSTEM_INVALID_INDEX : 
+                      memcmp(entryPtr->cell, cell, sizeof(cell)) == 0;
+      dist = 0.0f;
+      for(d = 0; d < spatial->dimensions && inside; d++)
+      {
+         inside = entryPtr->pos[d] >= lower[d] && entryPtr->pos[d] <= upper[d];
+         if(center != NULL)
+         {
+            delta = entryPtr->pos[d] - center[d];
+            dist += delta * delta;
+         }
+      }
+      if(inside && (center == NULL || dist <= radius * radius))
+      {
+         outIds[count] = entryPtr->actor;
+         count ++;
+      }
+   }
+   return count;
+}
+
+static void CompSystem_LeaveSpatial(CompSystem_T sys, actorid_t actor)
+{
+   Spatial_T * spatial;
+   int type, slot;
+   
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   for(type = 0; type < sys->typeInfo.eleCount && sys->spatialCount > 0; type++)
+   {
+      spatial = sys->typeArray[type].spatial;
+      if(spatial != NULL && slot < spatial->entrySize && 
+         spatial->entryArray[slot].bucket != COMPSYSTEM_INVALID_INDEX)
+      {
+         CompSystem_SpatialUnlink(spatial, slot);
+      }
+   }
+}
+
+static void CompSystem_ResetSpatial(CompSystem_T sys)
+{
+   Spatial_T * spatial;
+   int type, i;
+   
+   // Emptied until the next UpdateSpatial indexes the whole pool again
+   for(type = 0; type < sys->typeInfo.eleCount && sys->spatialCount > 0; type++)
+   {
+      spatial = sys->typeArray[type].spatial;
+      if(spatial == NULL)
+      {
+         continue;
+      }
+      for(i = 0; i < spatial->bucketCount; i++)
+      {
+         spatial->bucketArray[i] = COMPSYSTEM_INVALID_INDEX;
+      }
+      for(i = 0; i < spatial->entrySize; i++)
+      {
+         spatial->entryArray[i].bucket = COMPSYSTEM_INVALID_INDEX;
+      }
+      spatial->entryCount = 0;
+      spatial->rebuild = 1;
+   }
+}
+
+static unsigned int CompSystem_KeyHash(const byte_t * key, int size)
+{
+   unsigned int hash;
+   int i;
+   
+   // FNV-1a
+   hash = 2166136261u;
+   for(i = 0; i < size; i++)
+   {
+      hash = (hash ^ key[i]) * 16777619u;
+   }
+   return hash;
+}
+
+static KeySlot_T * CompSystem_KeySlot(CompSystem_T sys, KeyIndex_T * keyIndexPtr, actorid_t actor)
+{
+   int slot;
+   
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   if(slot >= keyIndexPtr->slotSize)
+   {
+      keyIndexPtr->slotSize = CompSystem_SetArraySize(sys, (void**)&keyIndexPtr->slotArray, 
+                                                      sizeof(KeySlot_T), DEFAULT_ALIGNMENT,
+                                                      keyIndexPtr->slotSize, 
+                                                      sys->slotInfo.arySize);
+   }
+   return &keyIndexPtr->slotArray[slot];
+}
+
+static void CompSystem_KeyIndexMark(CompSystem_T sys, comptypeid_t type, actorid_t actor)
+{
+   KeyIndex_T * keyIndexPtr;
+   KeySlot_T * slotPtr;
+   int index;
+   
+   // The key is hashed on the next lookup, once the caller has written it.
+   // An invalid type marks every index the actor has a component of.
+   for(index = 0; index < sys->keyIndexInfo.eleCount; index++)
+   {
+      keyIndexPtr = &sys->keyIndexArray[index];
+      if(keyIndexPtr->rebuild || 
+         ((int)type != COMPSYSTEM_INVALID_INDEX && keyIndexPtr->type != type) ||
+         INDEX_ENTRY(sys, keyIndexPtr->type, actor) == COMPSYSTEM_INVALID_INDEX)
+      {
+         continue;
+      }
+      
+      slotPtr = CompSystem_KeySlot(sys, keyIndexPtr, actor);
+      if(!slotPtr->pending)
+      {
+         slotPtr->pending = 1;
+         if(keyIndexPtr->pendingInfo.eleCount >= keyIndexPtr->pendingInfo.arySize)
+         {
+            keyIndexPtr->pendingInfo.arySize = CompSystem_GrowArraySize(sys, 
+                                                  (void**)&keyIndexPtr->pendingArray,
+                                                  sizeof(actorid_t),
+                                                  keyIndexPtr->pendingInfo.arySize,
+                                                  keyIndexPtr->pendingInfo.eleCount + 1);
+         }
+         keyIndexPtr->pendingArray[keyIndexPtr->pendingInfo.eleCount] = actor;
+         keyIndexPtr->pendingInfo.eleCount ++;
+      }
+   }
+}
+
+static void CompSystem_KeyIndexRemove(CompSystem_T sys, comptypeid_t type, actorid_t actor)
+{
+   KeyIndex_T * keyIndexPtr;
+   int index, slot;
+   
+   // An invalid type removes the actor from every index
+   slot = (int)COMPSYSTEM_ACTOR_INDEX(actor);
+   for(index = 0; index < sys->keyIndexInfo.eleCount; index++)
+   {
+      keyIndexPtr = &sys->keyIndexArray[index];
+      if(slot >= keyIndexPtr->slotSize ||
+         ((int)type != COMPSYSTEM_INVALID_INDEX && keyIndexPtr->type != type))
+      {
+         continue;
+      }
+      CompSystem_KeyIndexUnlink(keyIndexPtr, &keyIndexPtr->slotArray[slot]);
+      keyIndexPtr->slotArray[slot].pending = 0;
+   }
+}
+
+static void CompSystem_KeyIndexUnlink(KeyIndex_T * keyIndexPtr, KeySlot_T * slotPtr)
+{
+   if(slotPtr->entry > 0)
+   {
+      keyIndexPtr->entryArray[slotPtr->entry - 1].state = eKey_Deleted;
+      keyIndexPtr->liveCount --;
+      slotPtr->entry = 0;
+   }
+}
+
+static void CompSystem_KeyIndexInsert(CompSystem_T sys, KeyIndex_T * keyIndexPtr, actorid_t actor)
+{
+   CompType_T * compTypePtr;
+   KeyEntry_T * entryPtr;
+   byte_t * comp;
+   unsigned int hash, mask, position;
+   
+   // Deleted entries count as used, a table full of them is rebuilt at the same size
+   if((keyIndexPtr->usedCount + 1) * 2 > keyIndexPtr->entrySize)
+   {
+      CompSystem_KeyIndexResize(sys, keyIndexPtr, (keyIndexPtr->liveCount + 1) * 4 > 
+                                                  keyIndexPtr->entrySize ? 
+                                                  keyIndexPtr->entrySize * 2 : 
+                                                  keyIndexPtr->entrySize);
+   }
+   
+   compTypePtr = &sys->typeArray[keyIndexPtr->type];
+   comp = CompSystem_ElementPtr(compTypePtr, INDEX_ENTRY(sys, keyIndexPtr->type, actor));
+   hash = CompSystem_KeyHash(&comp[keyIndexPtr->keyOffset], keyIndexPtr->keySize);
+   mask = (unsigned int)keyIndexPtr->entrySize - 1;
+   position = hash & mask;
+   while(keyIndexPtr->entryArray[position].state == eKey_Live)
+   {
+      position = (position + 1) & mask;
+   }
+   
+   entryPtr = &keyIndexPtr->entryArray[position];
+   if(entryPtr->state == eKey_Empty)
+   {
+      keyIndexPtr->usedCount ++;
+   }
+   entryPtr->actor = actor;
+   entryPtr->hash  = hash;
+   entryPtr->state = eKey_Live;
+   keyIndexPtr->liveCount ++;
+   CompSystem_KeySlot(sys, keyIndexPtr, actor)->entry = (int)position + 1;
+}
+
+static void CompSystem_KeyIndexResize(CompSystem_T sys, KeyIndex_T * keyIndexPtr, int newSize)
+{
+   KeyEntry_T * oldArray, * entryPtr;
+   unsigned int mask, position;
+   int i, oldSize;
+   
+   oldArray = keyIndexPtr->entryArray;
+   oldSize  = keyIndexPtr->entrySize;
+   keyIndexPtr->entryArray = NULL;
+   keyIndexPtr->entrySize  = CompSystem_SetArraySize(sys, (void**)&keyIndexPtr->entryArray, 
+                                                     sizeof(KeyEntry_T), DEFAULT_ALIGNMENT,
+                                                     0, newSize);
+   keyIndexPtr->usedCount = keyIndexPtr->liveCount;
+   
+   // Stored hashes move the live entries without reading their keys
+   mask = (unsigned int)newSize - 1;
+   for(i = 0; i < oldSize; i++)
+   {
+      if(oldArray[i].state != eKey_Live)
+      {
+         continue;
+      }
+      position = oldArray[i].hash & mask;
+      while(keyIndexPtr->entryArray[position].state == eKey_Live)
+      {
+         position = (position + 1) & mask;
+      }
+      entryPtr = &keyIndexPtr->entryArray[position];
+      (*entryPtr) = oldArray[i];
+      keyIndexPtr->slotArray[COMPSYSTEM_ACTOR_INDEX(entryPtr->actor)].entry = (int)position + 1;
+   }
+   CompSystem_Free(sys, oldArray, sizeof(KeyEntry_T) * oldSize);
+}
+
+static void CompSystem_KeyIndexRefresh(CompSystem_T sys, KeyIndex_T * keyIndexPtr)
+{
+   CompType_T * compTypePtr;
+   KeySlot_T * slotPtr;
+   actorid_t actor;
+   int i;
+   
+   compTypePtr = &sys->typeArray[keyIndexPtr->type];
+   if(keyIndexPtr->rebuild)
+   {
+      for(i = 0; i < keyIndexPtr->entrySize; i++)
+      {
+         keyIndexPtr->entryArray[i].state = eKey_Empty;
+      }
+      if(keyIndexPtr->slotArray != NULL)
+      {
+         memset(keyIndexPtr->slotArray, 0, sizeof(KeySlot_T) * keyIndexPtr->slotSize);
+      }
+      keyIndexPtr->liveCount = 0;
+      keyIndexPtr->usedCount = 0;
+      keyIndexPtr->pendingInfo.eleCount = 0;
+      keyIndexPtr->rebuild = 0;
+      for(i = 0; i < compTypePtr->compInfo.eleCount; i++)
+      {
+         CompSystem_KeyIndexInsert(sys, keyIndexPtr, compTypePtr->actorIdArray[i]);
+      }
+      return;
+   }
+   
+   // Removed actors have had their flag cleared, but a new actor in the same
+   // slot may have set it again and is further down the list
+   for(i = 0; i < keyIndexPtr->pendingInfo.eleCount; i++)
+   {
+      actor = keyIndexPtr->pendingArray[i];
+      slotPtr = &keyIndexPtr->slotArray[COMPSYSTEM_ACTOR_INDEX(actor)];
+      if(!slotPtr->pending || CompSystem_FindActorFromID(sys, actor) == COMPSYSTEM_INVALID_INDEX)
+      {
+         continue;
+      }
+      slotPtr->pending = 0;
+      CompSystem_KeyIndexUnlink(keyIndexPtr, slotPtr);
+      CompSystem_KeyIndexInsert(sys, keyIndexPtr, actor);
+   }
+   keyIndexPtr->pendingInfo.eleCount = 0;
+}
+
+static void CompSystem_ResetKeyIndexes(CompSystem_T sys)
+{
+   int index;
+   
+   for(index = 0; index < sys->keyIndexInfo.eleCount; index++)
+   {
+      sys->keyIndexArray[index].rebuild = 1;
+   }
+}
+
+static int CompSystem_MaskMatches(const CompSystem_TypeMask_T * signature,
+                                  const CompSystem_TypeMask_T * include,
+                                  const CompSystem_TypeMask_T * exclude)
+{
+   unsigned int miss;
+   int word;
+   
+   word = 0;
+#ifdef COMPSYSTEM_SSE2
+   {
+      __m128i sig, inc, exc, bad, zero;
+      zero = _mm_setzero_si128();
+      for(; word + 4 <= COMPSYSTEM_MASK_WORDS; word += 4)
+      {
+         // A word group fails if an include bit is missing or an exclude bit is set
+         sig = _mm_loadu_si128((const __m128i *)&signature->bits[word]);
+         inc = _mm_loadu_si128((const __m128i *)&include->bits[word]);
+         bad = _mm_andnot_si128(sig, inc);
+         if(exclude != NULL)
+         {
+            exc = _mm_loadu_si128((const __m128i *)&exclude->bits[word]);
+            bad = _mm_or_si128(bad, _mm_and_si128(sig, exc));
+         }
+         if(_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xFFFF)
+         {
+            return 0;
+         }
+      }
+   }
+#endif
+   for(; word < COMPSYSTEM_MASK_WORDS; word++)
+   {
+      miss = include->bits[word] & ~signature->bits[word];
+      if(exclude != NULL)
+      {
+         miss |= exclude->bits[word] & signature->bits[word];
+      }
+      if(miss != 0)
+      {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+static void CompSystem_MovePoolElements(CompSystem_T sys, comptypeid_t type, 
+                                        int from, int to, int count)
+{
+   CompType_T * compTypePtr;
+   actorid_t owner;
+   int i;
+   
+   // Callers never pass overlapping ranges
+   compTypePtr = &sys->typeArray[type];
+   compTypePtr->layout ++;
+   CompSystem_CopyElements(compTypePtr, to, from, count);
+   for(i = 0; i < count; i++)
+   {
+      owner = compTypePtr->actorIdArray[from + i];
+      compTypePtr->actorIdArray[to + i] = owner;
+      INDEX_ENTRY(sys, type, owner) = to + i;
+   }
+}
+
+static void CompSystem_SwapPoolElements(CompSystem_T sys, comptypeid_t type, int a, int b)
+{
+   CompType_T * compTypePtr;
+   actorid_t ownerA, ownerB;
+   
+   compTypePtr = &sys->typeArray[type];
+   ownerA = compTypePtr->actorIdArray[a];
+   ownerB = compTypePtr->actorIdArray[b];
+   CompSystem_Journal(sys, eJournal_Component, type, a);
+   CompSystem_Journal(sys, eJournal_Component, type, b);
+   CompSystem_Journal(sys, eJournal_ActorId, type, a);
+   CompSystem_Journal(sys, eJournal_ActorId, type, b);
+   CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(ownerA));
+   CompSystem_Journal(sys, eJournal_IndexEntry, type, COMPSYSTEM_ACTOR_INDEX(ownerB));
+   
+   CompSystem_ReadElement(compTypePtr, a, sys->scratch);
+   CompSystem_ReadVersions(compTypePtr, a, sys->scratch);
+   CompSystem_CopyElements(compTypePtr, a, b, 1);
+   CompSystem_WriteElement(compTypePtr, b, sys->scratch);
+   CompSystem_WriteVersions(compTypePtr, b, sys->scratch);
+   
+   compTypePtr->actorIdArray[a] = ownerB;
+   compTypePtr->actorIdArray[b] = ownerA;
+   INDEX_ENTRY(sys, type, ownerA) = b;
+   INDEX_ENTRY(sys, type, ownerB) = a;
+   compTypePtr->layout ++;
+}
+
+static int CompSystem_FindArchetype(CompSystem_T sys, const CompSystem_TypeMask_T * mask)
+{
+   Archetype_T * archPtr;
+   int arch, type;
+   
+   for(arch = 0; arch < sys->archInfo.eleCount; arch++)
+   {
+      if(memcmp(&sys->archArray[arch].mask, mask, sizeof(CompSystem_TypeMask_T)) == 0)
+      {
+         return arch;
+      }
+   }
+   
+   if(sys->archInfo.eleCount >= sys->archInfo.arySize)
+   {
+      sys->archInfo.arySize = CompSystem_GrowArraySize(sys, (void**)&sys->archArray,
+                                                       sizeof(Archetype_T),
+                                                       sys->archInfo.arySize,
+                                                       sys->archInfo.eleCount + 1);
+   }
+   arch = sys->archInfo.eleCount;
+   sys->archInfo.eleCount ++;
+   
+   // New archetypes sort last, so their segments start at the end of each pool
+   archPtr = &sys->archArray[arch];
+   archPtr->mask    = (*mask);
+   archPtr->count   = 0;
+   archPtr->aligned = 1;
+   for(type = 0; type < COMPSYSTEM_MASK_TYPES; type++)
+   {
+      archPtr->start[type]   = 0;
+      archPtr->addEdge[type] = COMPSYSTEM_INVALID_INDEX;
+      archPtr->removeEdge[type] = COMPSYSTEM_INVALID_INDEX;
+      if(type < sys->typeInfo.eleCount && COMPSYSTEM_MASK_HAS(*mask, type))
+      {
+         archPtr->start[type] = sys->typeArray[type].compInfo.eleCount;
+      }
+   }
+   return arch;
+}
+
+static int CompSystem_NextArchetypeWithType(CompSystem_T sys, comptypeid_t type, int after)
+{
+   int arch;
+   for(arch = after + 1; arch < sys->archInfo.eleCount; arch++)
+   {
+      if(COMPSYSTEM_MASK_HAS(sys->archArray[arch].mask, type))
+      {
+         return arch;
+      }
+   }
+   return COMPSYSTEM_INVALID_INDEX;
+}
+
+static int CompSystem_SegmentEnd(CompSystem_T sys, comptypeid_t type, int arch)
+{
+   int next;
+   next = CompSystem_NextArchetypeWithType(sys, type, arch);
+   if(next == COMPSYSTEM_INVALID_INDEX)
+   {
+      return sys->typeArray[type].compInfo.eleCount;
+   }
+   return sys->archArray[next].start[type];
+}
+
+static int CompSystem_OpenSegmentGap(CompSystem_T sys, comptypeid_t type, int arch, int count)
+{
+   CompType_T * compTypePtr;
+   Archetype_T * archPtr;
+   int other, start, end, moved;
+   
+   compTypePtr = &sys->typeArray[type];
+   CompSystem_GrowComponentArrays(sys, compTypePtr, compTypePtr->compInfo.eleCount + count);
+   
+   // Shift every later segment up by count, last first. Only the elements
+   // that do not overlap their new range have to move.
+   end = compTypePtr->compInfo.eleCount;
+   for(other = sys->archInfo.eleCount - 1; other > arch; other--)
+   {
+      archPtr = &sys->archArray[other];
+      if(!COMPSYSTEM_MASK_HAS(archPtr->mask, type))
+      {
+         continue;
+      }
+      
+      start = archPtr->start[type];
+      moved = MIN(count, end - start);
+      if(moved > 0)
+      {
+         CompSystem_MovePoolElements(sys, type, start, MAX(end, start + count), moved);
+      }
+      if(count < end - start)
+      {
+         // The segment was rotated, so its columns no longer line up
+         archPtr->aligned = 0;
+      }
+      archPtr->start[type] = start + count;
+      end = start;
+   }
+   
+   compTypePtr->compInfo.eleCount += count;
+   return end;
+}
+
+static void CompSystem_CloseSegmentGap(CompSystem_T sys, comptypeid_t type, int arch, int count)
+{
+   CompType_T * compTypePtr;
+   Archetype_T * archPtr;
+   int other, next, start, end, moved;
+   
+   // Shift every later segment down by count over the vacated tail of arch
+   compTypePtr = &sys->typeArray[type];
+   other = CompSystem_NextArchetypeWithType(sys, type, arch);
+   while(other != COMPSYSTEM_INVALID_INDEX)
+   {
+      next = CompSystem_NextArchetypeWithType(sys, type, other);
+      archPtr = &sys->archArray[other];
+      start = archPtr->start[type];
+      end = next == COMPSYSTEM_INVALID_INDEX ? compTypePtr->compInfo.eleCount : 
+                                               sys->archArray[next].start[type];
+      moved = MIN(count, end - start);
+      if(moved > 0)
+      {
+         CompSystem_MovePoolElements(sys, type, MAX(start, end - count), start - count, moved);
+      }
+      if(count < end - start)
+      {
+         archPtr->aligned = 0;
+      }
+      archPtr->start[type] = start - count;
+      other = next;
+   }
+   
+   compTypePtr->compInfo.eleCount -= count;
+}
+
+static void CompSystem_ArchetypeAddComponent(CompSystem_T sys, Actor_T * actorPtr, comptypeid_t type)
+{
+   CompSystem_TypeMask_T mask;
+   CompType_T * compTypePtr;
+   int src, dst, other, compIndex, compIndexLast;
+   
+   src = actorPtr->archetype;
+   dst = sys->archArray[src].addEdge[type];
+   if(dst == COMPSYSTEM_INVALID_INDEX)
+   {
+      mask = sys->archArray[src].mask;
+      COMPSYSTEM_MASK_SET(mask, type);
+      dst = CompSystem_FindArchetype(sys, &mask);
+      sys->archArray[src].addEdge[type] = dst;
+   }
+   
+   // Carry every existing component from the old segment to the new one
+   for(other = 0; other < sys->typeInfo.eleCount && other < COMPSYSTEM_MASK_TYPES; other++)
+   {
+      if(!COMPSYSTEM_MASK_HAS(sys->archArray[src].mask, other))
+      {
+         continue;
+      }
+      
+      compTypePtr = &sys->typeArray[other];
+      compIndex = INDEX_ENTRY(sys, other, actorPtr->id);
+      compIndexLast = CompSystem_SegmentEnd(sys, other, src) - 1;
+      CompSystem_ReadElement(compTypePtr, compIndex, sys->scratch);
+      CompSystem_ReadVersions(compTypePtr, compIndex, sys->scratch);
+      if(compIndex != compIndexLast)
+      {
+         CompSystem_MovePoolElements(sys, other, compIndexLast, compIndex, 1);
+      }
+      CompSystem_CloseSegmentGap(sys, other, src, 1);
+      
+      compIndex = CompSystem_OpenSegmentGap(sys, other, dst, 1);
+      CompSystem_WriteElement(compTypePtr, compIndex, sys->scratch);
+      CompSystem_WriteVersions(compTypePtr, compIndex, sys->scratch);
+      compTypePtr->actorIdArray[compIndex] = actorPtr->id;
+      INDEX_ENTRY(sys, other, actorPtr->id) = compIndex;
+      compTypePtr->layout ++;
+   }
+   
+   compIndex = CompSystem_OpenSegmentGap(sys, type, dst, 1);
+   sys->typeArray[type].actorIdArray[compIndex] = actorPtr->id;
+   INDEX_ENTRY(sys, type, actorPtr->id) = compIndex;
+   
+   sys->archArray[src].count --;
+   sys->archArray[dst].count ++;
+   actorPtr->archetype = dst;
+}
+
+static void CompSystem_ArchetypeRemoveComponents(CompSystem_T sys, Actor_T * actorPtr)
+{
+   int type, arch, compIndex, compIndexLast;
+   
+   arch = actorPtr->archetype;
+   for(type = 0; type < sys->typeInfo.eleCount && type < COMPSYSTEM_MASK_TYPES; type++)
+   {
+      if(!COMPSYSTEM_MASK_HAS(sys->archArray[arch].mask, type))
+      {
+         continue;
+      }
+      
+      compIndex = INDEX_ENTRY(sys, type, actorPtr->id);
+      compIndexLast = CompSystem_SegmentEnd(sys, type, arch) - 1;
+      CompSystem_DestroyComponents(sys, type, compIndex, 1);
+      
+      // Swap-remove inside the segment, then close the hole it leaves
+      if(compIndex != compIndexLast)
+      {
+         CompSystem_MovePoolElements(sys, type, compIndexLast, compIndex, 1);
+      }
+      CompSystem_CloseSegmentGap(sys, type, arch, 1);
+      INDEX_ENTRY(sys, type, actorPtr->id) = COMPSYSTEM_INVALID_INDEX;
+   }
+   sys->archArray[arch].count --;
+   actorPtr->archetype = 0;
+}
+
+static void CompSystem_ArchetypeRemoveComponent(CompSystem_T sys, Actor_T * actorPtr, comptypeid_t type)
+{
+   CompSystem_TypeMask_T mask;
    CompType_T * compTypePtr;
-   compTypePtr = &sys->typeArray[type];
-   if(array != NULL)
+   int src, dst, other, compIndex, compIndexLast;
+   
+   src = actorPtr->archetype;
+   dst = sys->archArray[src].removeEdge[type];
+   if(dst == COMPSYSTEM_INVALID_INDEX)
    {
-      (*array) = compTypePtr->compArray;
+      mask = sys->archArray[src].mask;
+      COMPSYSTEM_MASK_CLEAR(mask, type);
+      dst = CompSystem_FindArchetype(sys, &mask);
+      sys->archArray[src].removeEdge[type] = dst;
    }
    
-   if(size != NULL)
+   // Every component leaves the old segment, all but type land in the new one
+   for(other = 0; other < sys->typeInfo.eleCount && other < COMPSYSTEM_MASK_TYPES; other++)
    {
-      (*size) = compTypePtr->compInfo.eleCount;
+      if(!COMPSYSTEM_MASK_HAS(sys->archArray[src].mask, other))
+      {
+         continue;
+      }
+      
+      compTypePtr = &sys->typeArray[other];
+      compIndex = INDEX_ENTRY(sys, other, actorPtr->id);
+      compIndexLast = CompSystem_SegmentEnd(sys, other, src) - 1;
+      if(other == (int)type)
+      {
+         CompSystem_DestroyComponents(sys, other, compIndex, 1);
+      }
+      else
+      {
+         CompSystem_ReadElement(compTypePtr, compIndex, sys->scratch);
+         CompSystem_ReadVersions(compTypePtr, compIndex, sys->scratch);
+      }
+      if(compIndex != compIndexLast)
+      {
+         CompSystem_MovePoolElements(sys, other, compIndexLast, compIndex, 1);
+      }
+      CompSystem_CloseSegmentGap(sys, other, src, 1);
+      if(other == (int)type)
+      {
+         INDEX_ENTRY(sys, other, actorPtr->id) = COMPSYSTEM_INVALID_INDEX;
+         continue;
+      }
+      
+      compIndex = CompSystem_OpenSegmentGap(sys, other, dst, 1);
+      CompSystem_WriteElement(compTypePtr, compIndex, sys->scratch);
+      CompSystem_WriteVersions(compTypePtr, compIndex, sys->scratch);
+      compTypePtr->actorIdArray[compIndex] = actorPtr->id;
+      INDEX_ENTRY(sys, other, actorPtr->id) = compIndex;
+      compTypePtr->layout ++;
    }
+   
+   sys->archArray[src].count --;
+   sys->archArray[dst].count ++;
+   actorPtr->archetype = dst;
 }
 
-void CompSystem_GetActorCount(const CompSystem_T sys, int * actorCount)
+static void CompSystem_AlignArchetype(CompSystem_T sys, int arch)
 {
-   (*actorCount) = sys->actorInfo.eleCount;
+   Archetype_T * archPtr;
+   int type;
+   
+   // Reorder every segment to follow the actor order of the first type
+   archPtr = &sys->archArray[arch];
+   for(type = 0; type < sys->typeInfo.eleCount && type < COMPSYSTEM_MASK_TYPES; type++)
+   {
+      if(COMPSYSTEM_MASK_HAS(archPtr->mask, type))
+      {
+         CompSystem_AlignSegments(sys, arch, type);
+         break;
+      }
+   }
+   archPtr->aligned = 1;
 }
 
-void CompSystem_GetActor(const CompSystem_T sys, int index, actorid_t * actor)
+static void CompSystem_AlignSegments(CompSystem_T sys, int arch, comptypeid_t lead)
 {
-   (*actor) = sys->actorArray[index].id;
+   Archetype_T * archPtr;
+   actorid_t * leadActors;
+   int type, i, compIndex;
+   
+   archPtr = &sys->archArray[arch];
+   leadActors = &sys->typeArray[lead].actorIdArray[archPtr->start[lead]];
+   for(type = 0; type < sys->typeInfo.eleCount && type < COMPSYSTEM_MASK_TYPES; type++)
+   {
+      if(type == (int)lead || !COMPSYSTEM_MASK_HAS(archPtr->mask, type))
+      {
+         continue;
+      }
+      
+      for(i = 0; i < archPtr->count; i++)
+      {
+         compIndex = INDEX_ENTRY(sys, type, leadActors[i]);
+         if(compIndex != archPtr->start[type] + i)
+         {
+            CompSystem_SwapPoolElements(sys, type, compIndex, archPtr->start[type] + i);
+         }
+      }
+   }
+   archPtr->aligned = 1;
 }
 
-
-void CompSystem_Destroy(CompSystem_T sys)
+static void CompSystem_SortRange(CompSystem_T sys, comptypeid_t type, int first, int count,
+                                 CompSystem_CompareFunc_T compareFunc, void * userData)
 {
-   int i, j;
    CompType_T * compTypePtr;
-   Actor_T * actorPtr;
-   byte_t * comp;
+   actorid_t * sorted;
+   int * order, * temp, * swap;
+   int width, left, mid, right, i, a, b, compIndex;
    
+   if(count < 2)
+   {
+      return;
+   }
    
-   // Clean Components
-   for(i = 0; i < sys->typeInfo.eleCount; i++)
+   // Stable bottom up merge sort of the pool indices
+   compTypePtr = &sys->typeArray[type];
+   order = CompSystem_Alloc(sys, sizeof(int) * count);
+   temp  = CompSystem_Alloc(sys, sizeof(int) * count);
+   for(i = 0; i < count; i++)
    {
-      compTypePtr = &sys->typeArray[i];
-      
-      if(compTypePtr->compArray != NULL)
+      order[i] = first + i;
+   }
+   for(width = 1; width < count; width *= 2)
+   {
+      for(left = 0; left < count; left += 2 * width)
+      {
+         mid   = MIN(left + width, count);
+         right = MIN(left + 2 * width, count);
+         a = left;
+         b = mid;
+         for(i = left; i < right; i++)
+         {
+            if(a < mid && (b >= right || 
+               compareFunc(CompSystem_ElementPtr(compTypePtr, order[a]),
+                           CompSystem_ElementPtr(compTypePtr, order[b]), userData) <= 0))
+            {
+               temp[i] = order[a++];
+            }
+            else
+            {
+               temp[i] = order[b++];
+            }
+         }
+      }
+      swap  = order;
+      order = temp;
+      temp  = swap;
+   }
+   
+   // Swap each actor into place, the index table follows every swap
+   sorted = CompSystem_Alloc(sys, sizeof(actorid_t) * count);
+   for(i = 0; i < count; i++)
+   {
+      sorted[i] = compTypePtr->actorIdArray[order[i]];
+   }
+   for(i = 0; i < count; i++)
+   {
+      compIndex = INDEX_ENTRY(sys, type, sorted[i]);
+      if(compIndex != first + i)
+      {
+         CompSystem_SwapPoolElements(sys, type, compIndex, first + i);
+      }
+   }
+   
+   CompSystem_Free(sys, sorted, sizeof(actorid_t) * count);
+   CompSystem_Free(sys, order, sizeof(int) * count);
+   CompSystem_Free(sys, temp, sizeof(int) * count);
+}
+
+static int CompSystem_GroupHas(const CompSystem_T sys, int group, actorid_t actor)
+{
+   const Group_T * groupPtr;
+   int index;
+   
+   groupPtr = &sys->groupArray[group];
+   index = INDEX_ENTRY(sys, groupPtr->typeList[0], actor);
+   return index != COMPSYSTEM_INVALID_INDEX && index < groupPtr->size;
+}
+
+static void CompSystem_GroupEnter(CompSystem_T sys, int group, actorid_t actor)
+{
+   Group_T * groupPtr;
+   int i, index;
+   
+   groupPtr = &sys->groupArray[group];
+   if(CompSystem_GroupHas(sys, group, actor))
+   {
+      return;
+   }
+   for(i = 0; i < groupPtr->typeCount; i++)
+   {
+      if(INDEX_ENTRY(sys, groupPtr->typeList[i], actor) == COMPSYSTEM_INVALID_INDEX)
+      {
+         return;
+      }
+   }
+   
+   // Swap the actor's components to just past the end of the group
+   for(i = 0; i < groupPtr->typeCount; i++)
+   {
+      index = INDEX_ENTRY(sys, groupPtr->typeList[i], actor);
+      if(index != groupPtr->size)
+      {
+         CompSystem_SwapPoolElements(sys, groupPtr->typeList[i], index, groupPtr->size);
+      }
+   }
+   CompSystem_Journal(sys, eJournal_GroupSize, 0, group);
+   groupPtr->size ++;
+}
+
+static void CompSystem_GroupLeave(CompSystem_T sys, int group, actorid_t actor)
+{
+   Group_T * groupPtr;
+   int i, index;
+   
+   groupPtr = &sys->groupArray[group];
+   if(!CompSystem_GroupHas(sys, group, actor))
+   {
+      return;
+   }
+   
+   // The last member takes the actor's place in every pool
+   CompSystem_Journal(sys, eJournal_GroupSize, 0, group);
+   groupPtr->size --;
+   for(i = 0; i < groupPtr->typeCount; i++)
+   {
+      index = INDEX_ENTRY(sys, groupPtr->typeList[i], actor);
+      if(index != groupPtr->size)
+      {
+         CompSystem_SwapPoolElements(sys, groupPtr->typeList[i], index, groupPtr->size);
+      }
+   }
+}
+
+static void CompSystem_GroupAlign(CompSystem_T sys, int group, comptypeid_t lead)
+{
+   Group_T * groupPtr;
+   actorid_t * leadActors;
+   comptypeid_t type;
+   int i, k, index;
+   
+   groupPtr = &sys->groupArray[group];
+   leadActors = sys->typeArray[lead].actorIdArray;
+   for(k = 0; k < groupPtr->typeCount; k++)
+   {
+      type = groupPtr->typeList[k];
+      for(i = 0; i < groupPtr->size && type != lead; i++)
       {
-         comp = compTypePtr->compArray;
-         for(j = 0; j < compTypePtr->compInfo.eleCount; j++)
+         index = INDEX_ENTRY(sys, type, leadActors[i]);
+         if(index != i)
          {
-            CompSystem_DestroyComponent(sys, i,
-                                        compTypePtr->actorPtrArray[j]->id,
-                                        compTypePtr->destroyFunc,
-                                        comp);
-            comp += compTypePtr->elementSize;
-                                           
+            CompSystem_SwapPoolElements(sys, type, index, i);
          }
+      }
+   }
+}
+
+static void CompSystem_BuildGroup(CompSystem_T sys, int group)
+{
+   Group_T * groupPtr;
+   CompType_T * compTypePtr;
+   int i;
+   
+   // Whatever a member swaps out of the front was already found wanting
+   groupPtr = &sys->groupArray[group];
+   compTypePtr = &sys->typeArray[groupPtr->typeList[0]];
+   CompSystem_Journal(sys, eJournal_GroupSize, 0, group);
+   groupPtr->size = 0;
+   for(i = 0; i < compTypePtr->compInfo.eleCount; i++)
+   {
+      CompSystem_GroupEnter(sys, group, compTypePtr->actorIdArray[i]);
+   }
+}
+
+static size_t CompSystem_PoolBytes(const CompType_T * compTypePtr, int count)
+{
+   size_t bytes;
+   
+   bytes = (size_t)compTypePtr->elementSize + sizeof(actorid_t);
+   if(compTypePtr->tracked)
+   {
+      bytes += VERSION_BYTES;
+   }
+   return bytes * count;
+}
+
+#ifdef COMPSYSTEM_STATS
+static unsigned long long CompSystem_TraceClock(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER counter, frequency;
+   QueryPerformanceCounter(&counter);
+   QueryPerformanceFrequency(&frequency);
+   return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+          (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ull / 
+          (unsigned long long)frequency.QuadPart;
+#else
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+#endif
+}
+
+static void CompSystem_TraceEvent(CompSystem_T sys, const char * event, unsigned long long start)
+{
+   if(sys->traceFunc != NULL)
+   {
+      sys->traceFunc(sys, event, CompSystem_TraceClock() - start, sys->traceData);
+   }
+}
+#endif
 
+static ThreadPool_T CompSystem_GetThreadPool(CompSystem_T sys)
+{
+   int threadCount, i;
+   
+   if(sys->threadPool == NULL)
+   {
+      threadCount = sys->threadCount;
+      if(threadCount <= 0)
+      {
+         ThreadPool_GetCoreCount(&threadCount);
+      }
+      sys->threadPool    = ThreadPool_Create(threadCount);
+      ThreadPool_GetThreadCount(sys->threadPool, &threadCount);
+      sys->threadQueries = CompSystem_Alloc(sys, sizeof(CompSystem_Query_T) * threadCount);
       
-         free(compTypePtr->compArray);
-         free(compTypePtr->actorPtrArray);
+      sys->bufferArray = CompSystem_Alloc(sys, sizeof(CompSystem_CommandBuffer_T) * threadCount);
+      for(i = 0; i < threadCount; i++)
+      {
+         sys->bufferArray[i] = CompSystem_Alloc(sys, sizeof(struct compsystem_commandbuffer_s));
+         memset(sys->bufferArray[i], 0, sizeof(struct compsystem_commandbuffer_s));
+         sys->bufferArray[i]->sys = sys;
       }
    }
+   return sys->threadPool;
+}
+
+static void CompSystem_RunParallel(CompSystem_T sys, ThreadPool_TaskFunc_T func, 
+                                   void * userData, int taskCount)
+{
+   ThreadPool_T pool;
+   int threadIndex, i;
    
-   // Clean Actors
-   for(i = 0; i < sys->actorInfo.eleCount; i++)
+   pool = CompSystem_GetThreadPool(sys);
+   if(sys->parallel)
    {
-      actorPtr = &sys->actorArray[i];
-      free(actorPtr->compIndexArray);
+      // Called from a system sharing its wave, the pool is already running.
+      // The tasks run here, on the worker slot of the calling thread.
+      ThreadPool_GetWorkerIndex(pool, &threadIndex);
+      for(i = 0; i < taskCount; i++)
+      {
+         func(userData, i, threadIndex);
+      }
+      return;
    }
+   sys->parallel = 1;
+   ThreadPool_Run(pool, func, userData, taskCount);
+   sys->parallel = 0;
+}
 
+static void CompSystem_StopThreads(CompSystem_T sys)
+{
+   CompSystem_CommandBuffer_T buffer;
+   int i, threadCount;
+   
+   if(sys->threadPool == NULL)
+   {
+      return;
+   }
    
-   free(sys->typeArray);
-   free(sys->actorArray);
-   free(sys);
+   ThreadPool_GetThreadCount(sys->threadPool, &threadCount);
+   for(i = 0; i < threadCount; i++)
+   {
+      buffer = sys->bufferArray[i];
+      CompSystem_Free(sys, buffer->data, buffer->dataInfo.arySize);
+      CompSystem_Free(sys, buffer->resolvedArray, sizeof(actorid_t) * buffer->resolvedInfo.arySize);
+      CompSystem_Free(sys, buffer, sizeof(struct compsystem_commandbuffer_s));
+   }
+   CompSystem_Free(sys, sys->bufferArray, sizeof(CompSystem_CommandBuffer_T) * threadCount);
+   ThreadPool_Destroy(sys->threadPool);
+   CompSystem_Free(sys, sys->threadQueries, sizeof(CompSystem_Query_T) * threadCount);
+   sys->threadPool    = NULL;
+   sys->threadQueries = NULL;
+   sys->bufferArray   = NULL;
 }
 
+static void CompSystem_RecordCommand(CompSystem_CommandBuffer_T buffer, int op, actorid_t actor,
+                                     comptypeid_t type, const void * comp, int size)
+{
+   Command_T command;
+   int offset, total;
+   
+   // The first record after a flush starts a new batch of pending actors
+   if(buffer->flushed)
+   {
+      buffer->resolvedInfo.eleCount = 0;
+      buffer->flushed = 0;
+   }
+   
+   offset = buffer->dataInfo.eleCount;
+   total = COMMAND_ALIGN(sizeof(Command_T)) + COMMAND_ALIGN(size);
+   if(offset + total > buffer->dataInfo.arySize)
+   {
+      buffer->dataInfo.arySize = CompSystem_GrowArraySize(buffer->sys, 
+                                                          (void**)&buffer->data, 1,
+                                                          buffer->dataInfo.arySize,
+                                                          offset + total);
+   }
+   
+   command.op    = op;
+   command.actor = actor;
+   command.type  = type;
+   command.size  = size;
+   memcpy(&buffer->data[offset], &command, sizeof(Command_T));
+   if(size > 0)
+   {
+      memcpy(&buffer->data[offset + COMMAND_ALIGN(sizeof(Command_T))], comp, size);
+   }
+   buffer->dataInfo.eleCount = offset + total;
+}
 
-static int CompSystem_GrowArraySize(void ** array, int elementSize, int size, int delta)
+static actorid_t CompSystem_ResolvePending(CompSystem_CommandBuffer_T buffer, actorid_t actor)
 {
-   return CompSystem_SetArraySize(array, elementSize, size, size + delta);
+   actorid_t pending;
+   
+   if(!COMPSYSTEM_ACTOR_IS_PENDING(actor))
+   {
+      return actor;
+   }
+   
+   pending = COMPSYSTEM_ACTOR_INDEX(actor);
+   if(pending >= (actorid_t)buffer->resolvedInfo.eleCount)
+   {
+      return COMPSYSTEM_INVALID_ACTOR;
+   }
+   return buffer->resolvedArray[pending];
 }
 
-static int CompSystem_SetArraySize(void ** array, int elementSize, int size, int newSize)
+static void CompSystem_ParallelForTask(void * userData, int taskIndex, int threadIndex)
 {
-   int minSize;
-   void * temp;
-   temp = calloc(newSize, elementSize);
-   minSize = MIN(size, newSize);
-   memcpy(temp, (*array), minSize * elementSize);
-   free(*array);
-   (*array) = temp;
-   return newSize;
+   ParallelJob_T * job;
+   int begin, count;
+   
+   job = userData;
+   begin = taskIndex * job->grainSize;
+   count = MIN(job->grainSize, job->count - begin);
+   job->kernel(CompSystem_ElementPtr(job->compTypePtr, begin), 
+               count, begin, threadIndex, job->userData);
 }
 
+static void CompSystem_ParallelQueryTask(void * userData, int taskIndex, int threadIndex)
+{
+   ParallelJob_T * job;
+   CompSystem_Query_T * query;
+   int i, count;
+   
+   job = userData;
+   query = &job->sys->threadQueries[threadIndex];
+   
+   // The thread owning the template only resets the cursor
+   if(query != job->query)
+   {
+      query->sys          = job->query->sys;
+      query->includeCount = job->query->includeCount;
+      query->excludeCount = job->query->excludeCount;
+      query->driver       = job->query->driver;
+      query->tagged       = job->query->tagged;
+      query->tagInclude   = job->query->tagInclude;
+      query->tagExclude   = job->query->tagExclude;
+      query->chunkActor   = NULL;
+      for(i = 0; i < query->includeCount; i++)
+      {
+         query->include[i] = job->query->include[i];
+         query->base[i]    = job->query->base[i];
+      }
+      for(i = 0; i < query->excludeCount; i++)
+      {
+         query->exclude[i] = job->query->exclude[i];
+      }
+   }
+   query->position = taskIndex * job->grainSize;
+   query->limit    = MIN(query->position + job->grainSize, job->count);
+   
+   CompSystem_QueryNext(query, &count);
+   while(count > 0)
+   {
+      job->queryKernel(query, threadIndex, job->userData);
+      CompSystem_QueryNext(query, &count);
+   }
+}
 
-static int CompSystem_FindActorFromID(CompSystem_T sys, actorid_t actor)
-{   
-   int i, outIndex;
+static int CompSystem_SystemsConflict(const System_T * a, const System_T * b)
+{
+   int i;
    
-   outIndex = COMPSYSTEM_INVALID_INDEX;
+   if(a->exclusive || b->exclusive)
+   {
+      return 1;
+   }
    
-   for(i = 0; i < sys->actorInfo.eleCount; i++)
+   // Readers may share a type, a writer needs it to itself
+   for(i = 0; i < COMPSYSTEM_MASK_WORDS; i++)
    {
-      if(sys->actorArray[i].id == actor)
+      if((a->writes.bits[i] & (b->reads.bits[i] | b->writes.bits[i])) != 0 ||
+         (b->writes.bits[i] & a->reads.bits[i]) != 0)
       {
-         outIndex = i;
-         break;
+         return 1;
       }
    }
-   return outIndex;
+   return 0;
 }
 
-static void CompSystem_UpdateAllActorPointers(CompSystem_T sys)
+static void CompSystem_BuildSchedule(CompSystem_T sys)
 {
-   int actorIndex;
-   Actor_T * actorPtr;
+   System_T * systemPtr;
+   int i, j, wave, waveCount, count;
    
-   for(actorIndex = 0; actorIndex < sys->actorInfo.eleCount; actorIndex++)
+   // Every system lands one wave after the last earlier system it conflicts
+   // with, so conflicting systems keep their registration order
+   waveCount = 0;
+   for(i = 0; i < sys->systemInfo.eleCount; i++)
    {
-      actorPtr = &sys->actorArray[actorIndex];
-      CompSystem_UpdateActorPointers(sys, actorPtr);
+      systemPtr = &sys->systemArray[i];
+      systemPtr->wave = 0;
+      for(j = 0; j < i; j++)
+      {
+         if(sys->systemArray[j].wave >= systemPtr->wave &&
+            CompSystem_SystemsConflict(&sys->systemArray[j], systemPtr))
+         {
+            systemPtr->wave = sys->systemArray[j].wave + 1;
+         }
+      }
+      waveCount = MAX(waveCount, systemPtr->wave + 1);
+   }
+   
+   count = 0;
+   for(wave = 0; wave < waveCount; wave++)
+   {
+      for(i = 0; i < sys->systemInfo.eleCount; i++)
+      {
+         if(sys->systemArray[i].wave == wave)
+         {
+            sys->scheduleArray[count] = i;
+            count ++;
+         }
+      }
    }
+   sys->scheduleDirty = 0;
+}
+
+static void CompSystem_SystemTask(void * userData, int taskIndex, int threadIndex)
+{
+   ParallelJob_T * job;
+   System_T * systemPtr;
+   
+   job = userData;
+   systemPtr = &job->sys->systemArray[job->systems[taskIndex]];
+   systemPtr->func(job->sys, threadIndex, systemPtr->userData);
 }
 
-static void CompSystem_UpdateActorPointers(CompSystem_T sys, Actor_T * actorPtr)
+static void CompSystem_ClearPool(CompSystem_T sys, comptypeid_t type)
 {
-   int typeIndex, dataIndex;
    CompType_T * compTypePtr;
-   for(typeIndex = 0; typeIndex < sys->typeInfo.eleCount; typeIndex++)
+   
+   compTypePtr = &sys->typeArray[type];
+   if(POOL_EXISTS(compTypePtr))
+   {
+      CompSystem_DestroyComponents(sys, type, 0, compTypePtr->compInfo.eleCount);
+      CompSystem_FreeComponentArrays(sys, compTypePtr);
+   }
+   compTypePtr->compInfo.arySize  = 0;
+   compTypePtr->compInfo.eleCount = 0;
+}
+
+static void CompSystem_SnapshotLayout(unsigned int * layout)
+{
+   layout[0] = sizeof(Actor_T);
+   layout[1] = sizeof(ActorSlot_T);
+   layout[2] = sizeof(Archetype_T);
+   layout[3] = sizeof(actorid_t);
+   layout[4] = COMPSYSTEM_MASK_TYPES;
+   layout[5] = COMPSYSTEM_ACTOR_INDEX_BITS;
+}
+
+static void CompSystem_SnapshotWrite(FILE * file, long long * offset, const void * data, 
+                                     size_t size)
+{
+   static const byte_t zeros[SNAPSHOT_ALIGNMENT] = { 0 };
+   size_t chunk, left;
+   
+   // No data writes zeros
+   if(data != NULL)
+   {
+      (void)fwrite(data, 1, size, file);
+   }
+   else
    {
-      dataIndex = actorPtr->compIndexArray[typeIndex];
-      if(dataIndex != COMPSYSTEM_INVALID_INDEX)
+      for(left = size; left > 0; left -= chunk)
       {
-         compTypePtr = &sys->typeArray[typeIndex];
-         compTypePtr->actorPtrArray[dataIndex] = actorPtr;
+         chunk = MIN(left, sizeof(zeros));
+         (void)fwrite(zeros, 1, chunk, file);
       }
    }
+   (*offset) += size;
+}
 
+static void CompSystem_SnapshotPad(FILE * file, long long * offset, size_t alignment)
+{
+   CompSystem_SnapshotWrite(file, offset, NULL, 
+                            (size_t)(alignment - (*offset) % alignment) % alignment);
 }
 
-static void CompSystem_MoveMemory(void * dest, void * src, int elementSize)
+static int CompSystem_SnapshotCheck(CompSystem_T sys, const byte_t * base, size_t size)
 {
-   if(dest != src)
+   SnapshotHeader_T header;
+   SnapshotType_T entry;
+   CompType_T * compTypePtr;
+   unsigned int layout[6];
+   long long end;
+   int type, valid;
+   
+   if(size < sizeof(SnapshotHeader_T))
+   {
+      return 0;
+   }
+   memcpy(&header, base, sizeof(SnapshotHeader_T));
+   CompSystem_SnapshotLayout(layout);
+   if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+      memcmp(header.layout, layout, sizeof(layout)) != 0 ||
+      header.storage != (int)sys->storage || header.typeCount != sys->typeInfo.eleCount ||
+      header.typeRows < header.typeCount || header.actorCount < 0 || header.slotCount < 0 ||
+      header.archCount < 0 || 
+      sizeof(SnapshotHeader_T) + sizeof(SnapshotType_T) * (size_t)header.typeCount > size)
    {
-      memcpy(dest, src, elementSize);
-   }   
+      return 0;
+   }
+   
+   valid = header.actorOffset >= 0 && header.slotOffset >= 0 && 
+           header.indexOffset >= 0 && header.archOffset >= 0 &&
+           header.actorOffset + (long long)sizeof(Actor_T) * header.actorCount <= (long long)size &&
+           header.slotOffset + (long long)sizeof(ActorSlot_T) * header.slotCount <= (long long)size &&
+           header.indexOffset + (long long)sizeof(int) * header.typeRows * header.slotCount <= 
+           (long long)size &&
+           header.archOffset + (long long)sizeof(Archetype_T) * header.archCount <= (long long)size;
+   
+   // Types have to be set up the same way as in the system that saved them
+   for(type = 0; type < header.typeCount && valid; type++)
+   {
+      memcpy(&entry, &base[sizeof(SnapshotHeader_T) + sizeof(SnapshotType_T) * type], 
+             sizeof(SnapshotType_T));
+      compTypePtr = &sys->typeArray[type];
+      end = entry.compOffset + (long long)entry.capacity * entry.elementSize;
+      valid = entry.elementSize == compTypePtr->elementSize && 
+              entry.fieldCount == compTypePtr->fieldCount &&
+              entry.count >= 0 && entry.capacity >= entry.count &&
+              entry.compOffset >= 0 && end <= (long long)size &&
+              entry.compOffset % MAX(SNAPSHOT_ALIGNMENT, compTypePtr->alignment) == 0 &&
+              entry.actorIdOffset >= 0 && 
+              entry.actorIdOffset + (long long)sizeof(actorid_t) * entry.capacity <= 
+              (long long)size;
+   }
+   return valid;
 }
 
-static void CompSystem_DestroyComponent(CompSystem_T sys, comptypeid_t type, 
-                                        actorid_t actor, 
-                                        CompSystem_DestroyFunc_T destroyFunc, 
-                                        void * comp)
+static void CompSystem_MapFile(CompSystem_T sys, const char * filename, byte_t ** base, 
+                               size_t * size)
 {
-   if(destroyFunc != NULL)
+#ifdef _WIN32
+   FILE * file;
+   long length;
+   
+   // Without mmap the file is read into one block that stands in for the mapping
+   (*base) = NULL;
+   file = fopen(filename, "rb");
+   if(file == NULL)
+   {
+      return;
+   }
+   if(fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0)
    {
-      destroyFunc(comp, sys, type, actor);
+      (*size) = (size_t)length;
+      (*base) = sys->allocator.allocFunc(sys->allocator.context, (*size), SNAPSHOT_ALIGNMENT);
+      fseek(file, 0, SEEK_SET);
+      if(fread((*base), 1, (*size), file) != (*size))
+      {
+         sys->allocator.freeFunc(sys->allocator.context, (*base), (*size), SNAPSHOT_ALIGNMENT);
+         (*base) = NULL;
+      }
+   }
+   fclose(file);
+#else
+   struct stat info;
+   void * map;
+   int fd;
+   (void)sys;
+   
+   // Private mapping, so pages the world writes to are copied, never the file
+   (*base) = NULL;
+   fd = open(filename, O_RDONLY);
+   if(fd < 0)
+   {
+      return;
+   }
+   if(fstat(fd, &info) == 0 && info.st_size > 0)
+   {
+      map = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if(map != MAP_FAILED)
+      {
+         (*base) = map;
+         (*size) = (size_t)info.st_size;
+      }
    }
+   close(fd);
+#endif
+}
+
+static void CompSystem_UnmapFile(CompSystem_T sys, byte_t * base, size_t size)
+{
+#ifdef _WIN32
+   sys->allocator.freeFunc(sys->allocator.context, base, size, SNAPSHOT_ALIGNMENT);
+#else
+   (void)sys;
+   munmap(base, size);
+#endif
 }
 
+static void CompSystem_ReleaseMapping(CompSystem_T sys)
+{
+   if(sys->mapBase != NULL)
+   {
+      CompSystem_UnmapFile(sys, sys->mapBase, sys->mapSize);
+      sys->mapBase = NULL;
+      sys->mapSize = 0;
+   }
+}
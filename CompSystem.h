@@ -27,27 +27,241 @@
 #ifndef __COMPSYSTEM_H__
 #define __COMPSYSTEM_H__
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define COMPSYSTEM_INVALID_INDEX -1
+#define COMPSYSTEM_INVALID_ACTOR 0xFFFFFFFFu
+
+// Actor IDs are generational handles. The low bits select a slot in the
+// actor lookup table and the high bits count how many times that slot has
+// been reused, so the ID of a removed actor never aliases a newer one.
+#define COMPSYSTEM_ACTOR_INDEX_BITS      22
+#define COMPSYSTEM_ACTOR_INDEX_MASK      ((1u << COMPSYSTEM_ACTOR_INDEX_BITS) - 1u)
+#define COMPSYSTEM_ACTOR_GENERATION_MASK (0xFFFFFFFFu >> COMPSYSTEM_ACTOR_INDEX_BITS)
+#define COMPSYSTEM_ACTOR_INDEX(actor)      ((actor) & COMPSYSTEM_ACTOR_INDEX_MASK)
+#define COMPSYSTEM_ACTOR_GENERATION(actor) ((actor) >> COMPSYSTEM_ACTOR_INDEX_BITS)
+
+// Live actors never use the top generation. Command buffers hand it out for
+// actors that will only be created when the buffer is flushed.
+#define COMPSYSTEM_ACTOR_IS_PENDING(actor) \
+   ((actor) != COMPSYSTEM_INVALID_ACTOR && \
+    COMPSYSTEM_ACTOR_GENERATION(actor) == COMPSYSTEM_ACTOR_GENERATION_MASK)
+
+// A type mask names a set of component types, one bit per comptypeid_t.
+// Only types below COMPSYSTEM_MASK_TYPES can be placed in a mask.
+#ifndef COMPSYSTEM_MASK_TYPES
+#define COMPSYSTEM_MASK_TYPES 128
+#endif
+#define COMPSYSTEM_MASK_WORDS ((COMPSYSTEM_MASK_TYPES + 31) / 32)
+#define COMPSYSTEM_MASK_SET(mask, type)   ((mask).bits[(type) >> 5] |=  (1u << ((type) & 31)))
+#define COMPSYSTEM_MASK_CLEAR(mask, type) ((mask).bits[(type) >> 5] &= ~(1u << ((type) & 31)))
+#define COMPSYSTEM_MASK_HAS(mask, type)   (((mask).bits[(type) >> 5] >> ((type) & 31)) & 1u)
+
+// Paged types use the largest power of two of components fitting in a page
+#ifndef COMPSYSTEM_PAGE_BYTES
+#define COMPSYSTEM_PAGE_BYTES 16384
+#endif
+
+// Frame captures keep this many frames for CompSystem_Rewind
+#ifndef COMPSYSTEM_ROLLBACK_FRAMES
+#define COMPSYSTEM_ROLLBACK_FRAMES 8
+#endif
 
 typedef struct compsystem_s * CompSystem_T;
+typedef struct compsystem_commandbuffer_s * CompSystem_CommandBuffer_T;
 
 typedef unsigned int actorid_t;
 typedef unsigned int comptypeid_t;
+typedef unsigned int comptick_t;
+typedef struct comptypemask_s
+{
+   unsigned int bits[COMPSYSTEM_MASK_WORDS];
+} CompSystem_TypeMask_T;
 typedef void (*CompSystem_DestroyFunc_T)(void * comp, CompSystem_T sys, 
                                          comptypeid_t type, actorid_t actor);
+// Destroys count contiguous components owned by actors[0 .. count - 1]. Types
+// with fields get a pointer into their first column.
+typedef void (*CompSystem_DestroyRangeFunc_T)(void * comps, int count, CompSystem_T sys, 
+                                              comptypeid_t type, const actorid_t * actors);
+
+typedef struct compsystem_field_s
+{
+   int size;
+} CompSystem_Field_T;
+
+// Every buffer the system owns comes from these hooks. Alignment is a power
+// of two, and the sizes handed to reallocFunc and freeFunc are the ones the
+// block was last allocated with. The default uses malloc, realloc and free.
+typedef struct compsystem_allocator_s
+{
+   void * (*allocFunc)(void * context, size_t size, size_t alignment);
+   void * (*reallocFunc)(void * context, void * ptr, size_t oldSize, size_t newSize, 
+                         size_t alignment);
+   void   (*freeFunc)(void * context, void * ptr, size_t size, size_t alignment);
+   void * context;
+} CompSystem_Allocator_T;
+
+// Packed storage keeps each type in its own array in insertion order.
+// Archetype storage additionally splits every array into one segment per
+// distinct component set, so actors sharing a set line up across types.
+// Archetype storage only supports types below COMPSYSTEM_MASK_TYPES.
+typedef enum compsystem_storage_e
+{
+   eCompSystem_Storage_Packed,
+   eCompSystem_Storage_Archetype
+} CompSystem_Storage_T;
+
+#define COMPSYSTEM_QUERY_MAX_TYPES 8
+#define COMPSYSTEM_QUERY_BATCH     256
+
+// Join iterator over every actor owning all include types and none of the
+// exclude types. Each CompSystem_QueryNext fills a batch of count matches:
+// match i owns component index[k][i] of include[k], whose pool starts at
+// base[k]. The structure of the system must not change while iterating.
+//
+// CompSystem_QueryNextChunk instead yields runs whose components sit at the
+// same offset in every type: base[k][i] and chunkActor[i] all belong to the
+// same actor. With archetype storage each matching archetype is one run.
+// Use either QueryNext or QueryNextChunk on a given iterator, not both.
+typedef struct compsystem_query_s
+{
+   int count;
+   void * base[COMPSYSTEM_QUERY_MAX_TYPES];
+   int index[COMPSYSTEM_QUERY_MAX_TYPES][COMPSYSTEM_QUERY_BATCH];
+   actorid_t actor[COMPSYSTEM_QUERY_BATCH];
+   const actorid_t * chunkActor;
+   
+   // Iterator state
+   CompSystem_T sys;
+   comptypeid_t include[COMPSYSTEM_QUERY_MAX_TYPES];
+   comptypeid_t exclude[COMPSYSTEM_QUERY_MAX_TYPES];
+   int includeCount;
+   int excludeCount;
+   int driver;
+   int position;
+   int limit;
+   int tagged;
+   CompSystem_TypeMask_T tagInclude;
+   CompSystem_TypeMask_T tagExclude;
+} CompSystem_Query_T;
+
+// Parallel kernels get a slice of count components starting at pool index
+// baseIndex, or one query batch, plus the index of the worker running them.
+typedef void (*CompSystem_KernelFunc_T)(void * comps, int count, int baseIndex, 
+                                        int threadIndex, void * userData);
+typedef void (*CompSystem_QueryKernelFunc_T)(const CompSystem_Query_T * batch, 
+                                             int threadIndex, void * userData);
+
+// Called for each pool a snapshot load adopts, comps is the first column.
+typedef void (*CompSystem_FixupFunc_T)(CompSystem_T sys, comptypeid_t type, void * comps, 
+                                       int count, void * userData);
+
+// Orders two components for CompSystem_SortType, like qsort. Types with
+// fields get pointers into their first column.
+typedef int (*CompSystem_CompareFunc_T)(const void * compA, const void * compB, void * userData);
+
+// Systems are run once per CompSystem_RunSystems on the worker threadIndex.
+typedef void (*CompSystem_SystemFunc_T)(CompSystem_T sys, int threadIndex, void * userData);
+
+// Sizes are always filled in, the counters only count when the library is
+// built with COMPSYSTEM_STATS.
+typedef struct compsystem_stats_s
+{
+   int actorCount;
+   int slotCount;
+   int typeCount;
+   int archetypeCount;
+   size_t bytesReserved;
+   size_t bytesUsed;
+   unsigned long long growCount;
+   unsigned long long lookupCount;
+   unsigned long long newActorCount;
+   unsigned long long removeActorCount;
+   unsigned long long setComponentCount;
+} CompSystem_Stats_T;
+
+typedef struct compsystem_typestats_s
+{
+   int count;
+   int capacity;
+   int elementSize;
+   size_t bytesReserved;
+   size_t bytesUsed;
+   unsigned long long growCount;
+} CompSystem_TypeStats_T;
+
+// Trace hooks get the event name ("NewActor", "Grow", ...) and how long it took.
+typedef void (*CompSystem_TraceFunc_T)(CompSystem_T sys, const char * event, 
+                                       unsigned long long durationNs, void * userData);
 
 
 
 
 CompSystem_T CompSystem_Create(void);
+CompSystem_T CompSystem_CreateWithStorage(CompSystem_Storage_T storage);
+CompSystem_T CompSystem_CreateWithAllocator(const CompSystem_Allocator_T * allocator, 
+                                            CompSystem_Storage_T storage);
+
+void CompSystem_ClearMask(CompSystem_TypeMask_T * mask);
 
 void CompSystem_NewType(CompSystem_T sys, comptypeid_t * type);
+// An elementSize of 0 makes a type below COMPSYSTEM_MASK_TYPES a tag. Tags
+// have no pool, only the signature bit of each actor that has one, so
+// SetComponent returns NULL for them and queries report a NULL base and
+// invalid indices. Tags can not be grouped.
 void CompSystem_SetType(CompSystem_T sys, comptypeid_t type, int elementSize, CompSystem_DestroyFunc_T destroyFunc);
+// Same as SetType, but the pool starts on an alignment byte boundary. Use an
+// elementSize that is a multiple of alignment to align every component.
+void CompSystem_SetTypeAligned(CompSystem_T sys, comptypeid_t type, int elementSize, 
+                               int alignment, CompSystem_DestroyFunc_T destroyFunc);
+// Stores each field of the type in its own packed column instead of an array
+// of structs. A whole component is its fields back to back without padding,
+// that is the layout DeferSetComponent copies from. Component pointers from
+// the other calls point into the first column, the rest are reached through
+// CompSystem_ColumnsFor with the component index.
+void CompSystem_SetTypeFields(CompSystem_T sys, comptypeid_t type, 
+                              const CompSystem_Field_T * fields, int fieldCount);
+// Replaces the destroyFunc of a set up type with one called once per run of
+// removed components, the whole pool on Destroy. Types without either are
+// trivially destructible, removing them never walks their components.
+void CompSystem_SetTypeDestroyRange(CompSystem_T sys, comptypeid_t type, 
+                                    CompSystem_DestroyRangeFunc_T destroyRangeFunc);
+// Moves a set up type into fixed size pages, so growing adds a page and
+// never moves a component: pointers stay valid until their component is
+// removed or moved by a removal, sort or group. Pools are then only
+// contiguous per page, ComponentFor and ColumnsFor return the first page and
+// QueryNext leaves base NULL. Packed storage and types without fields only.
+void CompSystem_SetTypePaged(CompSystem_T sys, comptypeid_t type);
 
 void CompSystem_NewActor(CompSystem_T sys, actorid_t * actor);
 void CompSystem_RemoveActor(CompSystem_T sys, actorid_t actor);
 
+// Creates count actors, each owning a component of every type in typeMask
+// (typeMask may be NULL). The new components of a type sit in one contiguous
+// run of its pool in outIds order, starting at the index of outIds[0], so
+// they can be filled with a single memcpy (one per page for paged types).
+void CompSystem_NewActors(CompSystem_T sys, int count, 
+                          const CompSystem_TypeMask_T * typeMask, 
+                          actorid_t * outIds);
+// Removes every live actor in ids, compacting each pool in a single pass.
+// Stale or repeated IDs are ignored.
+void CompSystem_RemoveActors(CompSystem_T sys, const actorid_t * ids, int count);
+void CompSystem_IsActorAlive(const CompSystem_T sys, actorid_t actor, int * alive);
+
+// Reserve capacity up front so later inserts never reallocate. Components
+// can only be reserved once the type has been set with CompSystem_SetType.
+void CompSystem_ReserveActors(CompSystem_T sys, int count);
+void CompSystem_ReserveComponents(CompSystem_T sys, comptypeid_t type, int count);
+
 void CompSystem_SetComponent(CompSystem_T sys, actorid_t actor, comptypeid_t type, void ** compOut);
+// Destroys one component, the last of its pool moves into the hole. The
+// actor stays alive.
+void CompSystem_RemoveComponent(CompSystem_T sys, actorid_t actor, comptypeid_t type);
+void CompSystem_HasComponent(const CompSystem_T sys, actorid_t actor, comptypeid_t type, int * has);
 void CompSystem_GetComponent(const CompSystem_T sys, actorid_t actor, comptypeid_t type, int * outIndex, void ** outPointer);
 void CompSystem_GetComponentActor(const CompSystem_T sys, comptypeid_t type, int index, actorid_t * actor);
 void CompSystem_GetComponentFromComponent(const CompSystem_T sys, 
@@ -58,10 +272,196 @@ void CompSystem_GetComponentFromComponent(const CompSystem_T sys,
                                           void ** destPointer);
 
 void CompSystem_ComponentFor(const CompSystem_T sys, comptypeid_t type, void ** array, int * size);
+// Pages of a paged type in order, until size is 0. Other types are page 0.
+void CompSystem_ComponentForPage(const CompSystem_T sys, comptypeid_t type, int page, 
+                                 void ** array, int * size);
+// Fills columns with one pointer per field, or just the pool for plain types
+void CompSystem_ColumnsFor(const CompSystem_T sys, comptypeid_t type, void ** columns, int * size);
+void CompSystem_QueryBegin(const CompSystem_T sys, CompSystem_Query_T * query,
+                           const comptypeid_t * include, int includeCount,
+                           const comptypeid_t * exclude, int excludeCount);
+void CompSystem_QueryNext(CompSystem_Query_T * query, int * count);
+void CompSystem_QueryNextChunk(CompSystem_Query_T * query, int * count);
+
+// A cached query keeps the list of actors matching its filter across frames
+// and updates it as components are added and removed, so reading it costs
+// no join. QueryMatches returns count matches: match i is actors[i] and owns
+// component indices[i * includeCount + k] of include[k], tags give an invalid
+// index. The lists stay valid until the structure changes. Sorting, groups
+// and archetype moves make the next call re-read the moved indices, Rewind
+// and LoadSnapshot rebuild the lists.
+void CompSystem_CreateQuery(CompSystem_T sys,
+                            const comptypeid_t * include, int includeCount,
+                            const comptypeid_t * exclude, int excludeCount,
+                            int * queryIndex);
+void CompSystem_QueryMatches(CompSystem_T sys, int queryIndex, const actorid_t ** actors,
+                             const int ** indices, int * count);
+
+// A spatial index hashes the actors of a type into a uniform grid of
+// cellSize cells by the 2 or 3 floats at offset in each component, for types
+// without fields. UpdateSpatial re-indexes the components changed since its
+// last call, or the whole pool for untracked types, so call it once per tick
+// after the positions are written. Removed actors and components leave the
+// index at once; Rewind and LoadSnapshot empty it until the next update.
+// QueryRadius and QueryAABB write up to maxCount actors whose indexed
+// position lies inside, in no particular order.
+void CompSystem_SetTypeSpatial(CompSystem_T sys, comptypeid_t type, int offset, int dimensions,
+                               float cellSize);
+void CompSystem_UpdateSpatial(CompSystem_T sys, comptypeid_t type);
+void CompSystem_QueryRadius(const CompSystem_T sys, comptypeid_t type, const float * center,
+                            float radius, actorid_t * outIds, int maxCount, int * outCount);
+void CompSystem_QueryAABB(const CompSystem_T sys, comptypeid_t type, const float * lower,
+                          const float * upper, actorid_t * outIds, int maxCount, int * outCount);
+
+// A key index finds the component of a type whose keySize bytes at keyOffset
+// equal a key, for types without fields. Components added or set through
+// SetComponent or NewActors are hashed on the next lookup, after the caller
+// has written them; a key changed through any other pointer needs
+// IndexRekey. Removed actors and components leave the index at once. With
+// duplicate keys the lookup returns one of them. A missing key gives
+// COMPSYSTEM_INVALID_ACTOR and NULL. CreateIndex returns
+// COMPSYSTEM_INVALID_INDEX when the key does not fit the type.
+void CompSystem_CreateIndex(CompSystem_T sys, comptypeid_t type, int keyOffset, int keySize,
+                            int * keyIndex);
+void CompSystem_IndexLookup(CompSystem_T sys, int keyIndex, const void * key,
+                            actorid_t * actor, void ** comp);
+void CompSystem_IndexRekey(CompSystem_T sys, int keyIndex, actorid_t actor);
+
+// Every actor carries a signature with the bit of each type it owns. Only
+// types below COMPSYSTEM_MASK_TYPES are tracked. FilterActors writes up to
+// maxCount actors that own every include type and no exclude type
+// (exclude may be NULL).
+void CompSystem_GetActorSignature(const CompSystem_T sys, actorid_t actor, 
+                                  CompSystem_TypeMask_T * signature);
+void CompSystem_ActorHasAll(const CompSystem_T sys, actorid_t actor, 
+                            const CompSystem_TypeMask_T * mask, int * hasAll);
+void CompSystem_FilterActors(const CompSystem_T sys, 
+                             const CompSystem_TypeMask_T * include,
+                             const CompSystem_TypeMask_T * exclude,
+                             actorid_t * outIds, int maxCount, int * outCount);
+
 void CompSystem_GetActorCount(const CompSystem_T sys, int * actorCount);
 void CompSystem_GetActor(const CompSystem_T sys, int index, actorid_t * actor);
 
+// Parallel iteration splits the driving pool into tasks of grainSize
+// components and runs them on a work-stealing thread pool owned by the
+// system. The thread count defaults to the number of cores; setting it
+// restarts the pool. Kernels may write their own components but must not
+// change the structure of the system.
+void CompSystem_SetThreadCount(CompSystem_T sys, int threadCount);
+void CompSystem_ParallelFor(CompSystem_T sys, comptypeid_t type, 
+                            CompSystem_KernelFunc_T kernel, void * userData, 
+                            int grainSize);
+void CompSystem_ParallelQuery(CompSystem_T sys, 
+                              const comptypeid_t * include, int includeCount,
+                              const comptypeid_t * exclude, int excludeCount,
+                              CompSystem_QueryKernelFunc_T kernel, void * userData, 
+                              int grainSize);
+
+// Each worker thread records structural changes into its own command buffer
+// without locking, and CompSystem_Flush applies them at a sync point: buffer
+// 0 first, each in recording order. DeferNewActor returns a pending handle
+// that the other Defer calls on the same buffer accept. After the flush,
+// ResolveActor maps it to the real actor until that buffer records again.
+// DeferSetComponent copies comp (elementSize bytes) if it is not NULL.
+void CompSystem_GetCommandBuffer(CompSystem_T sys, int threadIndex, 
+                                 CompSystem_CommandBuffer_T * buffer);
+void CompSystem_DeferNewActor(CompSystem_CommandBuffer_T buffer, actorid_t * pendingActor);
+void CompSystem_DeferSetComponent(CompSystem_CommandBuffer_T buffer, actorid_t actor, 
+                                  comptypeid_t type, const void * comp);
+void CompSystem_DeferRemoveActor(CompSystem_CommandBuffer_T buffer, actorid_t actor);
+void CompSystem_ResolveActor(const CompSystem_CommandBuffer_T buffer, actorid_t pendingActor, 
+                             actorid_t * actor);
+void CompSystem_Flush(CompSystem_T sys);
+
+// Systems declare the component types they read and write. RunSystems splits
+// them into waves, no two systems in a wave write a type the other one reads
+// or writes, and runs each wave on the thread pool. Conflicting systems keep
+// the order they were added in. A system alone in its wave runs on the
+// calling thread and its parallel calls use the whole pool; a system sharing
+// its wave runs them serially on its own worker. Structural changes go
+// through the command buffers, which are flushed at the end.
+void CompSystem_AddSystem(CompSystem_T sys, CompSystem_SystemFunc_T func, void * userData,
+                          const comptypeid_t * reads, int readCount,
+                          const comptypeid_t * writes, int writeCount,
+                          int * systemIndex);
+void CompSystem_RunSystems(CompSystem_T sys);
+
+// SortType reorders a pool with a stable sort, archetype storage sorts each
+// segment and reorders the other types of the archetype to match. A group,
+// packed storage only, keeps the actors owning all of its types at the front
+// of each of those pools, at the same indices from 0 to the group size, as
+// components come and go. A type belongs to one group at most; sorting it
+// sorts the group and the rest of the pool apart and reorders the other types
+// of the group to match. GroupTypes returns COMPSYSTEM_INVALID_INDEX when it
+// cannot group the types.
+void CompSystem_SortType(CompSystem_T sys, comptypeid_t type, 
+                         CompSystem_CompareFunc_T compareFunc, void * userData);
+void CompSystem_GroupTypes(CompSystem_T sys, const comptypeid_t * types, int count, 
+                           int * groupIndex);
+void CompSystem_GetGroupSize(const CompSystem_T sys, int groupIndex, int * size);
+
+// Change tracking is opt in per type. Every tracked component records the
+// tick it was added and last changed at; SetComponent and NewActors stamp
+// both, code writing through ComponentFor calls MarkChanged or
+// MarkChangedRange. Ranges marked from different threads must not share a
+// run of 64 components. The ChangedSince and AddedSince iterators return the
+// next run of components stamped at or after tick, starting at position 0,
+// until count is 0. Untracked types report their whole pool once.
+void CompSystem_TrackChanges(CompSystem_T sys, comptypeid_t type);
+void CompSystem_AdvanceTick(CompSystem_T sys, comptick_t * tick);
+void CompSystem_GetTick(const CompSystem_T sys, comptick_t * tick);
+void CompSystem_MarkChanged(CompSystem_T sys, actorid_t actor, comptypeid_t type);
+void CompSystem_MarkChangedRange(CompSystem_T sys, comptypeid_t type, int first, int count);
+void CompSystem_GetComponentVersion(const CompSystem_T sys, actorid_t actor, comptypeid_t type,
+                                    comptick_t * added, comptick_t * changed);
+void CompSystem_ComponentForChangedSince(const CompSystem_T sys, comptypeid_t type, comptick_t tick,
+                                         int * position, int * first, int * count);
+void CompSystem_ComponentForAddedSince(const CompSystem_T sys, comptypeid_t type, comptick_t tick,
+                                       int * position, int * first, int * count);
+
+// Frame captures journal what packed storage overwrites, so a rollback only
+// costs the edits made since. BeginFrameCapture starts a frame at the current
+// state and keeps the last COMPSYSTEM_ROLLBACK_FRAMES. Rewind(sys, n) undoes
+// the newest n frames, restoring the state of the nth most recent
+// BeginFrameCapture, and leaves that frame open for the resimulated tick.
+// Component bytes are saved by SetComponent and the MarkChanged calls, which
+// must come before the write while capturing; kernels and systems running
+// on the thread pool may call them, their journal appends take a lock.
+// Destroy callbacks of removed components still run. Types must be set up
+// before capturing starts, and archetype storage is not captured.
+void CompSystem_BeginFrameCapture(CompSystem_T sys);
+void CompSystem_Rewind(CompSystem_T sys, int frames, int * rewound);
+void CompSystem_ClearFrameCaptures(CompSystem_T sys);
+
+// Stats report the actor, slot and type counts and the bytes held by the
+// tables and pools. Grow, lookup and actor counters and the trace hook only
+// run in COMPSYSTEM_STATS builds, otherwise they compile away; counts taken
+// while systems run in parallel are approximate. ResetStats zeroes the
+// counters.
+void CompSystem_GetStats(const CompSystem_T sys, CompSystem_Stats_T * stats);
+void CompSystem_GetTypeStats(const CompSystem_T sys, comptypeid_t type, 
+                             CompSystem_TypeStats_T * stats);
+void CompSystem_ResetStats(CompSystem_T sys);
+void CompSystem_SetTraceHook(CompSystem_T sys, CompSystem_TraceFunc_T traceFunc, void * userData);
+
+// Snapshots hold the actor, slot and index tables and the raw pools in an
+// aligned, versioned file. Loading maps the file and adopts those blocks in
+// place, a table is only copied once it has to grow. The loading system
+// needs the same storage and types, set up with the same sizes; its current
+// actors are destroyed first. Pools are saved as raw bytes, so types holding
+// pointers repair them in fixupFunc, called once per non-empty pool or page.
+// Saving writes filename.tmp and renames it over filename, so a system may
+// save over the file it was loaded from.
+void CompSystem_SaveSnapshot(const CompSystem_T sys, const char * filename, int * saved);
+void CompSystem_LoadSnapshot(CompSystem_T sys, const char * filename, 
+                             CompSystem_FixupFunc_T fixupFunc, void * userData, int * loaded);
+
 void CompSystem_Destroy(CompSystem_T sys);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // __COMPSYSTEM_H__
 
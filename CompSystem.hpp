@@ -0,0 +1,297 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef __COMPSYSTEM_HPP__
+#define __COMPSYSTEM_HPP__
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "CompSystem.h"
+
+// C++17 front end over the same system. World<Components...> registers one
+// type per component in order, so a component's type ID is its position in
+// the list and known at compile time. Components live in the C pools and are
+// moved with memcpy, so they must be trivially copyable. Typed access and
+// each() loops are templates over the component types, the compiler sees
+// their sizes as constants and inlines the loop body. raw() returns the
+// CompSystem_T for everything else the C API offers.
+namespace CompSystem
+{
+   namespace Detail
+   {
+      template <typename T, typename... Ts>
+      struct IndexOf;
+
+      template <typename T, typename... Ts>
+      struct IndexOf<T, T, Ts...> : std::integral_constant<comptypeid_t, 0>
+      {
+      };
+
+      template <typename T, typename U, typename... Ts>
+      struct IndexOf<T, U, Ts...> : std::integral_constant<comptypeid_t, 1 + IndexOf<T, Ts...>::value>
+      {
+      };
+
+      template <typename T>
+      struct IndexOf<T>
+      {
+         static_assert(sizeof(T) == 0, "component is not part of this World");
+      };
+   }
+
+   template <typename... Components>
+   class World
+   {
+   public:
+      static_assert(sizeof...(Components) > 0, "a World needs at least one component");
+      static_assert((std::is_trivially_copyable_v<Components> && ...),
+                    "components are moved with memcpy and must be trivially copyable");
+
+      template <typename T>
+      static constexpr comptypeid_t TypeOf = Detail::IndexOf<T, Components...>::value;
+
+      explicit World(CompSystem_Storage_T storage = eCompSystem_Storage_Packed)
+         : sys(CompSystem_CreateWithStorage(storage)), storage(storage)
+      {
+         (Register<Components>(), ...);
+      }
+
+      ~World()
+      {
+         if(sys != nullptr)
+         {
+            CompSystem_Destroy(sys);
+         }
+      }
+
+      World(const World &) = delete;
+      World & operator=(const World &) = delete;
+
+      World(World && other) noexcept : sys(other.sys), storage(other.storage)
+      {
+         other.sys = nullptr;
+      }
+
+      CompSystem_T raw() const
+      {
+         return sys;
+      }
+
+      actorid_t create()
+      {
+         actorid_t actor;
+         CompSystem_NewActor(sys, &actor);
+         return actor;
+      }
+
+      void destroy(actorid_t actor)
+      {
+         CompSystem_RemoveActor(sys, actor);
+      }
+
+      bool alive(actorid_t actor) const
+      {
+         int isAlive;
+         CompSystem_IsActorAlive(sys, actor, &isAlive);
+         return isAlive != 0;
+      }
+
+      // Adds or overwrites the component, nullptr if the actor is gone
+      template <typename T>
+      T * add(actorid_t actor, const T & value = T())
+      {
+         void * comp;
+         CompSystem_SetComponent(sys, actor, TypeOf<T>, &comp);
+         return comp != nullptr ? ::new(comp) T(value) : nullptr;
+      }
+
+      template <typename T>
+      void remove(actorid_t actor)
+      {
+         CompSystem_RemoveComponent(sys, actor, TypeOf<T>);
+      }
+
+      template <typename T>
+      T * get(actorid_t actor) const
+      {
+         void * comp;
+         CompSystem_GetComponent(sys, actor, TypeOf<T>, nullptr, &comp);
+         return static_cast<T *>(comp);
+      }
+
+      template <typename T>
+      bool has(actorid_t actor) const
+      {
+         int hasComp;
+         CompSystem_HasComponent(sys, actor, TypeOf<T>, &hasComp);
+         return hasComp != 0;
+      }
+
+      // The pool of T in pool order, only the first page of a paged type
+      template <typename T>
+      T * pool(int & size) const
+      {
+         void * comps;
+         CompSystem_ComponentFor(sys, TypeOf<T>, &comps, &size);
+         return static_cast<T *>(comps);
+      }
+
+      // Calls func(T & ...) or func(actorid_t, T & ...) for every actor owning
+      // all of Ts. The C core finds the matches a batch or run at a time, the
+      // loop over them is inlined here. func must not change the structure.
+      template <typename... Ts, typename Func>
+      void each(Func && func)
+      {
+         static_assert(sizeof...(Ts) > 0 && sizeof...(Ts) <= COMPSYSTEM_QUERY_MAX_TYPES,
+                       "each takes 1 to COMPSYSTEM_QUERY_MAX_TYPES components");
+         if constexpr(sizeof...(Ts) == 1)
+         {
+            EachPool<Ts...>(func);
+         }
+         else if(storage == eCompSystem_Storage_Archetype)
+         {
+            EachRun<Ts...>(func, std::index_sequence_for<Ts...>());
+         }
+         else
+         {
+            EachBatch<Ts...>(func, std::index_sequence_for<Ts...>());
+         }
+      }
+
+   private:
+      template <typename T>
+      void Register()
+      {
+         comptypeid_t type;
+         CompSystem_NewType(sys, &type);
+         if constexpr(alignof(T) > 16)
+         {
+            CompSystem_SetTypeAligned(sys, type, sizeof(T), alignof(T), nullptr);
+         }
+         else
+         {
+            CompSystem_SetType(sys, type, sizeof(T), nullptr);
+         }
+      }
+
+      template <typename Func, typename... Ts>
+      static void Invoke(Func & func, actorid_t actor, Ts &... comps)
+      {
+         if constexpr(std::is_invocable_v<Func &, actorid_t, Ts &...>)
+         {
+            func(actor, comps...);
+         }
+         else
+         {
+            func(comps...);
+         }
+      }
+
+      template <typename T>
+      T & Element(const CompSystem_Query_T & query, size_t k, int i) const
+      {
+         void * comp;
+
+         // Paged pools have no single base, their components are looked up
+         if(query.base[k] == nullptr)
+         {
+            CompSystem_GetComponent(sys, query.actor[i], TypeOf<T>, nullptr, &comp);
+            return *static_cast<T *>(comp);
+         }
+         return static_cast<T *>(query.base[k])[query.index[k][i]];
+      }
+
+      template <typename T, typename Func>
+      void EachPool(Func & func)
+      {
+         void * comps;
+         int size, page, i;
+
+         // A single pool is one run, the iterator is only needed for the actors
+         if constexpr(std::is_invocable_v<Func &, actorid_t, T &>)
+         {
+            EachRun<T>(func, std::index_sequence<0>());
+         }
+         else
+         {
+            // Paged types set up through raw() are walked a page at a time
+            for(page = 0; ; page++)
+            {
+               CompSystem_ComponentForPage(sys, TypeOf<T>, page, &comps, &size);
+               if(size == 0)
+               {
+                  break;
+               }
+               for(i = 0; i < size; i++)
+               {
+                  func(static_cast<T *>(comps)[i]);
+               }
+            }
+         }
+      }
+
+      template <typename... Ts, typename Func, size_t... K>
+      void EachBatch(Func & func, std::index_sequence<K...>)
+      {
+         const comptypeid_t include[] = { TypeOf<Ts>... };
+         CompSystem_Query_T query;
+         int count, i;
+
+         CompSystem_QueryBegin(sys, &query, include, sizeof...(Ts), nullptr, 0);
+         for(CompSystem_QueryNext(&query, &count); count > 0; CompSystem_QueryNext(&query, &count))
+         {
+            for(i = 0; i < count; i++)
+            {
+               Invoke(func, query.actor[i], Element<Ts>(query, K, i)...);
+            }
+         }
+      }
+
+      template <typename... Ts, typename Func, size_t... K>
+      void EachRun(Func & func, std::index_sequence<K...>)
+      {
+         const comptypeid_t include[] = { TypeOf<Ts>... };
+         CompSystem_Query_T query;
+         int count, i;
+
+         CompSystem_QueryBegin(sys, &query, include, sizeof...(Ts), nullptr, 0);
+         for(CompSystem_QueryNextChunk(&query, &count); count > 0;
+             CompSystem_QueryNextChunk(&query, &count))
+         {
+            for(i = 0; i < count; i++)
+            {
+               Invoke(func, query.chunkActor[i], static_cast<Ts *>(query.base[K])[i]...);
+            }
+         }
+      }
+
+      CompSystem_T sys;
+      CompSystem_Storage_T storage;
+   };
+}
+
+#endif // __COMPSYSTEM_HPP__
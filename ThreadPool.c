@@ -0,0 +1,397 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <stdlib.h>
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef CRITICAL_SECTION   Mutex_T;
+typedef CONDITION_VARIABLE Cond_T;
+typedef HANDLE             Thread_T;
+typedef DWORD              ThreadId_T;
+
+#define MUTEX_INIT(m)         InitializeCriticalSection(m)
+#define MUTEX_DESTROY(m)      DeleteCriticalSection(m)
+#define MUTEX_LOCK(m)         EnterCriticalSection(m)
+#define MUTEX_UNLOCK(m)       LeaveCriticalSection(m)
+#define COND_INIT(c)          InitializeConditionVariable(c)
+#define COND_DESTROY(c)
+#define COND_WAIT(c, m)       SleepConditionVariableCS(c, m, INFINITE)
+#define COND_SIGNAL(c)        WakeConditionVariable(c)
+#define COND_BROADCAST(c)     WakeAllConditionVariable(c)
+#define THREAD_SELF()         GetCurrentThreadId()
+#define THREAD_EQUAL(a, b)    ((a) == (b))
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t Mutex_T;
+typedef pthread_cond_t  Cond_T;
+typedef pthread_t       Thread_T;
+typedef pthread_t       ThreadId_T;
+
+#define MUTEX_INIT(m)         pthread_mutex_init(m, NULL)
+#define MUTEX_DESTROY(m)      pthread_mutex_destroy(m)
+#define MUTEX_LOCK(m)         pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m)       pthread_mutex_unlock(m)
+#define COND_INIT(c)          pthread_cond_init(c, NULL)
+#define COND_DESTROY(c)       pthread_cond_destroy(c)
+#define COND_WAIT(c, m)       pthread_cond_wait(c, m)
+#define COND_SIGNAL(c)        pthread_cond_signal(c)
+#define COND_BROADCAST(c)     pthread_cond_broadcast(c)
+#define THREAD_SELF()         pthread_self()
+#define THREAD_EQUAL(a, b)    pthread_equal(a, b)
+#endif
+
+typedef struct taskqueue_s
+{
+   Mutex_T lock;
+   int begin;
+   int end;
+} TaskQueue_T;
+
+typedef struct worker_s
+{
+   ThreadPool_T pool;
+   int index;
+   Thread_T thread;
+   ThreadId_T id;
+} Worker_T;
+
+struct threadpool_s
+{
+   int           threadCount;
+   Worker_T    * workerArray;
+   TaskQueue_T * queueArray;
+   
+   Mutex_T lock;
+   Mutex_T shared;
+   Cond_T  wake;
+   Cond_T  done;
+   int     jobID;
+   int     busy;
+   int     quit;
+   
+   ThreadPool_TaskFunc_T func;
+   void * userData;
+};
+
+static void ThreadPool_Work(ThreadPool_T pool, int self);
+static int ThreadPool_PopTask(ThreadPool_T pool, int self);
+static int ThreadPool_Steal(ThreadPool_T pool, int self);
+static void ThreadPool_WorkerLoop(Worker_T * worker);
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadPool_ThreadMain(LPVOID arg)
+{
+   ThreadPool_WorkerLoop(arg);
+   return 0;
+}
+#else
+static void * ThreadPool_ThreadMain(void * arg)
+{
+   ThreadPool_WorkerLoop(arg);
+   return NULL;
+}
+#endif
+
+
+ThreadPool_T ThreadPool_Create(int threadCount)
+{
+   ThreadPool_T pool;
+   Worker_T * worker;
+   int i, started;
+   
+   if(threadCount < 1)
+   {
+      threadCount = 1;
+   }
+   
+   pool = malloc(sizeof(struct threadpool_s));
+   pool->threadCount = threadCount;
+   pool->workerArray = calloc(threadCount, sizeof(Worker_T));
+   pool->queueArray  = calloc(threadCount, sizeof(TaskQueue_T));
+   pool->jobID       = 0;
+   pool->busy        = 0;
+   pool->quit        = 0;
+   pool->func        = NULL;
+   pool->userData    = NULL;
+   MUTEX_INIT(&pool->lock);
+   MUTEX_INIT(&pool->shared);
+   COND_INIT(&pool->wake);
+   COND_INIT(&pool->done);
+   
+   for(i = 0; i < threadCount; i++)
+   {
+      MUTEX_INIT(&pool->queueArray[i].lock);
+      pool->queueArray[i].begin = 0;
+      pool->queueArray[i].end   = 0;
+   }
+   
+   // Worker 0 is whoever calls ThreadPool_Run
+   for(i = 1; i < threadCount; i++)
+   {
+      worker = &pool->workerArray[i];
+      worker->pool  = pool;
+      worker->index = i;
+#ifdef _WIN32
+      worker->thread = CreateThread(NULL, 0, ThreadPool_ThreadMain, worker, 0, &worker->id);
+      started = worker->thread != NULL;
+#else
+      started = pthread_create(&worker->thread, NULL, ThreadPool_ThreadMain, worker) == 0;
+      worker->id = worker->thread;
+#endif
+      if(!started)
+      {
+         break;
+      }
+   }
+   
+   // The pool runs with the workers that did start, runs split over them only
+   pool->threadCount = i;
+   for(; i < threadCount; i++)
+   {
+      MUTEX_DESTROY(&pool->queueArray[i].lock);
+   }
+   return pool;
+}
+
+void ThreadPool_Run(ThreadPool_T pool, ThreadPool_TaskFunc_T func, void * userData, int taskCount)
+{
+   TaskQueue_T * queue;
+   int i;
+   
+   if(taskCount <= 0)
+   {
+      return;
+   }
+   
+   // Start every worker on an even share, stealing evens out the rest
+   for(i = 0; i < pool->threadCount; i++)
+   {
+      queue = &pool->queueArray[i];
+      MUTEX_LOCK(&queue->lock);
+      queue->begin = (int)(((long long)taskCount * i)       / pool->threadCount);
+      queue->end   = (int)(((long long)taskCount * (i + 1)) / pool->threadCount);
+      MUTEX_UNLOCK(&queue->lock);
+   }
+   
+   MUTEX_LOCK(&pool->lock);
+   pool->workerArray[0].id = THREAD_SELF();
+   pool->func     = func;
+   pool->userData = userData;
+   pool->busy     = pool->threadCount - 1;
+   pool->jobID ++;
+   COND_BROADCAST(&pool->wake);
+   MUTEX_UNLOCK(&pool->lock);
+   
+   ThreadPool_Work(pool, 0);
+   
+   MUTEX_LOCK(&pool->lock);
+   while(pool->busy > 0)
+   {
+      COND_WAIT(&pool->done, &pool->lock);
+   }
+   MUTEX_UNLOCK(&pool->lock);
+}
+
+void ThreadPool_Lock(ThreadPool_T pool)
+{
+   MUTEX_LOCK(&pool->shared);
+}
+
+void ThreadPool_Unlock(ThreadPool_T pool)
+{
+   MUTEX_UNLOCK(&pool->shared);
+}
+
+void ThreadPool_GetWorkerIndex(const ThreadPool_T pool, int * workerIndex)
+{
+   ThreadId_T self;
+   int i;
+   
+   // Worker 0 is the thread that started the current run
+   self = THREAD_SELF();
+   (*workerIndex) = -1;
+   for(i = 0; i < pool->threadCount && (*workerIndex) < 0; i++)
+   {
+      if(THREAD_EQUAL(pool->workerArray[i].id, self))
+      {
+         (*workerIndex) = i;
+      }
+   }
+}
+
+void ThreadPool_GetThreadCount(const ThreadPool_T pool, int * threadCount)
+{
+   (*threadCount) = pool->threadCount;
+}
+
+void ThreadPool_GetCoreCount(int * coreCount)
+{
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   (*coreCount) = (int)info.dwNumberOfProcessors;
+#else
+   long count;
+   count = sysconf(_SC_NPROCESSORS_ONLN);
+   (*coreCount) = count > 0 ? (int)count : 1;
+#endif
+}
+
+void ThreadPool_Destroy(ThreadPool_T pool)
+{
+   int i;
+   
+   MUTEX_LOCK(&pool->lock);
+   pool->quit = 1;
+   COND_BROADCAST(&pool->wake);
+   MUTEX_UNLOCK(&pool->lock);
+   
+   for(i = 1; i < pool->threadCount; i++)
+   {
+#ifdef _WIN32
+      WaitForSingleObject(pool->workerArray[i].thread, INFINITE);
+      CloseHandle(pool->workerArray[i].thread);
+#else
+      pthread_join(pool->workerArray[i].thread, NULL);
+#endif
+   }
+   
+   for(i = 0; i < pool->threadCount; i++)
+   {
+      MUTEX_DESTROY(&pool->queueArray[i].lock);
+   }
+   MUTEX_DESTROY(&pool->lock);
+   MUTEX_DESTROY(&pool->shared);
+   COND_DESTROY(&pool->wake);
+   COND_DESTROY(&pool->done);
+   free(pool->queueArray);
+   free(pool->workerArray);
+   free(pool);
+}
+
+
+static void ThreadPool_WorkerLoop(Worker_T * worker)
+{
+   ThreadPool_T pool;
+   int seenJob;
+   
+   pool = worker->pool;
+   seenJob = 0;
+   MUTEX_LOCK(&pool->lock);
+   while(1)
+   {
+      while(!pool->quit && pool->jobID == seenJob)
+      {
+         COND_WAIT(&pool->wake, &pool->lock);
+      }
+      if(pool->quit)
+      {
+         break;
+      }
+      seenJob = pool->jobID;
+      MUTEX_UNLOCK(&pool->lock);
+      
+      ThreadPool_Work(pool, worker->index);
+      
+      MUTEX_LOCK(&pool->lock);
+      pool->busy --;
+      if(pool->busy == 0)
+      {
+         COND_SIGNAL(&pool->done);
+      }
+   }
+   MUTEX_UNLOCK(&pool->lock);
+}
+
+static void ThreadPool_Work(ThreadPool_T pool, int self)
+{
+   int task;
+   
+   while(1)
+   {
+      task = ThreadPool_PopTask(pool, self);
+      if(task < 0)
+      {
+         if(!ThreadPool_Steal(pool, self))
+         {
+            return;
+         }
+         continue;
+      }
+      pool->func(pool->userData, task, self);
+   }
+}
+
+static int ThreadPool_PopTask(ThreadPool_T pool, int self)
+{
+   TaskQueue_T * queue;
+   int task;
+   
+   queue = &pool->queueArray[self];
+   task = -1;
+   MUTEX_LOCK(&queue->lock);
+   if(queue->begin < queue->end)
+   {
+      task = queue->begin;
+      queue->begin ++;
+   }
+   MUTEX_UNLOCK(&queue->lock);
+   return task;
+}
+
+static int ThreadPool_Steal(ThreadPool_T pool, int self)
+{
+   TaskQueue_T * victim, * own;
+   int i, half, begin, end;
+   
+   // Take the back half of the first worker that still has tasks left
+   for(i = 1; i < pool->threadCount; i++)
+   {
+      victim = &pool->queueArray[(self + i) % pool->threadCount];
+      MUTEX_LOCK(&victim->lock);
+      half = (victim->end - victim->begin + 1) / 2;
+      end = victim->end;
+      begin = end - half;
+      victim->end = begin;
+      MUTEX_UNLOCK(&victim->lock);
+      
+      if(half > 0)
+      {
+         own = &pool->queueArray[self];
+         MUTEX_LOCK(&own->lock);
+         own->begin = begin;
+         own->end   = end;
+         MUTEX_UNLOCK(&own->lock);
+         return 1;
+      }
+   }
+   return 0;
+}
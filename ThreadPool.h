@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+typedef struct threadpool_s * ThreadPool_T;
+
+typedef void (*ThreadPool_TaskFunc_T)(void * userData, int taskIndex, int threadIndex);
+
+// Persistent pool of threadCount workers, the calling thread counts as
+// worker 0. ThreadPool_Run hands out task indices 0 to taskCount - 1, idle
+// workers steal half of a busy worker's remaining range, and it returns
+// once every task has finished. Runs must not be nested. Workers that fail
+// to start are left out, ThreadPool_GetThreadCount reports the ones running.
+// ThreadPool_Lock guards short updates to state shared by the tasks of a run.
+// ThreadPool_GetWorkerIndex gives the worker index of the calling thread
+// during a run, or -1 for a thread that is not one of its workers.
+ThreadPool_T ThreadPool_Create(int threadCount);
+void ThreadPool_Run(ThreadPool_T pool, ThreadPool_TaskFunc_T func, void * userData, int taskCount);
+void ThreadPool_Lock(ThreadPool_T pool);
+void ThreadPool_Unlock(ThreadPool_T pool);
+void ThreadPool_GetWorkerIndex(const ThreadPool_T pool, int * workerIndex);
+void ThreadPool_GetThreadCount(const ThreadPool_T pool, int * threadCount);
+void ThreadPool_GetCoreCount(int * coreCount);
+void ThreadPool_Destroy(ThreadPool_T pool);
+
+#endif // __THREADPOOL_H__
+
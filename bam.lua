@@ -1,9 +1,24 @@
 settings = NewSettings()
 
+if family ~= "windows" then
+   settings.link.libs:Add("pthread")
+end
+
 source = 
 {
    "CompSystem.c",
-   "testmain.c"
+   "ThreadPool.c",
+   "Arena.c"
 }
 objects = Compile(settings, source)
-exe = Link(settings, "test", objects)
+exe = Link(settings, "test", objects, Compile(settings, "testmain.c"))
+bench = Link(settings, "bench", objects, Compile(settings, "benchmain.c"))
+
+-- CompSystem.hpp is header only, testworld checks it as C++17
+cxxsettings = settings:Copy()
+if family == "windows" then
+   cxxsettings.cc.flags_cxx:Add("/std:c++17")
+else
+   cxxsettings.cc.flags_cxx:Add("-std=c++17")
+end
+world = Link(cxxsettings, "testworld", objects, Compile(cxxsettings, "testworld.cpp"))
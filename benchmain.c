@@ -0,0 +1,428 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+// clock_gettime and syscall are hidden by -std=c99 without these
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CompSystem.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Every result is one CSV row, cache misses are "-" where no counter is open
+#define BENCH_HEADER "benchmark,storage,actors,types,element_size,ns_per_op,bytes_per_actor,cache_misses_per_op\n"
+
+// Configurations above this many component bytes are skipped
+#define BENCH_MAX_BYTES (256u << 20)
+
+// Small worlds repeat the read passes until about this many operations ran
+#define BENCH_MIN_OPS 1000000
+
+#define BENCH_MAX_TYPES 4
+
+typedef unsigned char byte_t;
+
+typedef struct counter_s
+{
+   size_t live;
+   int perfFd;
+} Counter_T;
+
+typedef struct measure_s
+{
+   double startTime;
+   long long startMisses;
+} Measure_T;
+
+static void * countingAlloc(void * context, size_t size, size_t alignment);
+static void * countingRealloc(void * context, void * ptr, size_t oldSize, size_t newSize, 
+                              size_t alignment);
+static void countingFree(void * context, void * ptr, size_t size, size_t alignment);
+static double nowNs(void);
+static void openMissCounter(Counter_T * counter);
+static long long readMisses(const Counter_T * counter);
+static void measureBegin(const Counter_T * counter, Measure_T * measure);
+static void measureEnd(const Counter_T * counter, const Measure_T * measure, 
+                       const char * name, CompSystem_Storage_T storage, 
+                       int actors, int types, int elementSize, 
+                       long long ops, double bytesPerActor);
+static unsigned int nextRandom(unsigned int * state);
+static void setupWorld(CompSystem_T sys, comptypeid_t * typeIds, int types, int elementSize);
+static void createActors(CompSystem_T sys, const comptypeid_t * typeIds, int types, 
+                         int elementSize, actorid_t * actorArray, int actors);
+static double measureBytes(Counter_T * counter, CompSystem_Storage_T storage, 
+                           int actors, int types, int elementSize);
+static void runConfig(Counter_T * counter, CompSystem_Storage_T storage, 
+                      int actors, int types, int elementSize);
+
+static volatile unsigned int sink;
+
+int main(int argc, char * args[])
+{
+   static const int actorCounts[]  = { 1000, 100000, 1000000 };
+   static const int typeCounts[]   = { 1, 4 };
+   static const int elementSizes[] = { 16, 64, 256 };
+   Counter_T counter;
+   int maxActors, s, a, t, e;
+   
+   // An optional argument caps the actor count for quick runs
+   maxActors = (argc > 1) ? atoi(args[1]) : 1000000;
+   
+   counter.live = 0;
+   openMissCounter(&counter);
+   printf(BENCH_HEADER);
+   for(s = 0; s < 2; s++)
+   {
+      for(a = 0; a < (int)(sizeof(actorCounts) / sizeof(actorCounts[0])); a++)
+      {
+         for(t = 0; t < (int)(sizeof(typeCounts) / sizeof(typeCounts[0])); t++)
+         {
+            for(e = 0; e < (int)(sizeof(elementSizes) / sizeof(elementSizes[0])); e++)
+            {
+               if(actorCounts[a] > maxActors ||
+                  (size_t)actorCounts[a] * typeCounts[t] * elementSizes[e] > BENCH_MAX_BYTES)
+               {
+                  continue;
+               }
+               runConfig(&counter, (s == 0) ? eCompSystem_Storage_Packed : 
+                                              eCompSystem_Storage_Archetype,
+                         actorCounts[a], typeCounts[t], elementSizes[e]);
+            }
+         }
+      }
+   }
+   
+#if defined(__linux__)
+   if(counter.perfFd >= 0)
+   {
+      close(counter.perfFd);
+   }
+#endif
+   return 0;
+}
+
+static void runConfig(Counter_T * counter, CompSystem_Storage_T storage, 
+                      int actors, int types, int elementSize)
+{
+   CompSystem_Query_T query;
+   CompSystem_T sys;
+   Measure_T measure;
+   comptypeid_t typeIds[BENCH_MAX_TYPES];
+   actorid_t * actorArray;
+   byte_t * comp, * base;
+   unsigned int state, sum, swap;
+   double bytesPerActor;
+   int reps, r, i, t, j, count;
+   
+   // The timed passes use the default allocator, memory is counted apart
+   bytesPerActor = measureBytes(counter, storage, actors, types, elementSize);
+   sys = CompSystem_CreateWithStorage(storage);
+   setupWorld(sys, typeIds, types, elementSize);
+   actorArray = malloc(sizeof(actorid_t) * actors);
+   reps = (actors < BENCH_MIN_OPS) ? BENCH_MIN_OPS / actors : 1;
+   
+   measureBegin(counter, &measure);
+   createActors(sys, typeIds, types, elementSize, actorArray, actors);
+   measureEnd(counter, &measure, "create", storage, actors, types, elementSize, 
+              actors, bytesPerActor);
+   
+   // Lookups and removals visit the actors in a shuffled order
+   state = 12345u;
+   for(i = actors - 1; i > 0; i--)
+   {
+      j = nextRandom(&state) % (i + 1);
+      swap = actorArray[i];
+      actorArray[i] = actorArray[j];
+      actorArray[j] = swap;
+   }
+   
+   sum = 0;
+   measureBegin(counter, &measure);
+   for(r = 0; r < reps; r++)
+   {
+      for(i = 0; i < actors; i++)
+      {
+         CompSystem_GetComponent(sys, actorArray[i], typeIds[0], NULL, (void**)&comp);
+         sum += comp[0];
+      }
+   }
+   measureEnd(counter, &measure, "get_random", storage, actors, types, elementSize, 
+              (long long)reps * actors, bytesPerActor);
+   
+   // Iterate reads every byte of one pool
+   measureBegin(counter, &measure);
+   for(r = 0; r < reps; r++)
+   {
+      CompSystem_ComponentFor(sys, typeIds[0], (void**)&base, &count);
+      for(i = 0; i < count * elementSize; i += sizeof(unsigned int))
+      {
+         sum += *(unsigned int *)&base[i];
+      }
+   }
+   measureEnd(counter, &measure, "iterate", storage, actors, types, elementSize, 
+              (long long)reps * actors, bytesPerActor);
+   
+   // Join every type, touching one word of each component
+   if(types > 1)
+   {
+      measureBegin(counter, &measure);
+      for(r = 0; r < reps; r++)
+      {
+         CompSystem_QueryBegin(sys, &query, typeIds, types, NULL, 0);
+         for(CompSystem_QueryNext(&query, &count); count > 0; CompSystem_QueryNext(&query, &count))
+         {
+            for(t = 0; t < types; t++)
+            {
+               base = query.base[t];
+               for(i = 0; i < count; i++)
+               {
+                  sum += *(unsigned int *)&base[(size_t)query.index[t][i] * elementSize];
+               }
+            }
+         }
+      }
+      measureEnd(counter, &measure, "join", storage, actors, types, elementSize, 
+                 (long long)reps * actors, bytesPerActor);
+   }
+   sink = sum;
+   
+   measureBegin(counter, &measure);
+   for(i = 0; i < actors; i++)
+   {
+      CompSystem_RemoveActor(sys, actorArray[i]);
+   }
+   measureEnd(counter, &measure, "remove", storage, actors, types, elementSize, 
+              actors, bytesPerActor);
+   
+   CompSystem_Destroy(sys);
+   free(actorArray);
+}
+
+static void setupWorld(CompSystem_T sys, comptypeid_t * typeIds, int types, int elementSize)
+{
+   int t;
+   
+   for(t = 0; t < types; t++)
+   {
+      CompSystem_NewType(sys, &typeIds[t]);
+      CompSystem_SetType(sys, typeIds[t], elementSize, NULL);
+   }
+}
+
+// Create: one actor with every type
+static void createActors(CompSystem_T sys, const comptypeid_t * typeIds, int types, 
+                         int elementSize, actorid_t * actorArray, int actors)
+{
+   byte_t * comp;
+   int i, t;
+   
+   for(i = 0; i < actors; i++)
+   {
+      CompSystem_NewActor(sys, &actorArray[i]);
+      for(t = 0; t < types; t++)
+      {
+         CompSystem_SetComponent(sys, actorArray[i], typeIds[t], (void**)&comp);
+         memset(comp, i, elementSize);
+      }
+   }
+}
+
+// Builds the same world through the counting allocator, untimed
+static double measureBytes(Counter_T * counter, CompSystem_Storage_T storage, 
+                           int actors, int types, int elementSize)
+{
+   CompSystem_Allocator_T allocator;
+   CompSystem_T sys;
+   comptypeid_t typeIds[BENCH_MAX_TYPES];
+   actorid_t * actorArray;
+   size_t baseLive;
+   double bytesPerActor;
+   
+   allocator.allocFunc   = countingAlloc;
+   allocator.reallocFunc = countingRealloc;
+   allocator.freeFunc    = countingFree;
+   allocator.context     = counter;
+   baseLive = counter->live;
+   sys = CompSystem_CreateWithAllocator(&allocator, storage);
+   setupWorld(sys, typeIds, types, elementSize);
+   actorArray = malloc(sizeof(actorid_t) * actors);
+   createActors(sys, typeIds, types, elementSize, actorArray, actors);
+   bytesPerActor = (double)(counter->live - baseLive) / actors;
+   CompSystem_Destroy(sys);
+   free(actorArray);
+   return bytesPerActor;
+}
+
+static void measureBegin(const Counter_T * counter, Measure_T * measure)
+{
+   measure->startMisses = readMisses(counter);
+   measure->startTime   = nowNs();
+}
+
+static void measureEnd(const Counter_T * counter, const Measure_T * measure, 
+                       const char * name, CompSystem_Storage_T storage, 
+                       int actors, int types, int elementSize, 
+                       long long ops, double bytesPerActor)
+{
+   double elapsed;
+   long long misses;
+   
+   elapsed = nowNs() - measure->startTime;
+   misses  = readMisses(counter);
+   printf("%s,%s,%d,%d,%d,%.3f,%.1f,", name, 
+          (storage == eCompSystem_Storage_Packed) ? "packed" : "archetype",
+          actors, types, elementSize, elapsed / (double)ops, bytesPerActor);
+   if(misses >= 0 && measure->startMisses >= 0)
+   {
+      printf("%.4f\n", (double)(misses - measure->startMisses) / (double)ops);
+   }
+   else
+   {
+      printf("-\n");
+   }
+   fflush(stdout);
+}
+
+static double nowNs(void)
+{
+#if defined(_WIN32)
+   LARGE_INTEGER counter, frequency;
+   QueryPerformanceCounter(&counter);
+   QueryPerformanceFrequency(&frequency);
+   return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+#endif
+}
+
+static void openMissCounter(Counter_T * counter)
+{
+#if defined(__linux__)
+   struct perf_event_attr attr;
+   
+   memset(&attr, 0, sizeof(attr));
+   attr.type           = PERF_TYPE_HARDWARE;
+   attr.size           = sizeof(attr);
+   attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv     = 1;
+   counter->perfFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+   if(counter->perfFd >= 0)
+   {
+      ioctl(counter->perfFd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter->perfFd, PERF_EVENT_IOC_ENABLE, 0);
+   }
+#else
+   counter->perfFd = -1;
+#endif
+}
+
+static long long readMisses(const Counter_T * counter)
+{
+#if defined(__linux__)
+   long long value;
+   
+   if(counter->perfFd >= 0 && read(counter->perfFd, &value, sizeof(value)) == sizeof(value))
+   {
+      return value;
+   }
+#else
+   (void)counter;
+#endif
+   return -1;
+}
+
+static unsigned int nextRandom(unsigned int * state)
+{
+   (*state) = (*state) * 1664525u + 1013904223u;
+   return (*state) >> 8;
+}
+
+// Counts live bytes, over-aligned blocks keep the malloc pointer before them
+static void * countingAlloc(void * context, size_t size, size_t alignment)
+{
+   Counter_T * counter;
+   byte_t * block, * aligned;
+   
+   counter = context;
+   block = malloc(size + alignment + sizeof(void *));
+   if(block == NULL)
+   {
+      return NULL;
+   }
+   aligned = (byte_t *)(((size_t)(block + sizeof(void *)) + alignment - 1) & ~(alignment - 1));
+   memcpy(aligned - sizeof(void *), &block, sizeof(void *));
+   counter->live += size;
+   return aligned;
+}
+
+static void * countingRealloc(void * context, void * ptr, size_t oldSize, size_t newSize, 
+                              size_t alignment)
+{
+   void * temp;
+   
+   temp = countingAlloc(context, newSize, alignment);
+   if(temp != NULL && ptr != NULL)
+   {
+      memcpy(temp, ptr, (oldSize < newSize) ? oldSize : newSize);
+      countingFree(context, ptr, oldSize, alignment);
+   }
+   return temp;
+}
+
+static void countingFree(void * context, void * ptr, size_t size, size_t alignment)
+{
+   Counter_T * counter;
+   void * block;
+   (void)alignment;
+   
+   if(ptr == NULL)
+   {
+      return;
+   }
+   counter = context;
+   memcpy(&block, (byte_t *)ptr - sizeof(void *), sizeof(void *));
+   counter->live -= size;
+   free(block);
+}
@@ -25,8 +25,16 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 #include <stdio.h>
+#include <string.h>
 #include "CompSystem.h"
 
+// The checks below compare the system against a plain model of its actors
+#define MODEL_ACTORS  64
+#define MODEL_SEEDS   30
+#define MODEL_FRAMES  200
+#define SNAPSHOT_FILE "testmain.snap"
+#define COMMAND_ACTORS 1000
+
 typedef enum comp_e
 {
    eComp_Position,
@@ -35,12 +43,67 @@ typedef enum comp_e
    eComp_Last
 } Comp_T;
 
+typedef struct modelentry_s
+{
+   actorid_t id;
+   int value;
+   int hasField;
+   int field[2];
+} ModelEntry_T;
+
+typedef struct model_s
+{
+   ModelEntry_T entryArray[MODEL_ACTORS];
+   int count;
+} Model_T;
+
+typedef struct markjob_s
+{
+   CompSystem_T sys;
+   comptypeid_t type;
+} MarkJob_T;
+
+typedef struct deferjob_s
+{
+   CompSystem_T sys;
+   comptypeid_t types[3];
+   actorid_t pendingArray[COMMAND_ACTORS];
+   int threadArray[COMMAND_ACTORS];
+} DeferJob_T;
+
+static int failures;
+static unsigned int seed;
+
 static void createTypes(CompSystem_T sys, comptypeid_t * types);
 static void addActors(CompSystem_T sys, comptypeid_t * types, int start, int count);
 static void loop(CompSystem_T sys, comptypeid_t * types);
 static void jumptest(CompSystem_T sys, comptypeid_t * types, actorid_t actor);
 static void destroy(int * comp, CompSystem_T sys, comptypeid_t type, actorid_t actor);
 
+static void check(int condition, const char * name);
+static int nextRandom(int range);
+static void createModelTypes(CompSystem_T sys, comptypeid_t * types);
+static void setField(CompSystem_T sys, comptypeid_t type, actorid_t actor, const int * field);
+static void addModelActor(CompSystem_T sys, const comptypeid_t * types, Model_T * model);
+static void stepModel(CompSystem_T sys, const comptypeid_t * types, Model_T * model);
+static int checkModel(CompSystem_T sys, const comptypeid_t * types, const Model_T * model);
+static void rollbacktest(void);
+static void markKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData);
+static void paralleltest(void);
+static void snapshottest(void);
+static int compareInts(const void * compA, const void * compB, void * userData);
+static int checkQuery(CompSystem_T sys, const comptypeid_t * types, int query);
+static int checkGroup(CompSystem_T sys, const comptypeid_t * types, int group);
+static void querytest(CompSystem_Storage_T storage);
+static void addKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData);
+static void addQueryKernel(const CompSystem_Query_T * batch, int threadIndex, void * userData);
+static void parallelSystem(CompSystem_T sys, int threadIndex, void * userData);
+static void systemstest(void);
+static void deferKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData);
+static int checkFields(CompSystem_T sys, comptypeid_t type, actorid_t actor, int first, int second);
+static void commandstest(void);
+static void handletest(void);
+
 int main(int argc, char * args[])
 {
    CompSystem_T sys;
@@ -70,7 +133,17 @@ int main(int argc, char * args[])
    
    CompSystem_Destroy(sys);
    printf("HelloWorld\n");
-   return 0;
+   
+   rollbacktest();
+   paralleltest();
+   snapshottest();
+   querytest(eCompSystem_Storage_Packed);
+   querytest(eCompSystem_Storage_Archetype);
+   systemstest();
+   commandstest();
+   handletest();
+   printf("Checks failed: %i\n", failures);
+   return failures > 0;
 }
 
 static void createTypes(CompSystem_T sys, comptypeid_t * types)
@@ -148,3 +221,726 @@ static void destroy(int * comp, CompSystem_T sys, comptypeid_t type, actorid_t a
    printf("Destroy: (a, t, v) = (%i, %i, %i)\n", actor, type, *comp);
 }
 
+static void check(int condition, const char * name)
+{
+   if(!condition)
+   {
+      printf("Check failed: %s\n", name);
+      failures ++;
+   }
+}
+
+static int nextRandom(int range)
+{
+   seed = seed * 1103515245u + 12345u;
+   return (int)((seed >> 16) % (unsigned int)range);
+}
+
+static void createModelTypes(CompSystem_T sys, comptypeid_t * types)
+{
+   CompSystem_Field_T fields[2] = { { sizeof(int) }, { sizeof(int) } };
+   
+   CompSystem_NewType(sys, &types[0]);
+   CompSystem_SetType(sys, types[0], sizeof(int), NULL);
+   CompSystem_NewType(sys, &types[1]);
+   CompSystem_SetTypeFields(sys, types[1], fields, 2);
+}
+
+static void setField(CompSystem_T sys, comptypeid_t type, actorid_t actor, const int * field)
+{
+   void * columns[2];
+   int index, size;
+   
+   CompSystem_GetComponent(sys, actor, type, &index, NULL);
+   CompSystem_ColumnsFor(sys, type, columns, &size);
+   ((int *)columns[0])[index] = field[0];
+   ((int *)columns[1])[index] = field[1];
+}
+
+static void addModelActor(CompSystem_T sys, const comptypeid_t * types, Model_T * model)
+{
+   ModelEntry_T * entryPtr;
+   int * comp;
+   
+   entryPtr = &model->entryArray[model->count];
+   model->count ++;
+   CompSystem_NewActor(sys, &entryPtr->id);
+   CompSystem_SetComponent(sys, entryPtr->id, types[0], (void**)&comp);
+   entryPtr->value = nextRandom(1000);
+   (*comp) = entryPtr->value;
+   
+   entryPtr->hasField = nextRandom(2);
+   if(entryPtr->hasField)
+   {
+      CompSystem_SetComponent(sys, entryPtr->id, types[1], (void**)&comp);
+      entryPtr->field[0] = nextRandom(1000);
+      entryPtr->field[1] = -nextRandom(1000);
+      setField(sys, types[1], entryPtr->id, entryPtr->field);
+   }
+}
+
+// One random edit applied to both the system and the model
+static void stepModel(CompSystem_T sys, const comptypeid_t * types, Model_T * model)
+{
+   ModelEntry_T * entryPtr;
+   CompSystem_TypeMask_T mask;
+   actorid_t ids[3];
+   int * comp, op, i;
+   
+   op = model->count > 0 ? nextRandom(6) : 0;
+   if(model->count + 3 > MODEL_ACTORS && (op == 0 || op == 4))
+   {
+      op = 1;
+   }
+   entryPtr = &model->entryArray[model->count > 0 ? nextRandom(model->count) : 0];
+   switch(op)
+   {
+   case 0:
+      addModelActor(sys, types, model);
+      break;
+   case 1:
+      CompSystem_RemoveActor(sys, entryPtr->id);
+      model->count --;
+      (*entryPtr) = model->entryArray[model->count];
+      break;
+   case 2:
+      CompSystem_SetComponent(sys, entryPtr->id, types[0], (void**)&comp);
+      entryPtr->value = nextRandom(1000);
+      (*comp) = entryPtr->value;
+      break;
+   case 3:
+      if(entryPtr->hasField)
+      {
+         CompSystem_RemoveComponent(sys, entryPtr->id, types[1]);
+         entryPtr->hasField = 0;
+      }
+      else
+      {
+         CompSystem_SetComponent(sys, entryPtr->id, types[1], (void**)&comp);
+         entryPtr->hasField = 1;
+         entryPtr->field[0] = nextRandom(1000);
+         entryPtr->field[1] = -nextRandom(1000);
+         setField(sys, types[1], entryPtr->id, entryPtr->field);
+      }
+      break;
+   case 4:
+      memset(&mask, 0, sizeof(CompSystem_TypeMask_T));
+      COMPSYSTEM_MASK_SET(mask, types[0]);
+      COMPSYSTEM_MASK_SET(mask, types[1]);
+      CompSystem_NewActors(sys, 3, &mask, ids);
+      for(i = 0; i < 3; i++)
+      {
+         entryPtr = &model->entryArray[model->count];
+         model->count ++;
+         entryPtr->id = ids[i];
+         entryPtr->value = nextRandom(1000);
+         CompSystem_GetComponent(sys, ids[i], types[0], NULL, (void**)&comp);
+         (*comp) = entryPtr->value;
+         entryPtr->hasField = 1;
+         entryPtr->field[0] = nextRandom(1000);
+         entryPtr->field[1] = -nextRandom(1000);
+         setField(sys, types[1], ids[i], entryPtr->field);
+      }
+      break;
+   default:
+      // Writes in place are marked first, as frame captures require
+      if(entryPtr->hasField)
+      {
+         CompSystem_MarkChanged(sys, entryPtr->id, types[1]);
+         entryPtr->field[1] = -nextRandom(1000);
+         setField(sys, types[1], entryPtr->id, entryPtr->field);
+      }
+      break;
+   }
+}
+
+static int checkModel(CompSystem_T sys, const comptypeid_t * types, const Model_T * model)
+{
+   const ModelEntry_T * entryPtr;
+   void * columns[2];
+   int * value;
+   int i, count, fieldCount, size, alive, has, index;
+   
+   CompSystem_GetActorCount(sys, &count);
+   CompSystem_ColumnsFor(sys, types[1], columns, &size);
+   if(count != model->count)
+   {
+      return 0;
+   }
+   
+   fieldCount = 0;
+   for(i = 0; i < model->count; i++)
+   {
+      entryPtr = &model->entryArray[i];
+      CompSystem_IsActorAlive(sys, entryPtr->id, &alive);
+      CompSystem_GetComponent(sys, entryPtr->id, types[0], NULL, (void**)&value);
+      CompSystem_HasComponent(sys, entryPtr->id, types[1], &has);
+      if(!alive || value == NULL || (*value) != entryPtr->value || 
+         (has != 0) != entryPtr->hasField)
+      {
+         return 0;
+      }
+      if(has)
+      {
+         CompSystem_GetComponent(sys, entryPtr->id, types[1], &index, NULL);
+         if(((int *)columns[0])[index] != entryPtr->field[0] || 
+            ((int *)columns[1])[index] != entryPtr->field[1])
+         {
+            return 0;
+         }
+         fieldCount ++;
+      }
+   }
+   return fieldCount == size;
+}
+
+static void rollbacktest(void)
+{
+   CompSystem_T sys;
+   comptypeid_t types[2];
+   Model_T model, history[COMPSYSTEM_ROLLBACK_FRAMES];
+   int run, frame, frames, i, frameCount, rewound, matches;
+   
+   // history[i] is the state the i-th frame still held by the system began at
+   for(run = 0; run < MODEL_SEEDS; run++)
+   {
+      seed = run + 1;
+      sys = CompSystem_Create();
+      createModelTypes(sys, types);
+      model.count = 0;
+      frames = 0;
+      matches = 1;
+      for(frame = 0; frame < MODEL_FRAMES && matches; frame++)
+      {
+         CompSystem_BeginFrameCapture(sys);
+         if(frames == COMPSYSTEM_ROLLBACK_FRAMES)
+         {
+            memmove(history, &history[1], sizeof(Model_T) * (frames - 1));
+            frames --;
+         }
+         history[frames] = model;
+         frames ++;
+         
+         for(i = 0; i < 5; i++)
+         {
+            stepModel(sys, types, &model);
+         }
+         if(nextRandom(4) == 0)
+         {
+            frameCount = 1 + nextRandom(frames);
+            CompSystem_Rewind(sys, frameCount, &rewound);
+            model = history[frames - frameCount];
+            frames = frames - frameCount + 1;
+            matches = rewound == frameCount;
+         }
+         matches = matches && checkModel(sys, types, &model);
+      }
+      check(matches, "Rewind restores the captured frames");
+      CompSystem_Destroy(sys);
+   }
+}
+
+static void markKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData)
+{
+   MarkJob_T * job;
+   int i;
+   
+   (void)threadIndex;
+   job = userData;
+   CompSystem_MarkChangedRange(job->sys, job->type, baseIndex, count);
+   for(i = 0; i < count; i++)
+   {
+      ((int *)comps)[i] += 1000;
+   }
+}
+
+static void paralleltest(void)
+{
+   MarkJob_T job;
+   actorid_t actor;
+   int * comp, i, count, rewound, matches;
+   
+   job.sys = CompSystem_Create();
+   CompSystem_SetThreadCount(job.sys, 4);
+   CompSystem_NewType(job.sys, &job.type);
+   CompSystem_SetType(job.sys, job.type, sizeof(int), NULL);
+   for(i = 0; i < 100000; i++)
+   {
+      CompSystem_NewActor(job.sys, &actor);
+      CompSystem_SetComponent(job.sys, actor, job.type, (void**)&comp);
+      (*comp) = i;
+   }
+   
+   // Every worker journals its own slices into the same frame
+   CompSystem_BeginFrameCapture(job.sys);
+   CompSystem_ParallelFor(job.sys, job.type, markKernel, &job, 64);
+   CompSystem_Rewind(job.sys, 1, &rewound);
+   CompSystem_ComponentFor(job.sys, job.type, (void**)&comp, &count);
+   matches = rewound == 1 && count == 100000;
+   for(i = 0; i < count; i++)
+   {
+      matches = matches && comp[i] == i;
+   }
+   check(matches, "Rewind undoes ranges marked by parallel kernels");
+   CompSystem_Destroy(job.sys);
+}
+
+static void snapshottest(void)
+{
+   CompSystem_T sys, loaded;
+   comptypeid_t types[2];
+   Model_T model;
+   int i, saved, done;
+   
+   seed = 7;
+   sys = CompSystem_Create();
+   createModelTypes(sys, types);
+   model.count = 0;
+   for(i = 0; i < 500; i++)
+   {
+      stepModel(sys, types, &model);
+   }
+   CompSystem_SaveSnapshot(sys, SNAPSHOT_FILE, &saved);
+   loaded = CompSystem_Create();
+   createModelTypes(loaded, types);
+   CompSystem_LoadSnapshot(loaded, SNAPSHOT_FILE, NULL, NULL, &done);
+   check(saved && done && checkModel(loaded, types, &model), "Snapshot round trip");
+   
+   // Save over the file the pools were loaded from, then load it back
+   for(i = 0; i < 100; i++)
+   {
+      stepModel(loaded, types, &model);
+   }
+   CompSystem_SaveSnapshot(loaded, SNAPSHOT_FILE, &saved);
+   check(saved && checkModel(loaded, types, &model), "Snapshot saved over its own file");
+   CompSystem_LoadSnapshot(sys, SNAPSHOT_FILE, NULL, NULL, &done);
+   check(done && checkModel(sys, types, &model), "Snapshot saved over its own file loads");
+   
+   CompSystem_Destroy(loaded);
+   CompSystem_Destroy(sys);
+   remove(SNAPSHOT_FILE);
+}
+
+static int compareInts(const void * compA, const void * compB, void * userData)
+{
+   (void)userData;
+   return *(const int *)compA - *(const int *)compB;
+}
+
+// The cached query holds exactly the actors owning types 0 and 1 but not 2
+static int checkQuery(CompSystem_T sys, const comptypeid_t * types, int query)
+{
+   const actorid_t * actors;
+   const int * indices;
+   actorid_t actor;
+   int i, j, count, actorCount, expected, has[3], index[2];
+   
+   CompSystem_GetActorCount(sys, &actorCount);
+   expected = 0;
+   for(i = 0; i < actorCount; i++)
+   {
+      CompSystem_GetActor(sys, i, &actor);
+      for(j = 0; j < 3; j++)
+      {
+         CompSystem_HasComponent(sys, actor, types[j], &has[j]);
+      }
+      expected += has[0] && has[1] && !has[2];
+   }
+   
+   CompSystem_QueryMatches(sys, query, &actors, &indices, &count);
+   if(count != expected)
+   {
+      return 0;
+   }
+   for(i = 0; i < count; i++)
+   {
+      for(j = 0; j < i; j++)
+      {
+         if(actors[j] == actors[i])
+         {
+            return 0;
+         }
+      }
+      CompSystem_HasComponent(sys, actors[i], types[2], &has[2]);
+      CompSystem_GetComponent(sys, actors[i], types[0], &index[0], NULL);
+      CompSystem_GetComponent(sys, actors[i], types[1], &index[1], NULL);
+      if(has[2] || index[0] != indices[i * 2] || index[1] != indices[i * 2 + 1])
+      {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+// The group keeps the actors owning types 0 and 1 at the front of both pools
+static int checkGroup(CompSystem_T sys, const comptypeid_t * types, int group)
+{
+   actorid_t actor, owner[2];
+   int i, actorCount, expected, size, has[2];
+   
+   CompSystem_GetActorCount(sys, &actorCount);
+   expected = 0;
+   for(i = 0; i < actorCount; i++)
+   {
+      CompSystem_GetActor(sys, i, &actor);
+      CompSystem_HasComponent(sys, actor, types[0], &has[0]);
+      CompSystem_HasComponent(sys, actor, types[1], &has[1]);
+      expected += has[0] && has[1];
+   }
+   
+   CompSystem_GetGroupSize(sys, group, &size);
+   for(i = 0; i < size; i++)
+   {
+      CompSystem_GetComponentActor(sys, types[0], i, &owner[0]);
+      CompSystem_GetComponentActor(sys, types[1], i, &owner[1]);
+      if(owner[0] != owner[1])
+      {
+         return 0;
+      }
+   }
+   return size == expected;
+}
+
+static void querytest(CompSystem_Storage_T storage)
+{
+   CompSystem_T sys;
+   comptypeid_t types[3];
+   actorid_t actors[2];
+   int * comp, run, step, i, type, has, count, query, group, matches, grouped;
+   
+   for(run = 0; run < MODEL_SEEDS; run++)
+   {
+      seed = run + 100;
+      sys = CompSystem_CreateWithStorage(storage);
+      for(i = 0; i < 3; i++)
+      {
+         CompSystem_NewType(sys, &types[i]);
+         CompSystem_SetType(sys, types[i], sizeof(int), NULL);
+      }
+      CompSystem_CreateQuery(sys, types, 2, &types[2], 1, &query);
+      group = COMPSYSTEM_INVALID_INDEX;
+      if(storage == eCompSystem_Storage_Packed)
+      {
+         CompSystem_GroupTypes(sys, types, 2, &group);
+      }
+      
+      matches = 1;
+      grouped = 1;
+      for(step = 0; step < MODEL_FRAMES && matches && grouped; step++)
+      {
+         CompSystem_GetActorCount(sys, &count);
+         switch(count > 0 ? nextRandom(5) : 0)
+         {
+         case 0:
+            if(count < MODEL_ACTORS)
+            {
+               CompSystem_NewActor(sys, &actors[0]);
+               for(i = 0; i < 3; i++)
+               {
+                  if(nextRandom(3) > 0)
+                  {
+                     CompSystem_SetComponent(sys, actors[0], types[i], (void**)&comp);
+                     (*comp) = nextRandom(1000);
+                  }
+               }
+            }
+            break;
+         case 1:
+            CompSystem_GetActor(sys, nextRandom(count), &actors[0]);
+            CompSystem_RemoveActor(sys, actors[0]);
+            break;
+         case 2:
+            CompSystem_GetActor(sys, nextRandom(count), &actors[0]);
+            CompSystem_GetActor(sys, nextRandom(count), &actors[1]);
+            CompSystem_RemoveActors(sys, actors, actors[0] == actors[1] ? 1 : 2);
+            break;
+         case 3:
+            CompSystem_SortType(sys, types[nextRandom(3)], compareInts, NULL);
+            break;
+         default:
+            CompSystem_GetActor(sys, nextRandom(count), &actors[0]);
+            type = types[nextRandom(3)];
+            CompSystem_HasComponent(sys, actors[0], type, &has);
+            if(has)
+            {
+               CompSystem_RemoveComponent(sys, actors[0], type);
+            }
+            else
+            {
+               CompSystem_SetComponent(sys, actors[0], type, (void**)&comp);
+               (*comp) = nextRandom(1000);
+            }
+            break;
+         }
+         matches = checkQuery(sys, types, query);
+         grouped = group == COMPSYSTEM_INVALID_INDEX || checkGroup(sys, types, group);
+      }
+      check(matches, "Cached query matches the actors");
+      check(grouped, "Group keeps its actors at the front of its pools");
+      CompSystem_Destroy(sys);
+   }
+}
+
+static void addKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData)
+{
+   int i;
+   
+   (void)baseIndex;
+   (void)threadIndex;
+   for(i = 0; i < count; i++)
+   {
+      ((int *)comps)[i] += *(const int *)userData;
+   }
+}
+
+static void addQueryKernel(const CompSystem_Query_T * batch, int threadIndex, void * userData)
+{
+   int i;
+   
+   (void)threadIndex;
+   for(i = 0; i < batch->count; i++)
+   {
+      ((int *)batch->base[0])[batch->index[0][i]] += *(const int *)userData;
+   }
+}
+
+// Writes only its own type, so it shares a wave with the other system
+static void parallelSystem(CompSystem_T sys, int threadIndex, void * userData)
+{
+   static const int one = 1, ten = 10;
+   comptypeid_t type;
+   
+   (void)threadIndex;
+   type = *(const comptypeid_t *)userData;
+   CompSystem_ParallelFor(sys, type, addKernel, (void *)&one, 16);
+   CompSystem_ParallelQuery(sys, &type, 1, NULL, 0, addQueryKernel, (void *)&ten, 16);
+}
+
+static void systemstest(void)
+{
+   CompSystem_T sys;
+   comptypeid_t types[2];
+   actorid_t actor;
+   int * comp, i, run, count, systemIndex, matches;
+   
+   sys = CompSystem_Create();
+   CompSystem_SetThreadCount(sys, 4);
+   for(i = 0; i < 2; i++)
+   {
+      CompSystem_NewType(sys, &types[i]);
+      CompSystem_SetType(sys, types[i], sizeof(int), NULL);
+      CompSystem_AddSystem(sys, parallelSystem, &types[i], NULL, 0, &types[i], 1, &systemIndex);
+   }
+   for(i = 0; i < 1000; i++)
+   {
+      CompSystem_NewActor(sys, &actor);
+      CompSystem_SetComponent(sys, actor, types[0], (void**)&comp);
+      (*comp) = 0;
+      CompSystem_SetComponent(sys, actor, types[1], (void**)&comp);
+      (*comp) = 0;
+   }
+   
+   // The parallel calls of both systems run nested in the wave's pool run
+   for(run = 0; run < 20; run++)
+   {
+      CompSystem_RunSystems(sys);
+   }
+   matches = 1;
+   for(i = 0; i < 2; i++)
+   {
+      CompSystem_ComponentFor(sys, types[i], (void**)&comp, &count);
+      while(count > 0)
+      {
+         count --;
+         matches = matches && comp[count] == 20 * 11;
+      }
+   }
+   check(matches, "Systems sharing a wave may use the parallel calls");
+   CompSystem_Destroy(sys);
+}
+
+// Actor v removes itself when v % 5 == 0, spawns a tagged actor with both
+// components when v % 3 == 0 and gets a field component when v % 7 == 0
+static void deferKernel(void * comps, int count, int baseIndex, int threadIndex, void * userData)
+{
+   CompSystem_CommandBuffer_T buffer;
+   DeferJob_T * job;
+   actorid_t actor;
+   int i, value, spawned, field[2];
+   
+   job = userData;
+   CompSystem_GetCommandBuffer(job->sys, threadIndex, &buffer);
+   for(i = 0; i < count; i++)
+   {
+      value = ((int *)comps)[i];
+      CompSystem_GetComponentActor(job->sys, job->types[0], baseIndex + i, &actor);
+      if(value % 3 == 0)
+      {
+         CompSystem_DeferNewActor(buffer, &job->pendingArray[value]);
+         job->threadArray[value] = threadIndex;
+         spawned  = value + COMMAND_ACTORS;
+         field[0] = value;
+         field[1] = -value;
+         CompSystem_DeferSetComponent(buffer, job->pendingArray[value], job->types[0], &spawned);
+         CompSystem_DeferSetComponent(buffer, job->pendingArray[value], job->types[1], field);
+         CompSystem_DeferSetComponent(buffer, job->pendingArray[value], job->types[2], NULL);
+      }
+      if(value % 7 == 0)
+      {
+         field[0] = value * 2;
+         field[1] = value;
+         CompSystem_DeferSetComponent(buffer, actor, job->types[1], field);
+      }
+      if(value % 5 == 0)
+      {
+         CompSystem_DeferRemoveActor(buffer, actor);
+      }
+   }
+}
+
+static int checkFields(CompSystem_T sys, comptypeid_t type, actorid_t actor, int first, int second)
+{
+   void * columns[2];
+   int index, size;
+   
+   CompSystem_GetComponent(sys, actor, type, &index, NULL);
+   CompSystem_ColumnsFor(sys, type, columns, &size);
+   return index != COMPSYSTEM_INVALID_INDEX && 
+          ((int *)columns[0])[index] == first && ((int *)columns[1])[index] == second;
+}
+
+static void commandstest(void)
+{
+   static DeferJob_T job;
+   static actorid_t actors[COMMAND_ACTORS];
+   CompSystem_Field_T fields[2] = { { sizeof(int) }, { sizeof(int) } };
+   CompSystem_CommandBuffer_T buffers[2];
+   actorid_t actor, pending;
+   int * comp, i, value, count, expected, alive, has, matches;
+   
+   job.sys = CompSystem_Create();
+   CompSystem_SetThreadCount(job.sys, 4);
+   for(i = 0; i < 3; i++)
+   {
+      CompSystem_NewType(job.sys, &job.types[i]);
+   }
+   CompSystem_SetType(job.sys, job.types[0], sizeof(int), NULL);
+   CompSystem_SetTypeFields(job.sys, job.types[1], fields, 2);
+   CompSystem_SetType(job.sys, job.types[2], 0, NULL);
+   for(i = 0; i < COMMAND_ACTORS; i++)
+   {
+      CompSystem_NewActor(job.sys, &actors[i]);
+      CompSystem_SetComponent(job.sys, actors[i], job.types[0], (void**)&comp);
+      (*comp) = i;
+   }
+   
+   // Workers record, the flush afterwards applies every buffer
+   CompSystem_ParallelFor(job.sys, job.types[0], deferKernel, &job, 16);
+   CompSystem_Flush(job.sys);
+   
+   expected = 0;
+   matches = 1;
+   for(value = 0; value < COMMAND_ACTORS; value++)
+   {
+      CompSystem_IsActorAlive(job.sys, actors[value], &alive);
+      CompSystem_GetComponent(job.sys, actors[value], job.types[0], NULL, (void**)&comp);
+      CompSystem_HasComponent(job.sys, actors[value], job.types[1], &has);
+      if(value % 5 == 0)
+      {
+         matches = matches && !alive;
+      }
+      else
+      {
+         expected ++;
+         matches = matches && alive && comp != NULL && (*comp) == value && 
+                   (has != 0) == (value % 7 == 0) && 
+                   (!has || checkFields(job.sys, job.types[1], actors[value], value * 2, value));
+      }
+      
+      // Pending handles resolve through the buffer that recorded them
+      if(value % 3 == 0)
+      {
+         expected ++;
+         CompSystem_GetCommandBuffer(job.sys, job.threadArray[value], &buffers[0]);
+         CompSystem_ResolveActor(buffers[0], job.pendingArray[value], &actor);
+         CompSystem_GetComponent(job.sys, actor, job.types[0], NULL, (void**)&comp);
+         CompSystem_HasComponent(job.sys, actor, job.types[2], &has);
+         matches = matches && comp != NULL && (*comp) == value + COMMAND_ACTORS && has && 
+                   checkFields(job.sys, job.types[1], actor, value, -value);
+      }
+   }
+   CompSystem_GetActorCount(job.sys, &count);
+   check(matches && count == expected, "Commands recorded by workers match the serial model");
+   
+   // Buffer 0 is applied first, each buffer in recording order
+   CompSystem_GetCommandBuffer(job.sys, 0, &buffers[0]);
+   CompSystem_GetCommandBuffer(job.sys, 1, &buffers[1]);
+   value = 1;
+   CompSystem_DeferSetComponent(buffers[1], actors[1], job.types[0], &value);
+   value = 2;
+   CompSystem_DeferSetComponent(buffers[0], actors[1], job.types[0], &value);
+   value = 3;
+   CompSystem_DeferSetComponent(buffers[1], actors[2], job.types[0], &value);
+   value = 4;
+   CompSystem_DeferSetComponent(buffers[1], actors[2], job.types[0], &value);
+   CompSystem_DeferSetComponent(buffers[0], actors[4], job.types[0], &value);
+   CompSystem_DeferRemoveActor(buffers[1], actors[4]);
+   CompSystem_DeferNewActor(buffers[0], &pending);
+   CompSystem_DeferRemoveActor(buffers[0], pending);
+   CompSystem_Flush(job.sys);
+   
+   CompSystem_GetComponent(job.sys, actors[1], job.types[0], NULL, (void**)&comp);
+   matches = comp != NULL && (*comp) == 1;
+   CompSystem_GetComponent(job.sys, actors[2], job.types[0], NULL, (void**)&comp);
+   matches = matches && comp != NULL && (*comp) == 4;
+   CompSystem_IsActorAlive(job.sys, actors[4], &alive);
+   CompSystem_GetActorCount(job.sys, &count);
+   check(matches && !alive && count == expected - 1, "Flush applies buffers in order");
+   CompSystem_Destroy(job.sys);
+}
+
+static void handletest(void)
+{
+   CompSystem_T sys;
+   comptypeid_t type;
+   actorid_t first, actor, previous;
+   int * comp, i, alive, stale, reused, pending;
+   
+   sys = CompSystem_Create();
+   CompSystem_NewType(sys, &type);
+   CompSystem_SetType(sys, type, sizeof(int), NULL);
+   
+   // A removed actor's ID is rejected once its slot holds a new actor
+   CompSystem_NewActor(sys, &first);
+   CompSystem_RemoveActor(sys, first);
+   CompSystem_NewActor(sys, &actor);
+   CompSystem_SetComponent(sys, actor, type, (void**)&comp);
+   (*comp) = 5;
+   CompSystem_IsActorAlive(sys, first, &alive);
+   CompSystem_GetComponent(sys, first, type, NULL, (void**)&comp);
+   stale = !alive && comp == NULL;
+   CompSystem_SetComponent(sys, first, type, (void**)&comp);
+   CompSystem_RemoveActor(sys, first);
+   CompSystem_IsActorAlive(sys, actor, &alive);
+   stale = stale && comp == NULL && alive && actor != first && 
+           COMPSYSTEM_ACTOR_INDEX(actor) == COMPSYSTEM_ACTOR_INDEX(first);
+   CompSystem_GetComponent(sys, actor, type, NULL, (void**)&comp);
+   check(stale && comp != NULL && (*comp) == 5, "Stale actor IDs are rejected");
+   
+   // Cycling one slot through every generation never hands out the pending one
+   reused = 1;
+   pending = 0;
+   previous = actor;
+   for(i = 0; i < 2 * (int)COMPSYSTEM_ACTOR_GENERATION_MASK; i++)
+   {
+      CompSystem_RemoveActor(sys, previous);
+      CompSystem_NewActor(sys, &actor);
+      reused  = reused && actor != previous && 
+                COMPSYSTEM_ACTOR_INDEX(actor) == COMPSYSTEM_ACTOR_INDEX(first);
+      pending = pending || COMPSYSTEM_ACTOR_IS_PENDING(actor) || 
+                actor == COMPSYSTEM_INVALID_ACTOR;
+      previous = actor;
+   }
+   check(reused && !pending, "Live actors never use the top generation");
+   CompSystem_Destroy(sys);
+}
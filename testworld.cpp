@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * Copyright (c) 2014, Ryan Hanson
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the <organization> nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL RYAN HANSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <cstdio>
+#include "CompSystem.hpp"
+
+// Checks the C++ World front end in both storages and with a paged type
+#define WORLD_ACTORS 5000
+
+struct Position
+{
+   int x;
+};
+
+struct Velocity
+{
+   int vx;
+};
+
+struct alignas(32) Transform
+{
+   float m[8];
+};
+
+typedef CompSystem::World<Position, Velocity, Transform> World_T;
+
+static int failures;
+
+static void check(bool condition, const char * name)
+{
+   if(!condition)
+   {
+      std::printf("Check failed: %s\n", name);
+      failures ++;
+   }
+}
+
+// Every actor i gets a Position of i, odd ones a Velocity of i, and every
+// third one a Transform; every seventh actor is destroyed again
+static void fill(World_T & world, actorid_t * actors)
+{
+   int i;
+   
+   for(i = 0; i < WORLD_ACTORS; i++)
+   {
+      actors[i] = world.create();
+      world.add<Position>(actors[i], Position{ i });
+      if(i & 1)
+      {
+         world.add<Velocity>(actors[i], Velocity{ i });
+      }
+      if(i % 3 == 0)
+      {
+         world.add<Transform>(actors[i])->m[7] = (float)i;
+      }
+   }
+   for(i = 0; i < WORLD_ACTORS; i += 7)
+   {
+      world.destroy(actors[i]);
+   }
+}
+
+static void worldtest(CompSystem_Storage_T storage, bool paged, const char * name)
+{
+   static actorid_t actors[WORLD_ACTORS];
+   World_T world(storage);
+   int positions, joined, transforms, expected[3], i;
+   bool matches;
+   
+   // A paged Position pool spans several pages
+   if(paged)
+   {
+      CompSystem_SetTypePaged(world.raw(), World_T::TypeOf<Position>);
+   }
+   fill(world, actors);
+   
+   expected[0] = expected[1] = expected[2] = 0;
+   for(i = 0; i < WORLD_ACTORS; i++)
+   {
+      if(i % 7 != 0)
+      {
+         expected[0] ++;
+         expected[1] += i & 1;
+         expected[2] += i % 3 == 0;
+      }
+   }
+   
+   matches = world.alive(actors[1]) && !world.alive(actors[7]) && 
+             world.get<Position>(actors[1])->x == 1 && world.get<Velocity>(actors[2]) == nullptr;
+   check(matches, name);
+   
+   positions = 0;
+   matches = true;
+   world.each<Position>([&](Position & position)
+   {
+      positions ++;
+      matches = matches && position.x % 7 != 0;
+   });
+   check(matches && positions == expected[0], name);
+   
+   positions = 0;
+   world.each<Position>([&](actorid_t actor, Position & position)
+   {
+      positions ++;
+      matches = matches && world.get<Position>(actor) == &position;
+   });
+   check(matches && positions == expected[0], name);
+   
+   joined = 0;
+   world.each<Position, Velocity>([&](actorid_t actor, Position & position, Velocity & velocity)
+   {
+      joined ++;
+      matches = matches && world.get<Position>(actor) == &position && 
+                world.get<Velocity>(actor) == &velocity && position.x == velocity.vx;
+   });
+   check(matches && joined == expected[1], name);
+   
+   joined = 0;
+   world.each<Position, Velocity>([&](Position & position, Velocity & velocity)
+   {
+      joined ++;
+      position.x += velocity.vx;
+   });
+   check(joined == expected[1] && world.get<Position>(actors[3])->x == 6, name);
+   
+   transforms = 0;
+   world.each<Transform>([&](actorid_t actor, Transform & transform)
+   {
+      transforms ++;
+      matches = matches && ((size_t)&transform & 31) == 0 && world.has<Transform>(actor);
+   });
+   check(matches && transforms == expected[2], name);
+   
+   // Removing a component leaves the actor and its other components
+   world.remove<Velocity>(actors[1]);
+   joined = 0;
+   world.each<Position, Velocity>([&](Position &, Velocity &) { joined ++; });
+   check(!world.has<Velocity>(actors[1]) && world.alive(actors[1]) && 
+         world.get<Position>(actors[1])->x == 2 && joined == expected[1] - 1, name);
+}
+
+int main()
+{
+   worldtest(eCompSystem_Storage_Packed, false, "World with packed storage");
+   worldtest(eCompSystem_Storage_Archetype, false, "World with archetype storage");
+   worldtest(eCompSystem_Storage_Packed, true, "World with a paged type");
+   std::printf("Checks failed: %i\n", failures);
+   return failures > 0;
+}